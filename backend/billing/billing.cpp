@@ -0,0 +1,980 @@
+extern "C" {
+#include "journey_json.h"
+#include "journey_record.h"
+#include "stations.h"
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Monthly billing over a /journeys export. The export is split into one
+// slice per worker thread; each worker bills its slice into its own map of
+// per-card monthly totals and the maps are merged once all workers finish.
+// Gates record the fare of each journey at exit, so billing is a sum; only
+// journeys logged before fares were recorded are priced here, from the same
+// fare matrix (stations.c).
+//
+// Input is either NDJSON, one journey record per line as the gates write
+// them (`jq -c '.journeys[]' export.json` turns an RTDB export into this),
+// or a file of packed journey records (journey_record.h).
+
+namespace {
+
+constexpr size_t kUidMax = 10;
+
+// A journey reduced to what billing needs
+struct Trip {
+    uint8_t uid[kUidMax];
+    uint8_t uid_len;
+    int origin;
+    int selected;
+    int destination;
+    int train_class;
+    int fare;        // Rupees as recorded at exit, or -1 when not recorded
+    int state;
+    bool fraud;
+    int32_t month;   // year * 12 + month - 1, or -1 when the record has no usable time
+};
+
+// Card UID and billing month, packed into two words
+struct BillKey {
+    uint64_t uid_lo;   // UID bytes 0..7
+    uint64_t uid_hi;   // UID bytes 8..9, UID length, month
+
+    bool operator==(const BillKey &other) const {
+        return uid_lo == other.uid_lo && uid_hi == other.uid_hi;
+    }
+};
+
+struct BillKeyHash {
+    size_t operator()(const BillKey &key) const {
+        uint64_t h = key.uid_lo * 0x9E3779B97F4A7C15ull ^ (key.uid_hi + 0x632BE59BD9B4E019ull);
+        h ^= h >> 29;
+        h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 32;
+        return static_cast<size_t>(h);
+    }
+};
+
+struct Totals {
+    uint64_t fare = 0;
+    uint32_t journeys = 0;
+    uint32_t stops = 0;
+    uint32_t fraud_flagged = 0;
+
+    void add(const Totals &other) {
+        fare += other.fare;
+        journeys += other.journeys;
+        stops += other.stops;
+        fraud_flagged += other.fraud_flagged;
+    }
+};
+
+// Open-addressing table of card-months with linear probing. Once there are
+// more card-months than fit in cache, each journey costs one miss into a
+// flat array instead of a bucket and a node as with std::unordered_map.
+// A key always has a non-zero UID length, so uid_hi == 0 marks a free slot.
+class BillMap {
+public:
+    struct Slot {
+        BillKey key;
+        Totals totals;
+    };
+
+    Totals &operator[](const BillKey &key) {
+        if ((count_ + 1) * 2 > slots_.size()) {
+            grow();
+        }
+        size_t mask = slots_.size() - 1;
+        for (size_t i = BillKeyHash()(key) & mask;; i = (i + 1) & mask) {
+            Slot &slot = slots_[i];
+            if (slot.key == key) {
+                return slot.totals;
+            }
+            if (slot.key.uid_hi == 0) {
+                slot.key = key;
+                count_++;
+                return slot.totals;
+            }
+        }
+    }
+
+    // Hint that key is about to be looked up; a no-op before the first insert
+    void prefetch(const BillKey &key) const {
+        if (!slots_.empty()) {
+            __builtin_prefetch(&slots_[BillKeyHash()(key) & (slots_.size() - 1)], 1);
+        }
+    }
+
+    const Totals *find(const BillKey &key) const {
+        if (slots_.empty()) {
+            return nullptr;
+        }
+        size_t mask = slots_.size() - 1;
+        for (size_t i = BillKeyHash()(key) & mask;; i = (i + 1) & mask) {
+            const Slot &slot = slots_[i];
+            if (slot.key == key) {
+                return &slot.totals;
+            }
+            if (slot.key.uid_hi == 0) {
+                return nullptr;
+            }
+        }
+    }
+
+    template <typename Fn>
+    void for_each(Fn fn) const {
+        for (const Slot &slot : slots_) {
+            if (slot.key.uid_hi != 0) {
+                fn(slot.key, slot.totals);
+            }
+        }
+    }
+
+    size_t size() const {
+        return count_;
+    }
+
+private:
+    void grow() {
+        std::vector<Slot> old(std::max<size_t>(1024, slots_.size() * 2));
+        old.swap(slots_);
+        size_t mask = slots_.size() - 1;
+        for (const Slot &slot : old) {
+            if (slot.key.uid_hi == 0) {
+                continue;
+            }
+            size_t i = BillKeyHash()(slot.key) & mask;
+            while (slots_[i].key.uid_hi != 0) {
+                i = (i + 1) & mask;
+            }
+            slots_[i] = slot;
+        }
+    }
+
+    std::vector<Slot> slots_;
+    size_t count_ = 0;
+};
+
+struct Counters {
+    uint64_t records = 0;
+    uint64_t billed = 0;
+    uint64_t priced = 0;        // Billed journeys with no recorded fare, priced here
+    uint64_t active = 0;        // Journeys still in progress, billed once they end
+    uint64_t malformed = 0;     // Lines or records that could not be parsed
+    uint64_t unknown = 0;       // Unknown station or class, or no usable time
+    uint64_t other_month = 0;   // Outside the month asked for
+
+    void add(const Counters &other) {
+        records += other.records;
+        billed += other.billed;
+        priced += other.priced;
+        active += other.active;
+        malformed += other.malformed;
+        unknown += other.unknown;
+        other_month += other.other_month;
+    }
+};
+
+struct Partial {
+    BillMap totals;
+    Counters counters;
+};
+
+struct Options {
+    bool binary = false;
+    int32_t month = -1;   // Only bill this month when set
+};
+
+BillKey make_key(const Trip &trip) {
+    uint8_t bytes[kUidMax] = {0};
+    BillKey key;
+
+    memcpy(bytes, trip.uid, trip.uid_len);
+    memcpy(&key.uid_lo, bytes, 8);
+    key.uid_hi = bytes[8] | (uint64_t)bytes[9] << 8 | (uint64_t)trip.uid_len << 16 |
+                 (uint64_t)(uint32_t)trip.month << 24;
+    return key;
+}
+
+void split_key(const BillKey &key, uint8_t *uid, uint8_t *uid_len, int32_t *month) {
+    memcpy(uid, &key.uid_lo, 8);
+    uid[8] = (uint8_t)key.uid_hi;
+    uid[9] = (uint8_t)(key.uid_hi >> 8);
+    *uid_len = (uint8_t)(key.uid_hi >> 16);
+    *month = (int32_t)(key.uid_hi >> 24);
+}
+
+// Days since 1970-01-01 to a month index (proleptic Gregorian)
+int32_t month_from_days(int64_t days) {
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int64_t doe = days - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    int64_t month = mp < 10 ? mp + 3 : mp - 9;
+    int64_t year = yoe + era * 400 + (month <= 2);
+    return (int32_t)(year * 12 + month - 1);
+}
+
+int32_t month_from_seconds(int64_t seconds) {
+    if (seconds < FIREBASE_CLOCK_VALID_AFTER) {
+        return -1;
+    }
+    return month_from_days(seconds / 86400);
+}
+
+bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+// "YYYY-MM..." as written by the gates
+int32_t month_from_iso(const char *p, const char *end) {
+    if (end - p < 7 || p[4] != '-' || !is_digit(p[0]) || !is_digit(p[1]) || !is_digit(p[2]) ||
+        !is_digit(p[3]) || !is_digit(p[5]) || !is_digit(p[6])) {
+        return -1;
+    }
+    int year = (p[0] - '0') * 1000 + (p[1] - '0') * 100 + (p[2] - '0') * 10 + (p[3] - '0');
+    int month = (p[5] - '0') * 10 + (p[6] - '0');
+    if (month < 1 || month > 12) {
+        return -1;
+    }
+    return year * 12 + month - 1;
+}
+
+const char *skip_space(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+// Past the closing quote of a string whose opening quote was already consumed
+const char *skip_string(const char *p, const char *end) {
+    while (p < end) {
+        const char *quote = static_cast<const char *>(memchr(p, '"', end - p));
+        if (quote == nullptr) {
+            return end;
+        }
+        // Escaped if preceded by an odd number of backslashes
+        const char *slash = quote;
+        while (slash > p && slash[-1] == '\\') {
+            slash--;
+        }
+        if ((quote - slash) % 2 == 0) {
+            return quote + 1;
+        }
+        p = quote + 1;
+    }
+    return end;
+}
+
+// Up to the comma or brace that ends a value; nested objects and arrays
+// are skipped by depth
+const char *skip_value(const char *p, const char *end) {
+    int depth = 0;
+
+    while (p < end) {
+        char c = *p;
+        if (c == '"') {
+            p = skip_string(p + 1, end);
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (depth == 0) {
+                return p;
+            }
+            depth--;
+        } else if (c == ',' && depth == 0) {
+            return p;
+        }
+        p++;
+    }
+    return end;
+}
+
+const char *parse_int(const char *p, const char *end, int64_t *value) {
+    bool negative = (p < end && *p == '-');
+    int64_t result = 0;
+
+    p += negative;
+    const char *start = p;
+    while (p < end && is_digit(*p)) {
+        result = result * 10 + (*p++ - '0');
+    }
+    if (p == start) {
+        return nullptr;
+    }
+    // Fractional milliseconds are not expected, but must not break the line
+    while (p < end && (is_digit(*p) || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-')) {
+        p++;
+    }
+    *value = negative ? -result : result;
+    return p;
+}
+
+// Timestamps are ISO strings from the gates or epoch milliseconds from
+// the server ({".sv":"timestamp"})
+const char *parse_time(const char *p, const char *end, int32_t *month) {
+    if (*p == '"') {
+        const char *close = skip_string(p + 1, end);
+        *month = month_from_iso(p + 1, close - 1);
+        return close;
+    }
+    int64_t ms;
+    const char *next = parse_int(p, end, &ms);
+    if (next == nullptr) {
+        *month = -1;
+        return skip_value(p, end);
+    }
+    *month = month_from_seconds(ms / 1000);
+    return next;
+}
+
+enum Field {
+    FIELD_OTHER,
+    FIELD_UID,
+    FIELD_START,
+    FIELD_END,
+    FIELD_ORIGIN,
+    FIELD_CLASS,
+    FIELD_SELECTED,
+    FIELD_DESTINATION,
+    FIELD_FARE,
+    FIELD_FRAUD,
+    FIELD_STATE,
+};
+
+Field field_of(const char *key, size_t len) {
+    switch (len) {
+        case 4:
+            return memcmp(key, "fare", 4) == 0 ? FIELD_FARE : FIELD_OTHER;
+        case 7:
+            return memcmp(key, "rfidUid", 7) == 0 ? FIELD_UID : FIELD_OTHER;
+        case 12:
+            if (memcmp(key, "endTimestamp", 12) == 0) {
+                return FIELD_END;
+            }
+            return memcmp(key, "currentState", 12) == 0 ? FIELD_STATE : FIELD_OTHER;
+        case 13:
+            if (memcmp(key, "originStation", 13) == 0) {
+                return FIELD_ORIGIN;
+            }
+            return memcmp(key, "selectedClass", 13) == 0 ? FIELD_CLASS : FIELD_OTHER;
+        case 14:
+            return memcmp(key, "startTimestamp", 14) == 0 ? FIELD_START : FIELD_OTHER;
+        case 16:
+            return memcmp(key, "isFraudSuspected", 16) == 0 ? FIELD_FRAUD : FIELD_OTHER;
+        case 24:
+            return memcmp(key, "actualDestinationStation", 24) == 0 ? FIELD_DESTINATION : FIELD_OTHER;
+        case 26:
+            return memcmp(key, "selectedDestinationStation", 26) == 0 ? FIELD_SELECTED : FIELD_OTHER;
+        default:
+            return FIELD_OTHER;
+    }
+}
+
+// One pass over a flat journey object; keys may come in any order
+bool parse_ndjson(const char *p, const char *end, Trip *trip) {
+    int32_t start_month = -1;
+    int32_t end_month = -1;
+    int64_t number;
+
+    memset(trip, 0, sizeof(*trip));
+    trip->state = -1;
+    trip->fare = -1;
+    p = skip_space(p, end);
+    if (p == end || *p++ != '{') {
+        return false;
+    }
+    while (p < end) {
+        p = skip_space(p, end);
+        if (p < end && *p == ',') {
+            p = skip_space(p + 1, end);
+        }
+        if (p == end || *p == '}') {
+            break;
+        }
+        if (*p != '"') {
+            return false;
+        }
+        const char *key = p + 1;
+        const char *close = skip_string(key, end);
+        size_t key_len = close - 1 - key;
+        p = skip_space(close, end);
+        if (p == end || *p++ != ':') {
+            return false;
+        }
+        p = skip_space(p, end);
+        if (p == end) {
+            return false;
+        }
+
+        Field field = field_of(key, key_len);
+        switch (field) {
+            case FIELD_UID: {
+                if (*p != '"') {
+                    return false;
+                }
+                const char *value = p + 1;
+                p = skip_string(value, end);
+                int high = -1;
+                for (const char *c = value; c < p - 1 && trip->uid_len < kUidMax; c++) {
+                    int nibble = hex_value(*c);
+                    if (nibble < 0) {
+                        continue;
+                    }
+                    if (high < 0) {
+                        high = nibble;
+                    } else {
+                        trip->uid[trip->uid_len++] = (uint8_t)(high << 4 | nibble);
+                        high = -1;
+                    }
+                }
+                break;
+            }
+            case FIELD_START:
+                p = parse_time(p, end, &start_month);
+                break;
+            case FIELD_END:
+                p = parse_time(p, end, &end_month);
+                break;
+            case FIELD_ORIGIN:
+            case FIELD_CLASS:
+            case FIELD_SELECTED:
+            case FIELD_DESTINATION:
+            case FIELD_FARE:
+            case FIELD_STATE:
+                p = parse_int(p, end, &number);
+                if (p == nullptr) {
+                    return false;
+                }
+                if (field == FIELD_ORIGIN) {
+                    trip->origin = (int)number;
+                } else if (field == FIELD_CLASS) {
+                    trip->train_class = (int)number;
+                } else if (field == FIELD_SELECTED) {
+                    trip->selected = (int)number;
+                } else if (field == FIELD_DESTINATION) {
+                    trip->destination = (int)number;
+                } else if (field == FIELD_FARE) {
+                    trip->fare = (int)number;
+                } else {
+                    trip->state = (int)number;
+                }
+                break;
+            case FIELD_FRAUD:
+                trip->fraud = (*p == 't');
+                p = skip_value(p, end);
+                break;
+            default:
+                p = skip_value(p, end);
+                break;
+        }
+    }
+    if (trip->uid_len == 0 || trip->state < 0) {
+        return false;
+    }
+    // A journey is billed in the month it ended
+    trip->month = end_month >= 0 ? end_month : start_month;
+    return true;
+}
+
+bool parse_record(const uint8_t *record, Trip *trip) {
+    journey_session_t journey;
+
+    if (!journey_record_decode(record, JOURNEY_RECORD_SIZE, &journey)) {
+        return false;
+    }
+    memcpy(trip->uid, journey.rfid_uid, journey.uid_size);
+    trip->uid_len = journey.uid_size;
+    trip->origin = journey.origin_station;
+    trip->selected = journey.selected_destination;
+    trip->fare = journey.fare > 0 ? journey.fare : -1;
+    trip->destination = journey.actual_destination;
+    trip->train_class = journey.selected_class;
+    trip->state = journey.current_state;
+    trip->fraud = journey.is_fraud_suspected;
+    trip->month = month_from_seconds(journey.end_timestamp);
+    if (trip->month < 0) {
+        trip->month = month_from_seconds(journey.start_timestamp);
+    }
+    return trip->uid_len > 0;
+}
+
+// Bills the journeys of one worker. Billable journeys are queued in small
+// batches whose table slots are prefetched before any is updated, so the
+// cache misses of a batch overlap instead of stalling one after another.
+class Biller {
+public:
+    Biller(const Options &options, Partial *partial)
+        : options_(options), partial_(partial), station_count_(get_number_of_destinations()),
+          class_count_(get_number_of_train_classes()) {}
+
+    ~Biller() {
+        flush();
+    }
+
+    void add(const Trip &trip) {
+        Counters &counters = partial_->counters;
+
+        if (trip.state != JOURNEY_STATE_INACTIVE) {
+            counters.active++;
+            return;
+        }
+        if (trip.origin < 1 || trip.origin > station_count_ || trip.destination < 1 ||
+            trip.destination > station_count_ || trip.train_class < 1 || trip.train_class > class_count_ ||
+            trip.month < 0) {
+            counters.unknown++;
+            return;
+        }
+        if (options_.month >= 0 && trip.month != options_.month) {
+            counters.other_month++;
+            return;
+        }
+
+        Pending &pending = batch_[batch_len_++];
+        pending.key = make_key(trip);
+        pending.stops = (uint32_t)std::abs(trip.destination - trip.origin);
+        if (trip.fare >= 0) {
+            pending.fare = (uint32_t)trip.fare;
+        } else {
+            pending.fare = get_journey_fare(trip.origin, trip.selected, trip.destination, trip.train_class);
+            partial_->counters.priced++;
+        }
+        pending.fraud = trip.fraud;
+        partial_->totals.prefetch(pending.key);
+        if (batch_len_ == kBatch) {
+            flush();
+        }
+    }
+
+    void flush() {
+        for (size_t i = 0; i < batch_len_; i++) {
+            const Pending &pending = batch_[i];
+            Totals &totals = partial_->totals[pending.key];
+            totals.journeys++;
+            totals.stops += pending.stops;
+            totals.fare += pending.fare;
+            totals.fraud_flagged += pending.fraud;
+        }
+        partial_->counters.billed += batch_len_;
+        batch_len_ = 0;
+    }
+
+private:
+    static constexpr size_t kBatch = 16;
+
+    struct Pending {
+        BillKey key;
+        uint32_t stops;
+        uint32_t fare;
+        bool fraud;
+    };
+
+    const Options &options_;
+    Partial *partial_;
+    int station_count_;
+    int class_count_;
+    Pending batch_[kBatch];
+    size_t batch_len_ = 0;
+};
+
+void bill_ndjson(const char *begin, const char *end, const Options &options, Partial *partial) {
+    Biller biller(options, partial);
+    Trip trip;
+
+    for (const char *line = begin; line < end;) {
+        const char *eol = static_cast<const char *>(memchr(line, '\n', end - line));
+        if (eol == nullptr) {
+            eol = end;
+        }
+        if (skip_space(line, eol) < eol) {
+            partial->counters.records++;
+            if (parse_ndjson(line, eol, &trip)) {
+                biller.add(trip);
+            } else {
+                partial->counters.malformed++;
+            }
+        }
+        line = eol + 1;
+    }
+}
+
+void bill_records(const uint8_t *begin, const uint8_t *end, const Options &options, Partial *partial) {
+    Biller biller(options, partial);
+    Trip trip;
+
+    for (const uint8_t *record = begin; record + JOURNEY_RECORD_SIZE <= end; record += JOURNEY_RECORD_SIZE) {
+        partial->counters.records++;
+        if (parse_record(record, &trip)) {
+            biller.add(trip);
+        } else {
+            partial->counters.malformed++;
+        }
+    }
+}
+
+// Bill the export on `threads` workers and merge their maps into one
+Partial bill_export(const char *data, size_t size, const Options &options, unsigned threads) {
+    std::vector<Partial> partials(threads);
+    std::vector<std::thread> workers;
+    std::vector<size_t> bounds(threads + 1, size);
+
+    // Slice boundaries fall on line starts, or whole records
+    bounds[0] = 0;
+    for (unsigned i = 1; i < threads; i++) {
+        size_t cut = size / threads * i;
+        if (options.binary) {
+            cut -= cut % JOURNEY_RECORD_SIZE;
+        } else {
+            const char *eol = static_cast<const char *>(memchr(data + cut, '\n', size - cut));
+            cut = eol ? (size_t)(eol - data) + 1 : size;
+        }
+        bounds[i] = std::max(cut, bounds[i - 1]);
+    }
+
+    for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back([&, i] {
+            const char *begin = data + bounds[i];
+            const char *end = data + bounds[i + 1];
+            if (options.binary) {
+                bill_records(reinterpret_cast<const uint8_t *>(begin), reinterpret_cast<const uint8_t *>(end),
+                             options, &partials[i]);
+            } else {
+                bill_ndjson(begin, end, options, &partials[i]);
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    // Merge into the largest partial so the fewest entries are rehashed
+    auto largest = std::max_element(partials.begin(), partials.end(), [](const Partial &a, const Partial &b) {
+        return a.totals.size() < b.totals.size();
+    });
+    Partial merged = std::move(*largest);
+    for (Partial &partial : partials) {
+        if (&partial == &*largest) {
+            continue;
+        }
+        partial.totals.for_each([&](const BillKey &key, const Totals &totals) {
+            merged.totals[key].add(totals);
+        });
+        merged.counters.add(partial.counters);
+        partial.totals = BillMap();
+    }
+    return merged;
+}
+
+std::string uid_hex(const uint8_t *uid, uint8_t len) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string out;
+
+    for (uint8_t i = 0; i < len; i++) {
+        out += hex[uid[i] >> 4];
+        out += hex[uid[i] & 0x0F];
+    }
+    return out;
+}
+
+// One CSV row per card and month, ordered by card then month
+void print_bills(const BillMap &totals) {
+    struct Row {
+        std::string card;
+        int32_t month;
+        const Totals *totals;
+    };
+    std::vector<Row> rows;
+
+    rows.reserve(totals.size());
+    totals.for_each([&](const BillKey &key, const Totals &card_month) {
+        uint8_t uid[kUidMax];
+        uint8_t uid_len;
+        int32_t month;
+        split_key(key, uid, &uid_len, &month);
+        rows.push_back({uid_hex(uid, uid_len), month, &card_month});
+    });
+    std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+        return a.card != b.card ? a.card < b.card : a.month < b.month;
+    });
+
+    printf("card,month,journeys,stops,fare,fraud_flagged\n");
+    for (const Row &row : rows) {
+        printf("%s,%04d-%02d,%u,%u,%" PRIu64 ",%u\n", row.card.c_str(), row.month / 12, row.month % 12 + 1,
+               row.totals->journeys, row.totals->stops, row.totals->fare, row.totals->fraud_flagged);
+    }
+}
+
+void print_summary(const Partial &result, size_t bytes, double seconds, unsigned threads) {
+    const Counters &c = result.counters;
+
+    fprintf(stderr, "Billed %" PRIu64 " of %" PRIu64 " journeys into %zu card-months on %u threads "
+                    "in %.3f s (%.1f M journeys/s, %.0f MB/s)\n",
+            c.billed, c.records, result.totals.size(), threads, seconds,
+            seconds > 0 ? c.records / seconds / 1e6 : 0.0, seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+    fprintf(stderr, "Priced here: %" PRIu64 " journeys with no recorded fare\n", c.priced);
+    fprintf(stderr, "Skipped: %" PRIu64 " active, %" PRIu64 " malformed, %" PRIu64 " unknown station/class/time, "
+                    "%" PRIu64 " other months\n",
+            c.active, c.malformed, c.unknown, c.other_month);
+}
+
+// Synthetic journeys from the gates: random cards, stations and classes,
+// spread over the months of 2026, with some still active or flagged
+std::string synthesize(uint64_t count, uint32_t cards, bool binary, uint64_t seed, unsigned threads) {
+    std::vector<std::string> slices(threads);
+    std::vector<std::thread> workers;
+
+    setenv("TZ", "UTC", 1);
+    tzset();
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 rng(seed * 0x9E3779B97F4A7C15ull + t);
+            uint64_t first = count * t / threads;
+            uint64_t last = count * (t + 1) / threads;
+            int stations = get_number_of_destinations();
+            int classes = get_number_of_train_classes();
+            std::string &out = slices[t];
+            char line[JOURNEY_JSON_MAX_LEN];
+            uint8_t record[JOURNEY_RECORD_SIZE];
+
+            out.reserve((last - first) * (binary ? JOURNEY_RECORD_SIZE : 300));
+            for (uint64_t i = first; i < last; i++) {
+                journey_session_t journey;
+                uint64_t r = rng();
+                uint32_t card = (uint32_t)(r % cards);
+
+                memset(&journey, 0, sizeof(journey));
+                snprintf(journey.ticket_id, sizeof(journey.ticket_id), "T%014" PRIX64, i);
+                journey.uid_size = (card & 1) ? 7 : 4;
+                journey.rfid_uid[0] = 0x04;
+                journey.rfid_uid[1] = (uint8_t)(card >> 16);
+                journey.rfid_uid[2] = (uint8_t)(card >> 8);
+                journey.rfid_uid[3] = (uint8_t)card;
+                journey.start_timestamp = 1767225600 + (time_t)((r >> 32) % (365 * 86400));
+                journey.origin_station = 1 + (r >> 8) % stations;
+                journey.selected_destination = 1 + (r >> 16) % stations;
+                journey.selected_class = 1 + (r >> 24) % classes;
+                if ((r >> 60) == 0) {
+                    journey.current_state = JOURNEY_STATE_ACTIVE;
+                } else {
+                    journey.current_state = JOURNEY_STATE_INACTIVE;
+                    journey.actual_destination = ((r >> 56) & 7) ? journey.selected_destination
+                                                                 : 1 + (r >> 40) % stations;
+                    journey.is_fraud_suspected = journey.actual_destination != journey.selected_destination;
+                    journey.travel_duration = 300 + (r >> 44) % 5400;
+                    journey.end_timestamp = journey.start_timestamp + journey.travel_duration;
+                    journey.fare = get_journey_fare(journey.origin_station, journey.selected_destination,
+                                                    journey.actual_destination, journey.selected_class);
+                }
+
+                if (binary) {
+                    journey_record_encode(&journey, record);
+                    out.append(reinterpret_cast<const char *>(record), JOURNEY_RECORD_SIZE);
+                } else {
+                    size_t len = journey_json_encode(&journey, line, sizeof(line));
+                    out.append(line, len);
+                    out += '\n';
+                }
+            }
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    std::string data;
+    size_t total = 0;
+    for (const std::string &slice : slices) {
+        total += slice.size();
+    }
+    data.reserve(total);
+    for (std::string &slice : slices) {
+        data += slice;
+        slice = std::string();
+    }
+    return data;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Billing throughput on synthetic data at 1, 2, 4... threads up to max_threads;
+// every run must produce the same bills as the single-threaded one
+int run_bench(uint64_t count, uint32_t cards, const Options &options, unsigned max_threads, uint64_t seed) {
+    auto start = std::chrono::steady_clock::now();
+    std::string data = synthesize(count, cards, options.binary, seed, max_threads);
+    fprintf(stderr, "Synthesized %" PRIu64 " %s journeys for %u cards: %.1f MB in %.2f s\n", count,
+            options.binary ? "packed" : "NDJSON", cards, data.size() / 1e6, seconds_since(start));
+
+    std::vector<unsigned> thread_counts;
+    for (unsigned t = 1; t < max_threads; t *= 2) {
+        thread_counts.push_back(t);
+    }
+    thread_counts.push_back(max_threads);
+
+    printf("threads  seconds  M journeys/s     MB/s  speedup\n");
+    BillMap reference;
+    double single = 0;
+    bool consistent = true;
+    for (unsigned threads : thread_counts) {
+        start = std::chrono::steady_clock::now();
+        Partial result = bill_export(data.data(), data.size(), options, threads);
+        double seconds = seconds_since(start);
+
+        if (threads == 1) {
+            single = seconds;
+            reference = std::move(result.totals);
+        } else {
+            consistent &= result.totals.size() == reference.size();
+            result.totals.for_each([&](const BillKey &key, const Totals &totals) {
+                const Totals *match = reference.find(key);
+                consistent &= match != nullptr && match->fare == totals.fare &&
+                              match->journeys == totals.journeys && match->stops == totals.stops;
+            });
+        }
+        printf("%7u  %7.3f  %12.1f  %7.0f  %7.2f\n", threads, seconds, count / seconds / 1e6,
+               data.size() / seconds / 1e6, single / seconds);
+    }
+    if (!consistent) {
+        fprintf(stderr, "Bills differ between thread counts\n");
+        return 1;
+    }
+    return 0;
+}
+
+void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-b] [-t threads] [-m YYYY-MM] [-q] export\n"
+                    "       %s -G journeys [-b] [-c cards] [-s seed] > export\n"
+                    "       %s -B journeys [-b] [-c cards] [-s seed] [-t max-threads]\n"
+                    "  -b  packed journey records instead of NDJSON\n"
+                    "  -t  worker threads (default: all cores)\n"
+                    "  -m  only bill journeys that ended in this month\n"
+                    "  -q  summary only, no CSV\n"
+                    "  -G  write a synthetic export to stdout\n"
+                    "  -B  benchmark billing throughput on synthetic data\n"
+                    "  -c  distinct cards in synthetic data (default 100000)\n"
+                    "  -s  random seed for synthetic data (default 1)\n", argv0, argv0, argv0);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    uint64_t generate = 0;
+    uint64_t bench = 0;
+    uint32_t cards = 100000;
+    uint64_t seed = 1;
+    bool quiet = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bt:m:qG:B:c:s:")) != -1) {
+        switch (opt) {
+            case 'b':
+                options.binary = true;
+                break;
+            case 't':
+                threads = (unsigned)std::max(1, atoi(optarg));
+                break;
+            case 'm':
+                options.month = month_from_iso(optarg, optarg + strlen(optarg));
+                if (options.month < 0) {
+                    fprintf(stderr, "Bad month: %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            case 'G':
+                generate = strtoull(optarg, nullptr, 0);
+                break;
+            case 'B':
+                bench = strtoull(optarg, nullptr, 0);
+                break;
+            case 'c':
+                cards = (uint32_t)std::max(1L, strtol(optarg, nullptr, 0));
+                break;
+            case 's':
+                seed = strtoull(optarg, nullptr, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (bench) {
+        return run_bench(bench, cards, options, threads, seed);
+    }
+    if (generate) {
+        std::string data = synthesize(generate, cards, options.binary, seed, threads);
+        return fwrite(data.data(), 1, data.size(), stdout) == data.size() ? 0 : 1;
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    size_t size = (size_t)st.st_size;
+    const char *data = "";
+    if (size > 0) {
+        void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            return 1;
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+        data = static_cast<const char *>(map);
+    }
+    if (options.binary && size % JOURNEY_RECORD_SIZE != 0) {
+        fprintf(stderr, "Warning: %zu trailing bytes are not a whole record\n", size % JOURNEY_RECORD_SIZE);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Partial result = bill_export(data, size, options, threads);
+    double seconds = seconds_since(start);
+
+    if (!quiet) {
+        print_bills(result.totals);
+    }
+    print_summary(result, size, seconds, threads);
+    if (size > 0) {
+        munmap(const_cast<char *>(data), size);
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include "journey_json.h"
+#include "journey_outbox.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "cJSON.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Host encoder microbenchmark: the journey upload body written by
+// journey_json.c against the same document built as a cJSON tree and
+// printed, as the firmware did before. No network or RTDB stand-in needed
+
+#define BENCH_START_TIME 1760000000     // Any time past FIREBASE_CLOCK_VALID_AFTER
+
+typedef struct {
+    const char *name;
+    journey_session_t journeys[OUTBOX_BATCH_SIZE];
+    size_t count;
+} bench_case_t;
+
+typedef struct {
+    double ns_per_op;
+    size_t bytes;
+    double allocations_per_op;
+    int64_t peak_heap;
+    char *body;             // One output, kept for the equivalence check
+} bench_result_t;
+
+typedef char *(*cjson_print_fn)(const cJSON *item);
+
+static void make_journey(journey_session_t *journey, uint32_t card, bool finished) {
+    memset(journey, 0, sizeof(journey_session_t));
+    snprintf(journey->ticket_id, sizeof(journey->ticket_id), "TK%08lX", (unsigned long)card);
+    journey->rfid_uid[0] = 0x08;
+    journey->rfid_uid[1] = (uint8_t)(card >> 16);
+    journey->rfid_uid[2] = (uint8_t)(card >> 8);
+    journey->rfid_uid[3] = (uint8_t)card;
+    journey->uid_size = 4;
+    journey->start_timestamp = BENCH_START_TIME + card * 60;
+    journey->origin_station = 2;
+    journey->selected_class = 2;
+    journey->selected_destination = 5;
+    journey->current_state = JOURNEY_STATE_ACTIVE;
+    if (finished) {
+        journey->end_timestamp = journey->start_timestamp + 1800;
+        journey->actual_destination = 5;
+        journey->travel_duration = 1800;
+        journey->fare = 120;
+        journey->current_state = JOURNEY_STATE_INACTIVE;
+    }
+}
+
+// The first half of the cards enter, then they exit again, as a busy gate
+// fills one upload batch
+static void make_cases(bench_case_t *cases) {
+    cases[0].name = "start";
+    make_journey(&cases[0].journeys[0], 1, false);
+    cases[0].count = 1;
+
+    cases[1].name = "end";
+    make_journey(&cases[1].journeys[0], 1, true);
+    cases[1].count = 1;
+
+    cases[2].name = "batch";
+    cases[2].count = OUTBOX_BATCH_SIZE;
+    for (size_t i = 0; i < OUTBOX_BATCH_SIZE; i++) {
+        size_t half = (OUTBOX_BATCH_SIZE + 1) / 2;
+        make_journey(&cases[2].journeys[i], (uint32_t)(i % half), i >= half);
+    }
+}
+
+static void format_timestamp(time_t timestamp, char *buffer, size_t size) {
+    struct tm timeinfo;
+    localtime_r(&timestamp, &timeinfo);
+    strftime(buffer, size, "%Y-%m-%dT%H:%M:%SZ", &timeinfo);
+}
+
+static void add_server_timestamp(cJSON *object, const char *key) {
+    cJSON *sv = cJSON_CreateObject();
+    cJSON_AddStringToObject(sv, ".sv", "timestamp");
+    cJSON_AddItemToObject(object, key, sv);
+}
+
+// The same record journey_json.c writes, node by node
+static cJSON *build_record(const journey_session_t *journey) {
+    bool finished = (journey->current_state == JOURNEY_STATE_INACTIVE);
+    char uid[32];
+    char timestamp[32];
+    char event_id[32];
+
+    cJSON *record = cJSON_CreateObject();
+    cJSON_AddStringToObject(record, "ticketID", journey->ticket_id);
+    for (size_t i = 0; i < journey->uid_size; i++) {
+        snprintf(uid + i * 2, 3, "%02X", journey->rfid_uid[i]);
+    }
+    cJSON_AddStringToObject(record, "rfidUid", uid);
+    format_timestamp(journey->start_timestamp, timestamp, sizeof(timestamp));
+    cJSON_AddStringToObject(record, "startTimestamp", timestamp);
+    if (finished) {
+        format_timestamp(journey->end_timestamp, timestamp, sizeof(timestamp));
+        cJSON_AddStringToObject(record, "endTimestamp", timestamp);
+    }
+    cJSON_AddNumberToObject(record, "originStation", journey->origin_station);
+    cJSON_AddNumberToObject(record, "selectedClass", journey->selected_class);
+    cJSON_AddNumberToObject(record, "selectedDestinationStation", journey->selected_destination);
+    if (finished) {
+        cJSON_AddNumberToObject(record, "actualDestinationStation", journey->actual_destination);
+        cJSON_AddNumberToObject(record, "travelDuration", journey->travel_duration);
+        if (journey->fare > 0) {
+            cJSON_AddNumberToObject(record, "fare", journey->fare);
+        }
+        cJSON_AddBoolToObject(record, "isFraudSuspected", journey->is_fraud_suspected);
+    }
+    cJSON_AddNumberToObject(record, "currentState", journey->current_state);
+    cJSON_AddNumberToObject(record, "eventSeq", journey_event_seq(journey));
+    snprintf(event_id, sizeof(event_id), "%s-%lu", journey->ticket_id, (unsigned long)journey_event_seq(journey));
+    cJSON_AddStringToObject(record, "eventId", event_id);
+    add_server_timestamp(record, "recordedAt");
+    return record;
+}
+
+static void replace_path(cJSON *update, const char *key, cJSON *value) {
+    cJSON_DeleteItemFromObject(update, key);
+    cJSON_AddItemToObject(update, key, value);
+}
+
+// Multi-path update with the old replace-in-tree handling of repeated paths
+static cJSON *build_updates(const journey_session_t *journeys, size_t count) {
+    cJSON *update = cJSON_CreateObject();
+    char key[96];
+    char uid[32];
+
+    for (size_t i = 0; i < count; i++) {
+        const journey_session_t *journey = &journeys[i];
+        bool active = (journey->current_state == JOURNEY_STATE_ACTIVE);
+
+        for (size_t b = 0; b < journey->uid_size; b++) {
+            snprintf(uid + b * 2, 3, "%02X", journey->rfid_uid[b]);
+        }
+        snprintf(key, sizeof(key), "cardsByUid/%s/activeJourney", uid);
+        replace_path(update, key, active ? build_record(journey) : cJSON_CreateNull());
+        snprintf(key, sizeof(key), "cardsByUid/%s/activeTicketId", uid);
+        replace_path(update, key, active ? cJSON_CreateString(journey->ticket_id) : cJSON_CreateNull());
+        snprintf(key, sizeof(key), "journeys/%.*s", (int)sizeof(journey->ticket_id), journey->ticket_id);
+        replace_path(update, key, build_record(journey));
+    }
+    return update;
+}
+
+static void run_writer(const bench_case_t *c, int iterations, bench_result_t *result) {
+    static char buffer[OUTBOX_BATCH_SIZE * JOURNEY_JSON_UPDATE_MAX_LEN + 2];
+    host_heap_stats_t before, after;
+    size_t len = 0;
+
+    host_heap_reset_peak();
+    host_heap_get_stats(&before);
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++) {
+        len = journey_json_encode_updates(c->journeys, c->count, buffer, sizeof(buffer));
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    host_heap_get_stats(&after);
+
+    result->ns_per_op = elapsed * 1000.0 / iterations;
+    result->bytes = len;
+    result->allocations_per_op = (double)(after.allocations - before.allocations) / iterations;
+    result->peak_heap = after.peak_bytes - before.live_bytes;
+    result->body = strdup(buffer);
+}
+
+static void run_cjson(const bench_case_t *c, int iterations, cjson_print_fn print, bench_result_t *result) {
+    host_heap_stats_t before, after;
+    char *body = NULL;
+
+    host_heap_reset_peak();
+    host_heap_get_stats(&before);
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++) {
+        free(body);
+        cJSON *update = build_updates(c->journeys, c->count);
+        body = print(update);
+        cJSON_Delete(update);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    host_heap_get_stats(&after);
+
+    result->ns_per_op = elapsed * 1000.0 / iterations;
+    result->bytes = strlen(body);
+    result->allocations_per_op = (double)(after.allocations - before.allocations) / iterations;
+    result->peak_heap = after.peak_bytes - before.live_bytes;
+    result->body = body;
+}
+
+// Both encoders must describe the same document for the figures to compare
+static bool same_document(const char *a, const char *b) {
+    cJSON *x = cJSON_Parse(a);
+    cJSON *y = cJSON_Parse(b);
+    bool same = x && y && cJSON_Compare(x, y, true);
+    cJSON_Delete(x);
+    cJSON_Delete(y);
+    return same;
+}
+
+static void print_result(const char *encoder, const bench_result_t *r, const bench_result_t *reference) {
+    printf("  %-24s %9.0f ns  %5zu bytes  %5.1f allocs  %6lld B peak heap%s\n", encoder, r->ns_per_op, r->bytes,
+           r->allocations_per_op, (long long)r->peak_heap,
+           r == reference ? "" : same_document(r->body, reference->body) ? "  same document" : "  DIFFERENT DOCUMENT");
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-n iterations]\n"
+                    "  -n  encodes timed per case and encoder (default 20000)\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    int iterations = 20000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (iterations <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    static bench_case_t cases[3];
+    make_cases(cases);
+
+    printf("Journey upload body, %d encodes each (batch = %d events)\n", iterations, OUTBOX_BATCH_SIZE);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        bench_result_t writer, compact, pretty;
+        run_writer(&cases[i], iterations, &writer);
+        run_cjson(&cases[i], iterations, cJSON_PrintUnformatted, &compact);
+        run_cjson(&cases[i], iterations, cJSON_Print, &pretty);
+
+        printf("%s:\n", cases[i].name);
+        print_result("journey_json", &writer, &writer);
+        print_result("cJSON_PrintUnformatted", &compact, &writer);
+        print_result("cJSON_Print", &pretty, &writer);
+
+        free(writer.body);
+        free(compact.body);
+        free(pretty.body);
+    }
+    return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef HOST_ESP_CRT_BUNDLE_H
+#define HOST_ESP_CRT_BUNDLE_H
+
+#include "esp_err.h"
+
+// Accepted and ignored, the host client never verifies certificates
+esp_err_t esp_crt_bundle_attach(void *conf);
+
+#endif // HOST_ESP_CRT_BUNDLE_H
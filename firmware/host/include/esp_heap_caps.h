@@ -0,0 +1,32 @@
+#ifndef HOST_ESP_HEAP_CAPS_H
+#define HOST_ESP_HEAP_CAPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+
+// Size of the pretend heap the host figures are reported against, about
+// what an ESP32 has left once Wi-Fi and TLS are up
+#define HOST_HEAP_SIZE (160 * 1024)
+
+// Free space is HOST_HEAP_SIZE less the bytes the firmware and shim objects
+// hold. There is no fragmentation model, the largest block is all of it
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+
+// Host only: allocation counters. The Makefile links with --wrap so every
+// malloc, calloc, realloc, strdup and free made by the firmware sources, the
+// shims and cJSON goes through esp_host.c
+typedef struct {
+    uint64_t allocations;   // Successful malloc, calloc, realloc and strdup calls
+    uint64_t frees;
+    int64_t live_bytes;     // Usable bytes currently held
+    int64_t peak_bytes;     // Most bytes held at once since host_heap_reset_peak
+} host_heap_stats_t;
+
+void host_heap_get_stats(host_heap_stats_t *stats);
+void host_heap_reset_peak(void);
+
+#endif // HOST_ESP_HEAP_CAPS_H
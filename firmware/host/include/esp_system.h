@@ -0,0 +1,7 @@
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+
+#include "esp_err.h"
+#include "esp_random.h"
+
+#endif // HOST_ESP_SYSTEM_H
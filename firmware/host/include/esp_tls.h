@@ -0,0 +1,7 @@
+#ifndef HOST_ESP_TLS_H
+#define HOST_ESP_TLS_H
+
+// The host build talks plain HTTP to the local stand-in, there is no TLS layer
+#include "esp_err.h"
+
+#endif // HOST_ESP_TLS_H
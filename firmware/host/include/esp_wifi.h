@@ -0,0 +1,7 @@
+#ifndef HOST_ESP_WIFI_H
+#define HOST_ESP_WIFI_H
+
+// The host network is always up
+#include "esp_err.h"
+
+#endif // HOST_ESP_WIFI_H
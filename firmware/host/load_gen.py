@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+"""Multi-gate load generator against the local RTDB stand-in.
+
+Every simulated gate is a tap_bench process, so each one issues exactly the
+firmware's request sequence over its own keep-alive connection. At boot that
+is the whitelist sync of /rfidApplications and the card event stream. Each
+tap runs firebase_verify_rfid, then firebase_check_active_journey, then
+firebase_start_journey or firebase_end_journey. Journeys are uploaded to
+/journeys by the outbox in the background. Gates tap random cards out of
+the synthetic set, each every --interval-ms, so a card can enter at one gate
+and leave at another.
+
+For every dataset size in --stages (cards:journeys) the stand-in is started
+fresh with that many approved cards and finished journeys. The gates are
+booted, staggered over one interval, and each makes --taps taps. Each
+stage reports:
+
+  throughput   taps per second over all gates, and server requests per second
+  latency      tap latency percentiles over every tap of every gate
+  bytes/tap    wire bytes per tap seen by the gates, outbox uploads included
+  boot         time until a gate's whitelist sync and card stream snapshot are
+               done, and the bytes it took (both grow with the cards)
+
+  make RTDB_URL=http://127.0.0.1:9000/
+  python3 load_gen.py --gates 50 --taps 20 --interval-ms 3000 --stages 1000:10000,10000:100000
+
+tap_bench talks to the URL it was built with (RTDB_URL), so --url must match.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+import urllib.request
+from urllib.parse import urlsplit
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+STATIONS = 17
+
+
+def parse_stages(text):
+    stages = []
+    for item in text.split(","):
+        cards, _, journeys = item.partition(":")
+        stages.append((int(cards), int(journeys or 0)))
+    return stages
+
+
+def percentile(values, percent):
+    ordered = sorted(values)
+    rank = max(1, -(-len(ordered) * percent // 100))
+    return ordered[rank - 1]
+
+
+def fetch_json(url):
+    with urllib.request.urlopen(url, timeout=30) as response:
+        return json.load(response)
+
+
+def start_server(args, cards, journeys):
+    port = urlsplit(args.url).port or 80
+    command = [sys.executable, os.path.join(HERE, "rtdb_server.py"), "--port", str(port),
+               "--cards", str(cards), "--journeys", str(journeys)]
+    if args.latency_ms:
+        command += ["--latency-ms", str(args.latency_ms)]
+    server = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+    # The stand-in prints one line once it is listening
+    if not server.stdout.readline():
+        raise SystemExit("RTDB stand-in failed to start: " + " ".join(command))
+    return server
+
+
+def run_gates(args, cards, stage):
+    gates = []
+    stagger_s = args.interval_ms / 1000.0 / max(args.gates, 1)
+    for gate in range(args.gates):
+        seed = stage * 100000 + gate + 1
+        command = [args.bench, "-j", "-n", str(args.taps), "-w", str(args.interval_ms), "-C", str(cards),
+                   "-g", str(1 + gate % STATIONS), "-s", str(seed)]
+        env = dict(os.environ, HOST_RANDOM_SEED=str(seed))
+        gates.append(subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True, env=env))
+        time.sleep(stagger_s)
+
+    results = []
+    for gate, process in enumerate(gates):
+        output, _ = process.communicate()
+        lines = [line for line in output.splitlines() if line.startswith("{")]
+        if not lines:
+            print(f"gate {gate}: no summary (exit {process.returncode})", file=sys.stderr)
+            continue
+        results.append(json.loads(lines[-1]))
+    return results
+
+
+def run_stage(args, stage, cards, journeys):
+    server = start_server(args, cards, journeys)
+    base = args.url.rstrip("/")
+    try:
+        before = fetch_json(base + "/.stats")
+        started = time.monotonic()
+        results = run_gates(args, cards, stage)
+        elapsed = time.monotonic() - started
+        after = fetch_json(base + "/.stats")
+        stored = fetch_json(base + "/journeys.json?shallow=true") or {}
+    finally:
+        server.terminate()
+        server.wait()
+
+    taps = sum(r["taps"] for r in results)
+    latencies = [us / 1000.0 for r in results for us in r["tap_us"]]
+    tap_bytes = sum(r["tap_bytes_sent"] + r["tap_bytes_received"] for r in results)
+    return {
+        "cards": cards,
+        "journeys": journeys,
+        "gates": len(results),
+        "taps": taps,
+        "rejected": sum(r["rejected"] for r in results),
+        "failed": sum(r["failed"] for r in results),
+        "taps_per_s": sum(r["taps"] / (r["run_us"] / 1e6) for r in results if r["run_us"] > 0),
+        "requests_per_s": (after["requests"] - before["requests"]) / elapsed,
+        "p50_ms": percentile(latencies, 50) if latencies else 0.0,
+        "p95_ms": percentile(latencies, 95) if latencies else 0.0,
+        "p99_ms": percentile(latencies, 99) if latencies else 0.0,
+        "max_ms": max(latencies) if latencies else 0.0,
+        "requests_per_tap": sum(r["tap_requests"] for r in results) / taps if taps else 0.0,
+        "bytes_per_tap": tap_bytes / taps if taps else 0.0,
+        "boot_p50_ms": percentile([r["ready_us"] / 1000.0 for r in results], 50) if results else 0.0,
+        "boot_max_ms": max(r["ready_us"] / 1000.0 for r in results) if results else 0.0,
+        "boot_bytes": sum(r["boot_bytes_received"] for r in results) / len(results) if results else 0.0,
+        "outbox_pending": sum(r["outbox_pending"] for r in results),
+        "stored_journeys": len(stored),
+    }
+
+
+def print_report(rows):
+    print(f"{'cards':>7} {'journeys':>9} {'gates':>5} {'taps':>6} {'rej':>4} {'fail':>4} {'taps/s':>7} "
+          f"{'req/s':>7} {'p50 ms':>7} {'p95':>7} {'p99':>7} {'max':>7} {'req/tap':>7} {'B/tap':>7} "
+          f"{'boot p50':>8} {'boot max':>8} {'boot B':>9} {'pending':>7} {'stored':>8}")
+    for row in rows:
+        print(f"{row['cards']:>7} {row['journeys']:>9} {row['gates']:>5} {row['taps']:>6} {row['rejected']:>4} "
+              f"{row['failed']:>4} {row['taps_per_s']:>7.2f} {row['requests_per_s']:>7.1f} {row['p50_ms']:>7.2f} "
+              f"{row['p95_ms']:>7.2f} {row['p99_ms']:>7.2f} {row['max_ms']:>7.2f} {row['requests_per_tap']:>7.2f} "
+              f"{row['bytes_per_tap']:>7.0f} {row['boot_p50_ms']:>8.1f} {row['boot_max_ms']:>8.1f} "
+              f"{row['boot_bytes']:>9.0f} {row['outbox_pending']:>7} {row['stored_journeys']:>8}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--gates", type=int, default=50, help="simulated gates (default 50)")
+    parser.add_argument("--taps", type=int, default=20, help="taps per gate per stage (default 20)")
+    parser.add_argument("--interval-ms", type=int, default=3000, help="pause between a gate's taps (default 3000)")
+    parser.add_argument("--stages", default="1000:10000,10000:100000",
+                        help="comma separated cards:journeys dataset sizes (default 1000:10000,10000:100000)")
+    parser.add_argument("--url", default="http://127.0.0.1:9000/", help="URL tap_bench was built with")
+    parser.add_argument("--bench", default=os.path.join(HERE, "build", "tap_bench"), help="tap_bench binary")
+    parser.add_argument("--latency-ms", type=float, default=0.0, help="stand-in delay before every response")
+    parser.add_argument("--json", metavar="FILE", help="also write the stage results as JSON")
+    args = parser.parse_args()
+
+    if not os.access(args.bench, os.X_OK):
+        raise SystemExit(f"{args.bench} not found, run make first")
+
+    rows = []
+    for stage, (cards, journeys) in enumerate(parse_stages(args.stages)):
+        print(f"Stage {stage + 1}: {args.gates} gates, {cards} cards, {journeys} journeys", file=sys.stderr)
+        rows.append(run_stage(args, stage, cards, journeys))
+
+    print_report(rows)
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump(rows, out, indent=2)
+    return 1 if any(row["failed"] for row in rows) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
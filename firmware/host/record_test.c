@@ -0,0 +1,354 @@
+#include "journey_record.h"
+#include "journey_outbox.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Host test of the packed journey record and the outbox slot format: record
+// round trips in both versions, the slot CRC staying at offset 56, the move of
+// events pending in the legacy 128-byte slots, and undecodable slots left out
+// of an upload. Each case runs in its own process, so it starts from an erased
+// partition and a fresh outbox
+
+#define SLOT_MAGIC 0x4A524E32u          // "JRN2", as journey_outbox.c writes it
+#define SLOT_TYPE_OFFSET 8
+#define SLOT_RECORD_OFFSET 9
+#define SLOT_CRC_OFFSET 56
+#define SLOT_ACK_OFFSET (OUTBOX_SLOT_SIZE - 4)
+#define RECORD_V1_SIZE 44
+
+#define LEGACY_MAGIC 0x4A524E4Cu        // "JRNL"
+#define LEGACY_SLOT_SIZE 128
+
+// Slot layout of the firmware before packed records, kept here on purpose:
+// the test must notice if journey_outbox.c stops reading what was written
+typedef struct {
+    char ticket_id[16];
+    uint8_t rfid_uid[10];
+    uint8_t uid_size;
+    time_t start_timestamp;
+    time_t end_timestamp;
+    uint8_t origin_station;
+    uint8_t selected_class;
+    uint8_t selected_destination;
+    uint8_t actual_destination;
+    uint32_t travel_duration;
+    bool is_fraud_suspected;
+    journey_state_t current_state;
+} legacy_journey_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t type;
+    legacy_journey_t journey;
+    uint32_t crc;
+} legacy_record_t;
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "  %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// The uploader is left with nothing stored, so pending events stay put,
+// unless a case asks for the batches to be stored and kept
+static bool store_uploads = false;
+static journey_session_t uploaded[8];
+static size_t uploaded_count = 0;
+
+size_t firebase_write_journeys(const journey_session_t *journeys, size_t count, bool resend) {
+    if (!store_uploads) {
+        return 0;
+    }
+    for (size_t i = 0; i < count && uploaded_count < sizeof(uploaded) / sizeof(uploaded[0]); i++) {
+        uploaded[uploaded_count++] = journeys[i];
+    }
+    return count;
+}
+
+static void make_journey(journey_session_t *journey, uint8_t card, bool finished) {
+    static const uint8_t uid[7] = {0x04, 0x52, 0x9A, 0x1C, 0x33, 0x6B, 0x80};
+
+    memset(journey, 0, sizeof(journey_session_t));
+    snprintf(journey->ticket_id, sizeof(journey->ticket_id), "TK%02X-%010u", card, 4000000000u);
+    memcpy(journey->rfid_uid, uid, sizeof(uid));
+    journey->rfid_uid[6] = card;
+    journey->uid_size = sizeof(uid);
+    journey->start_timestamp = 4000000000u;     // Past 2038, still fits the u32 field
+    journey->origin_station = 3;
+    journey->selected_class = 1;
+    journey->selected_destination = 7;
+    journey->current_state = JOURNEY_STATE_ACTIVE;
+    if (finished) {
+        journey->end_timestamp = journey->start_timestamp + 2700;
+        journey->actual_destination = 6;
+        journey->travel_duration = 2700;
+        journey->fare = 350;
+        journey->is_fraud_suspected = true;
+        journey->current_state = JOURNEY_STATE_INACTIVE;
+    }
+}
+
+static bool same_journey(const journey_session_t *a, const journey_session_t *b) {
+    return strcmp(a->ticket_id, b->ticket_id) == 0 && a->uid_size == b->uid_size &&
+           memcmp(a->rfid_uid, b->rfid_uid, a->uid_size) == 0 &&
+           a->start_timestamp == b->start_timestamp && a->end_timestamp == b->end_timestamp &&
+           a->origin_station == b->origin_station && a->selected_class == b->selected_class &&
+           a->selected_destination == b->selected_destination &&
+           a->actual_destination == b->actual_destination && a->travel_duration == b->travel_duration &&
+           a->fare == b->fare && a->is_fraud_suspected == b->is_fraud_suspected &&
+           a->current_state == b->current_state;
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    uint32_t value;
+    memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+static void put_u32(uint8_t *out, uint32_t value) {
+    memcpy(out, &value, sizeof(value));
+}
+
+// A slot as the firmware writes it: erased bytes around the fields, the CRC
+// over everything before it
+static void make_slot(uint8_t *slot, uint32_t seq, outbox_event_t type, const uint8_t *record, size_t len) {
+    memset(slot, 0xFF, OUTBOX_SLOT_SIZE);
+    put_u32(slot, SLOT_MAGIC);
+    put_u32(slot + 4, seq);
+    slot[SLOT_TYPE_OFFSET] = (uint8_t)type;
+    memcpy(slot + SLOT_RECORD_OFFSET, record, len);
+    put_u32(slot + SLOT_CRC_OFFSET, esp_rom_crc32_le(0, slot, SLOT_CRC_OFFSET));
+}
+
+static void test_round_trip_v2(void) {
+    uint8_t record[JOURNEY_RECORD_SIZE];
+    journey_session_t in, out;
+
+    for (int finished = 0; finished <= 1; finished++) {
+        make_journey(&in, 0x21, finished);
+        CHECK(journey_record_encode(&in, record) == JOURNEY_RECORD_SIZE);
+        CHECK(record[0] == JOURNEY_RECORD_VERSION);
+        CHECK(journey_record_decode(record, sizeof(record), &out));
+        CHECK(same_journey(&in, &out));
+    }
+
+    // Truncated, unknown version and oversized UID are refused
+    CHECK(!journey_record_decode(record, JOURNEY_RECORD_SIZE - 1, &out));
+    record[0] = JOURNEY_RECORD_VERSION + 1;
+    CHECK(!journey_record_decode(record, sizeof(record), &out));
+    record[0] = JOURNEY_RECORD_VERSION;
+    record[2] = 11;
+    CHECK(!journey_record_decode(record, sizeof(record), &out));
+}
+
+// Version 1 is the version 2 layout without the trailing fare
+static void test_round_trip_v1(void) {
+    uint8_t record[JOURNEY_RECORD_SIZE];
+    journey_session_t in, out;
+
+    make_journey(&in, 0x22, true);
+    journey_record_encode(&in, record);
+    record[0] = 1;
+    CHECK(journey_record_decode(record, RECORD_V1_SIZE, &out));
+    CHECK(out.fare == 0);
+    in.fare = 0;
+    CHECK(same_journey(&in, &out));
+    CHECK(!journey_record_decode(record, RECORD_V1_SIZE - 1, &out));
+}
+
+// A version 1 slot left pending by the previous firmware is recovered, and
+// new slots keep the CRC where it always was
+static void test_slot_crc(void) {
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                ESP_PARTITION_SUBTYPE_ANY, OUTBOX_PARTITION_LABEL);
+    uint8_t record[JOURNEY_RECORD_SIZE];
+    uint8_t slot[OUTBOX_SLOT_SIZE];
+    journey_session_t old_journey, new_journey, found;
+    outbox_stats_t stats;
+
+    make_journey(&old_journey, 0x31, true);
+    journey_record_encode(&old_journey, record);
+    record[0] = 1;
+    make_slot(slot, 41, OUTBOX_EVENT_END_JOURNEY, record, RECORD_V1_SIZE);
+    esp_partition_write(partition, 0, slot, sizeof(slot));
+
+    CHECK(journey_outbox_init() == ESP_OK);
+    journey_outbox_get_stats(&stats);
+    CHECK(stats.pending == 1);
+    CHECK(journey_outbox_find_latest(old_journey.rfid_uid, old_journey.uid_size, &found));
+    old_journey.fare = 0;
+    CHECK(same_journey(&old_journey, &found));
+
+    make_journey(&new_journey, 0x32, false);
+    CHECK(journey_outbox_append(OUTBOX_EVENT_START_JOURNEY, &new_journey) == ESP_OK);
+    esp_partition_read(partition, OUTBOX_SLOT_SIZE, slot, sizeof(slot));
+    CHECK(get_u32(slot) == SLOT_MAGIC);
+    CHECK(get_u32(slot + 4) == 42);
+    CHECK(slot[SLOT_TYPE_OFFSET] == OUTBOX_EVENT_START_JOURNEY);
+    CHECK(get_u32(slot + SLOT_CRC_OFFSET) == esp_rom_crc32_le(0, slot, SLOT_CRC_OFFSET));
+    CHECK(get_u32(slot + SLOT_ACK_OFFSET) == 0xFFFFFFFFu);
+    CHECK(journey_record_decode(slot + SLOT_RECORD_OFFSET, JOURNEY_RECORD_SIZE, &found));
+    CHECK(same_journey(&new_journey, &found));
+}
+
+static void write_legacy(const esp_partition_t *partition, uint32_t slot, uint32_t seq, outbox_event_t type,
+                         const journey_session_t *journey, bool acked) {
+    uint8_t image[LEGACY_SLOT_SIZE];
+    legacy_record_t record;
+
+    memset(&record, 0xFF, sizeof(record));
+    record.magic = LEGACY_MAGIC;
+    record.seq = seq;
+    record.type = type;
+    memcpy(record.journey.ticket_id, journey->ticket_id, sizeof(record.journey.ticket_id));
+    memcpy(record.journey.rfid_uid, journey->rfid_uid, sizeof(record.journey.rfid_uid));
+    record.journey.uid_size = journey->uid_size;
+    record.journey.start_timestamp = journey->start_timestamp;
+    record.journey.end_timestamp = journey->end_timestamp;
+    record.journey.origin_station = journey->origin_station;
+    record.journey.selected_class = journey->selected_class;
+    record.journey.selected_destination = journey->selected_destination;
+    record.journey.actual_destination = journey->actual_destination;
+    record.journey.travel_duration = journey->travel_duration;
+    record.journey.is_fraud_suspected = journey->is_fraud_suspected;
+    record.journey.current_state = journey->current_state;
+    record.crc = esp_rom_crc32_le(0, (const uint8_t *)&record, offsetof(legacy_record_t, crc));
+
+    memset(image, 0xFF, sizeof(image));
+    memcpy(image, &record, sizeof(record));
+    if (acked) {
+        put_u32(image + LEGACY_SLOT_SIZE - 4, 0);
+    }
+    esp_partition_write(partition, slot * LEGACY_SLOT_SIZE, image, sizeof(image));
+}
+
+// Pending legacy events are re-logged oldest first after the newest one,
+// and each old copy is marked uploaded
+static void test_legacy_migration(void) {
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                ESP_PARTITION_SUBTYPE_ANY, OUTBOX_PARTITION_LABEL);
+    journey_session_t journeys[4], found;
+    outbox_stats_t stats;
+    uint8_t slot[OUTBOX_SLOT_SIZE];
+    uint32_t ack;
+
+    make_journey(&journeys[0], 0x41, false);
+    make_journey(&journeys[1], 0x41, true);
+    make_journey(&journeys[2], 0x42, false);
+    make_journey(&journeys[3], 0x43, false);
+    journeys[1].fare = 0;       // Legacy records carry no fare
+
+    // Slot order differs from log order, as after the old ring wrapped
+    write_legacy(partition, 0, 8, OUTBOX_EVENT_START_JOURNEY, &journeys[2], false);
+    write_legacy(partition, 1, 6, OUTBOX_EVENT_START_JOURNEY, &journeys[0], false);
+    write_legacy(partition, 2, 7, OUTBOX_EVENT_END_JOURNEY, &journeys[1], false);
+    write_legacy(partition, 3, 5, OUTBOX_EVENT_START_JOURNEY, &journeys[3], true);
+
+    CHECK(journey_outbox_init() == ESP_OK);
+    journey_outbox_get_stats(&stats);
+    CHECK(stats.pending == 3);
+    CHECK(stats.appended == 3);
+
+    // The latest event per card is found, the uploaded one is not carried over
+    CHECK(journey_outbox_find_latest(journeys[1].rfid_uid, journeys[1].uid_size, &found));
+    CHECK(same_journey(&journeys[1], &found));
+    CHECK(journey_outbox_find_latest(journeys[2].rfid_uid, journeys[2].uid_size, &found));
+    CHECK(same_journey(&journeys[2], &found));
+    CHECK(!journey_outbox_find_latest(journeys[3].rfid_uid, journeys[3].uid_size, &found));
+
+    // Re-logged in the sector after the newest legacy slot, continuing its sequence
+    for (size_t i = 0; i < 3; i++) {
+        esp_partition_read(partition, OUTBOX_SECTOR_SIZE + i * OUTBOX_SLOT_SIZE, slot, sizeof(slot));
+        CHECK(get_u32(slot) == SLOT_MAGIC);
+        CHECK(get_u32(slot + 4) == 9 + i);
+        CHECK(get_u32(slot + SLOT_CRC_OFFSET) == esp_rom_crc32_le(0, slot, SLOT_CRC_OFFSET));
+        CHECK(journey_record_decode(slot + SLOT_RECORD_OFFSET, JOURNEY_RECORD_SIZE, &found));
+        CHECK(same_journey(&journeys[i], &found));
+    }
+
+    for (uint32_t i = 0; i < 3; i++) {
+        esp_partition_read(partition, i * LEGACY_SLOT_SIZE + LEGACY_SLOT_SIZE - 4, &ack, sizeof(ack));
+        CHECK(ack == 0);
+    }
+}
+
+// A slot whose CRC holds but whose record does not decode is acknowledged
+// without being sent, and the events around it go up under their own data
+static void test_undecodable_slot(void) {
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                ESP_PARTITION_SUBTYPE_ANY, OUTBOX_PARTITION_LABEL);
+    uint8_t record[JOURNEY_RECORD_SIZE];
+    uint8_t slot[OUTBOX_SLOT_SIZE];
+    journey_session_t journeys[3];
+    outbox_stats_t stats;
+
+    for (uint32_t i = 0; i < 3; i++) {
+        make_journey(&journeys[i], 0x51 + i, i == 2);
+        journey_record_encode(&journeys[i], record);
+        if (i == 1) {
+            record[0] = JOURNEY_RECORD_VERSION + 1;
+        }
+        make_slot(slot, 21 + i, OUTBOX_EVENT_START_JOURNEY, record, sizeof(record));
+        esp_partition_write(partition, i * OUTBOX_SLOT_SIZE, slot, sizeof(slot));
+    }
+
+    store_uploads = true;
+    CHECK(journey_outbox_init() == ESP_OK);
+    for (int waited = 0; waited < 200; waited++) {
+        journey_outbox_get_stats(&stats);
+        if (stats.pending == 0) {
+            break;
+        }
+        usleep(10000);
+    }
+
+    CHECK(stats.pending == 0);
+    CHECK(stats.uploaded == 2);
+    CHECK(stats.discarded == 1);
+    CHECK(uploaded_count == 2);
+    CHECK(same_journey(&journeys[0], &uploaded[0]));
+    CHECK(same_journey(&journeys[2], &uploaded[1]));
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} test_case_t;
+
+int main(void) {
+    static const test_case_t cases[] = {
+        {"record round trip, version 2", test_round_trip_v2},
+        {"record round trip, version 1", test_round_trip_v1},
+        {"slot CRC at offset 56", test_slot_crc},
+        {"legacy outbox migration", test_legacy_migration},
+        {"undecodable slot skipped", test_undecodable_slot},
+    };
+    int failed = 0;
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            cases[i].run();
+            fflush(stderr);
+            _exit(failures ? 1 : 0);
+        }
+
+        int status = 0;
+        bool passed = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        printf("%-32s %s\n", cases[i].name, passed ? "ok" : "FAILED");
+        failed += !passed;
+    }
+    return failed ? 1 : 0;
+}
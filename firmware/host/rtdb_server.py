@@ -0,0 +1,471 @@
+#!/usr/bin/env python3
+"""Local stand-in for the Firebase Realtime Database REST API.
+
+Serves the subset of the REST protocol the gate firmware uses, over plain
+HTTP/1.1 with keep-alive, so firebase.c can be benchmarked on a host without
+network jitter:
+
+  GET/PUT/PATCH/POST/DELETE on /<path>.json, multi-path PATCH on the root
+  orderBy / equalTo / startAt / endAt / limitToFirst / limitToLast / shallow
+  X-Firebase-ETag and if-match conditional writes (412 on mismatch)
+  {".sv": "timestamp"} server values
+  Accept: text/event-stream subscriptions with put events and keep-alives
+
+Faults are injected reproducibly from --seed: --latency-ms delays every
+response, --fail-rate answers with 503, --drop-rate closes the connection
+without answering and --lost-reply-rate applies a write, then closes the
+connection without answering, as when a response is lost on the way back.
+GET /.stats returns request and byte counters.
+
+  python3 rtdb_server.py --port 9000 --data seed.json --cards 5000 --journeys 50000
+"""
+
+import argparse
+import copy
+import hashlib
+import json
+import queue
+import random
+import socket
+import socketserver
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, HTTPServer
+from urllib.parse import parse_qs, unquote
+
+KEEP_ALIVE_INTERVAL_S = 30
+
+
+class Database:
+    """JSON tree with subscriptions, guarded by one lock."""
+
+    def __init__(self, data=None):
+        self.root = data if data is not None else {}
+        self.lock = threading.Lock()
+        self.listeners = []
+
+    @staticmethod
+    def split(path):
+        return [unquote(part) for part in path.strip("/").split("/") if part]
+
+    def get(self, keys):
+        node = self.root
+        for key in keys:
+            if not isinstance(node, dict) or key not in node:
+                return None
+            node = node[key]
+        return node
+
+    def _set(self, keys, value):
+        if not keys:
+            self.root = value if value is not None else {}
+            return
+        # Create intermediate objects, then prune the ones a null write empties
+        node = self.root
+        parents = []
+        for key in keys[:-1]:
+            if not isinstance(node.get(key), dict):
+                if value is None:
+                    return
+                node[key] = {}
+            parents.append((node, key))
+            node = node[key]
+        if value is None:
+            node.pop(keys[-1], None)
+            for parent, key in reversed(parents):
+                if parent[key]:
+                    break
+                del parent[key]
+        else:
+            node[keys[-1]] = value
+
+    def write(self, keys, value):
+        self._set(keys, value)
+        self._notify(keys)
+
+    def update(self, keys, children):
+        for child, value in children.items():
+            self._set(keys + self.split(child), value)
+        for child in children:
+            self._notify(keys + self.split(child))
+
+    def _notify(self, keys):
+        for listener in list(self.listeners):
+            listener.changed(self, keys)
+
+
+class Listener:
+    """One event-stream subscription; events are queued as (name, data)."""
+
+    def __init__(self, keys):
+        self.keys = keys
+        self.events = queue.Queue()
+
+    def changed(self, db, keys):
+        depth = len(self.keys)
+        if keys[:depth] == self.keys:
+            relative = "/" + "/".join(keys[depth:])
+            self.events.put(("put", {"path": relative, "data": copy.deepcopy(db.get(keys))}))
+        elif self.keys[:len(keys)] == keys:
+            self.events.put(("put", {"path": "/", "data": copy.deepcopy(db.get(self.keys))}))
+
+
+def synthesize_cards(root, count):
+    """Add count approved applications and their /cardsByUid records."""
+    if count <= 0:
+        return
+    applications = root.setdefault("rfidApplications", {})
+    cards = root.setdefault("cardsByUid", {})
+    for i in range(count):
+        uid = "08%06X" % i
+        user_id = "bench-%06d" % i
+        applications[user_id] = {"name": "Bench Rider %d" % i, "rfidUid": uid, "status": "approved",
+                                 "updatedAt": 1700000000000 + i}
+        cards[uid] = {"name": "Bench Rider %d" % i, "status": "approved", "userId": user_id}
+
+
+def synthesize_journeys(root, count):
+    """Add count finished journeys spread over the approved cards, as history."""
+    if count <= 0:
+        return
+    uids = sorted(uid for uid, card in root.get("cardsByUid", {}).items() if card.get("status") == "approved")
+    if not uids:
+        raise SystemExit("--journeys needs approved cards (--cards or --data)")
+    journeys = root.setdefault("journeys", {})
+    start_s = 1700000000
+    for i in range(count):
+        origin = 1 + i % 17
+        destination = 1 + (i * 7 + 3) % 17
+        started = start_s + i * 60
+        ticket = "BENCH%010d" % i
+        journeys[ticket] = {
+            "ticketID": ticket, "rfidUid": uids[i % len(uids)],
+            "startTimestamp": time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime(started)),
+            "endTimestamp": time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime(started + 1800)),
+            "originStation": origin, "selectedClass": 1 + i % 3, "selectedDestinationStation": destination,
+            "actualDestinationStation": destination, "travelDuration": 1800, "fare": 100,
+            "isFraudSuspected": False, "currentState": 0, "recordedAt": (started + 1800) * 1000,
+        }
+
+
+def etag_of(value):
+    return hashlib.sha1(json.dumps(value, sort_keys=True, separators=(",", ":")).encode()).hexdigest()
+
+
+def resolve_server_values(value, now_ms):
+    if isinstance(value, dict):
+        if value == {".sv": "timestamp"}:
+            return now_ms
+        return {key: resolve_server_values(child, now_ms) for key, child in value.items()}
+    if isinstance(value, list):
+        return [resolve_server_values(child, now_ms) for child in value]
+    return value
+
+
+def sort_value(value):
+    # Firebase ordering: null, false, true, numbers, strings, objects
+    if value is None:
+        return (0,)
+    if isinstance(value, bool):
+        return (1, value)
+    if isinstance(value, (int, float)):
+        return (2, value)
+    if isinstance(value, str):
+        return (3, value)
+    return (4,)
+
+
+def apply_query(value, params):
+    """orderBy filters and limits on the children of value."""
+    if params.get("shallow") == "true" and isinstance(value, dict):
+        return {key: (True if isinstance(child, dict) else child) for key, child in value.items()}
+    if "orderBy" not in params or not isinstance(value, dict):
+        return value
+
+    order_by = json.loads(params["orderBy"])
+    if order_by in ("$key",):
+        items = [(key, key, child) for key, child in value.items()]
+    elif order_by == "$value":
+        items = [(child, key, child) for key, child in value.items()]
+    else:
+        items = [((child.get(order_by) if isinstance(child, dict) else None), key, child)
+                 for key, child in value.items()]
+    items.sort(key=lambda item: (sort_value(item[0]), item[1]))
+
+    if "equalTo" in params:
+        target = sort_value(json.loads(params["equalTo"]))
+        items = [item for item in items if sort_value(item[0]) == target]
+    if "startAt" in params:
+        start = sort_value(json.loads(params["startAt"]))
+        items = [item for item in items if sort_value(item[0]) >= start]
+    if "endAt" in params:
+        end = sort_value(json.loads(params["endAt"]))
+        items = [item for item in items if sort_value(item[0]) <= end]
+    if "limitToFirst" in params:
+        items = items[:int(params["limitToFirst"])]
+    if "limitToLast" in params:
+        items = items[-int(params["limitToLast"]):]
+    return {key: child for _, key, child in items}
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.counters = {"connections": 0, "requests": 0, "bytes_in": 0, "bytes_out": 0,
+                         "failed": 0, "dropped": 0, "lost_replies": 0, "precondition_failed": 0,
+                         "methods": {}}
+
+    def add(self, **counts):
+        with self.lock:
+            for key, amount in counts.items():
+                self.counters[key] += amount
+
+    def request(self, method, bytes_in):
+        with self.lock:
+            self.counters["requests"] += 1
+            self.counters["bytes_in"] += bytes_in
+            methods = self.counters["methods"]
+            methods[method] = methods.get(method, 0) + 1
+
+    def snapshot(self):
+        with self.lock:
+            return copy.deepcopy(self.counters)
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    server_version = "rtdb-stand-in/1.0"
+
+    def setup(self):
+        super().setup()
+        # Headers and body are separate writes; with Nagle on, the body waits
+        # for the client's delayed ACK
+        self.connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.server.stats.add(connections=1)
+
+    def log_message(self, format, *args):
+        if self.server.verbose:
+            super().log_message(format, *args)
+
+    # Request plumbing
+
+    def read_body(self):
+        length = int(self.headers.get("Content-Length") or 0)
+        return self.rfile.read(length) if length else b""
+
+    def send_json(self, status, value, etag=None):
+        body = b"" if status == 204 else json.dumps(value, separators=(",", ":")).encode()
+        self.send_response(status)
+        if status != 204:
+            self.send_header("Content-Type", "application/json; charset=utf-8")
+        self.send_header("Content-Length", str(len(body)))
+        self.send_header("Cache-Control", "no-cache")
+        if etag:
+            self.send_header("ETag", etag)
+        self.end_headers()
+        self.wfile.write(body)
+        self.server.stats.add(bytes_out=len(body))
+
+    def send_error_json(self, status, message):
+        self.send_json(status, {"error": message})
+
+    def handle_one(self, method):
+        # Not urlsplit: the firmware joins FIREBASE_HOST and "/path", and a
+        # leading "//" would be taken for a network location
+        path, _, query = self.path.partition("?")
+        params = {key: values[-1] for key, values in parse_qs(query).items()}
+        body = self.read_body()
+        self.server.stats.request(method, len(self.requestline) + len(body))
+
+        if path == "/.stats":
+            self.send_json(200, self.server.stats.snapshot())
+            return
+
+        # Faults are drawn before any state changes, so a dropped write never
+        # lands; a lost reply is only acted on once the write has been applied
+        fault = self.server.draw_fault()
+        if self.server.latency_s:
+            time.sleep(self.server.latency_s)
+        if fault == "drop":
+            self.server.stats.add(dropped=1)
+            self.close_connection = True
+            return
+        if fault == "fail":
+            self.server.stats.add(failed=1)
+            self.send_error_json(503, "Injected failure")
+            return
+
+        if self.server.auth and params.get("auth") != self.server.auth:
+            self.send_error_json(401, "Permission denied")
+            return
+        if not path.endswith(".json"):
+            self.send_error_json(404, "Not found")
+            return
+        keys = Database.split(path[:-len(".json")])
+
+        if method == "GET" and "text/event-stream" in (self.headers.get("Accept") or ""):
+            self.stream(keys)
+            return
+
+        try:
+            value = json.loads(body) if body else None
+        except ValueError:
+            self.send_error_json(400, "Invalid data; couldn't parse JSON object, array, or value.")
+            return
+
+        db = self.server.db
+        want_etag = (self.headers.get("X-Firebase-ETag") or "").lower() == "true"
+        if_match = self.headers.get("if-match")
+        silent = params.get("print") == "silent"
+        now_ms = int(time.time() * 1000)
+
+        with db.lock:
+            current = db.get(keys)
+            if if_match is not None and method in ("PUT", "DELETE") and if_match != etag_of(current):
+                self.server.stats.add(precondition_failed=1)
+                self.send_json(412, current, etag_of(current))
+                return
+
+            if method == "GET":
+                result = apply_query(current, params)
+            elif method == "PUT":
+                result = resolve_server_values(value, now_ms)
+                db.write(keys, copy.deepcopy(result))
+            elif method == "PATCH":
+                if not isinstance(value, dict):
+                    self.send_error_json(400, "Invalid data; PATCH needs an object.")
+                    return
+                result = resolve_server_values(value, now_ms)
+                db.update(keys, copy.deepcopy(result))
+            elif method == "POST":
+                name = "-%013x%07x" % (now_ms, random.getrandbits(28))
+                db.write(keys + [name], resolve_server_values(value, now_ms))
+                result = {"name": name}
+            else:
+                db.write(keys, None)
+                result = None
+            etag = etag_of(db.get(keys)) if want_etag or if_match is not None else None
+
+        if fault == "lose" and method != "GET":
+            self.server.stats.add(lost_replies=1)
+            self.close_connection = True
+            return
+        self.send_json(204 if silent else 200, result, etag)
+
+    def stream(self, keys):
+        db = self.server.db
+        listener = Listener(keys)
+        with db.lock:
+            snapshot = copy.deepcopy(db.get(keys))
+            db.listeners.append(listener)
+
+        self.send_response(200)
+        self.send_header("Content-Type", "text/event-stream")
+        self.send_header("Cache-Control", "no-cache")
+        self.send_header("Transfer-Encoding", "chunked")
+        self.end_headers()
+
+        def send_event(name, data):
+            payload = ("event: %s\ndata: %s\n\n" % (name, json.dumps(data, separators=(",", ":")))).encode()
+            self.wfile.write(b"%x\r\n%s\r\n" % (len(payload), payload))
+            self.wfile.flush()
+            self.server.stats.add(bytes_out=len(payload))
+
+        try:
+            send_event("put", {"path": "/", "data": snapshot})
+            while not self.server.stopping:
+                try:
+                    name, data = listener.events.get(timeout=KEEP_ALIVE_INTERVAL_S)
+                except queue.Empty:
+                    name, data = "keep-alive", None
+                send_event(name, data)
+        except (BrokenPipeError, ConnectionResetError):
+            pass
+        finally:
+            with db.lock:
+                db.listeners.remove(listener)
+            self.close_connection = True
+
+    def do_GET(self):
+        self.handle_one("GET")
+
+    def do_PUT(self):
+        self.handle_one("PUT")
+
+    def do_PATCH(self):
+        self.handle_one("PATCH")
+
+    def do_POST(self):
+        self.handle_one("POST")
+
+    def do_DELETE(self):
+        self.handle_one("DELETE")
+
+
+class Server(socketserver.ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, address, db, args):
+        super().__init__(address, Handler)
+        self.db = db
+        self.stats = Stats()
+        self.auth = args.auth
+        self.verbose = args.verbose
+        self.latency_s = args.latency_ms / 1000.0
+        self.fail_rate = args.fail_rate
+        self.drop_rate = args.drop_rate
+        self.lost_reply_rate = args.lost_reply_rate
+        self.rng = random.Random(args.seed)
+        self.rng_lock = threading.Lock()
+        self.stopping = False
+
+    def draw_fault(self):
+        with self.rng_lock:
+            roll = self.rng.random()
+        if roll < self.drop_rate:
+            return "drop"
+        if roll < self.drop_rate + self.fail_rate:
+            return "fail"
+        if roll < self.drop_rate + self.fail_rate + self.lost_reply_rate:
+            return "lose"
+        return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=9000)
+    parser.add_argument("--data", help="JSON file loaded as the database root")
+    parser.add_argument("--cards", type=int, default=0, help="synthesize approved cards 08000000, 08000001, ...")
+    parser.add_argument("--journeys", type=int, default=0, help="synthesize finished journeys over the approved cards")
+    parser.add_argument("--auth", help="require ?auth=<token> (any token is accepted when unset)")
+    parser.add_argument("--latency-ms", type=float, default=0.0, help="delay before every response")
+    parser.add_argument("--fail-rate", type=float, default=0.0, help="fraction of requests answered with 503")
+    parser.add_argument("--drop-rate", type=float, default=0.0, help="fraction of connections closed unanswered")
+    parser.add_argument("--lost-reply-rate", type=float, default=0.0,
+                        help="fraction of writes applied but left unanswered")
+    parser.add_argument("--seed", type=int, default=1, help="fault injection seed")
+    parser.add_argument("--verbose", action="store_true", help="log every request")
+    args = parser.parse_args()
+
+    data = {}
+    if args.data:
+        with open(args.data) as f:
+            data = json.load(f)
+    synthesize_cards(data, args.cards)
+    synthesize_journeys(data, args.journeys)
+
+    server = Server((args.host, args.port), Database(data), args)
+    print("RTDB stand-in listening on http://%s:%d/" % (args.host, args.port), flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.stopping = True
+        server.server_close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,405 @@
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "esp_crt_bundle.h"
+#include "esp_partition.h"
+#include "esp_heap_caps.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include <malloc.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Logging, timers, CRC, NVS and the journal partition for the host build
+
+static esp_log_level_t log_level = ESP_LOG_INFO;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+        case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_INVALID_HANDLE: return "ESP_ERR_NVS_INVALID_HANDLE";
+        case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+        case 0x7001: return "ESP_ERR_HTTP_MAX_REDIRECT";
+        case 0x7002: return "ESP_ERR_HTTP_CONNECT";
+        case 0x7003: return "ESP_ERR_HTTP_WRITE_DATA";
+        case 0x7004: return "ESP_ERR_HTTP_FETCH_HEADER";
+        case 0x7005: return "ESP_ERR_HTTP_INVALID_TRANSPORT";
+        case 0x7006: return "ESP_ERR_HTTP_CONNECTING";
+        case 0x7007: return "ESP_ERR_HTTP_EAGAIN";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    if (strcmp(tag, "*") == 0) {
+        log_level = level;
+    }
+}
+
+// Same line layout as the firmware console: level, milliseconds, tag
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    static const char letters[] = "NEWIDV";
+    va_list args;
+
+    if (level > log_level) {
+        return;
+    }
+    pthread_mutex_lock(&log_lock);
+    fprintf(stderr, "%c (%lld) %s: ", letters[level], (long long)(esp_timer_get_time() / 1000), tag);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    pthread_mutex_unlock(&log_lock);
+}
+
+int64_t esp_timer_get_time(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t esp_random(void) {
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    static uint64_t state = 0;
+    uint32_t value;
+
+    // Seeded from HOST_RANDOM_SEED when set, so runs can be replayed
+    pthread_mutex_lock(&lock);
+    if (state == 0) {
+        const char *seed = getenv("HOST_RANDOM_SEED");
+        state = seed ? strtoull(seed, NULL, 0) * 2 + 1 : (uint64_t)esp_timer_get_time() | 1;
+    }
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    value = (uint32_t)(state >> 32);
+    pthread_mutex_unlock(&lock);
+    return value;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+esp_err_t esp_crt_bundle_attach(void *conf) {
+    return ESP_OK;
+}
+
+// NVS: a flat list of namespace/key blobs, handles are namespace indexes
+
+#define HOST_NVS_MAX_NAMESPACES 8
+
+typedef struct nvs_entry {
+    struct nvs_entry *next;
+    nvs_handle_t ns;
+    char key[16];
+    size_t length;
+    uint8_t value[];
+} nvs_entry_t;
+
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static char nvs_namespaces[HOST_NVS_MAX_NAMESPACES][16];
+static nvs_entry_t *nvs_entries = NULL;
+
+esp_err_t nvs_flash_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    pthread_mutex_lock(&nvs_lock);
+    while (nvs_entries) {
+        nvs_entry_t *next = nvs_entries->next;
+        free(nvs_entries);
+        nvs_entries = next;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle) {
+    esp_err_t err = ESP_ERR_NO_MEM;
+
+    pthread_mutex_lock(&nvs_lock);
+    for (nvs_handle_t i = 0; i < HOST_NVS_MAX_NAMESPACES; i++) {
+        if (strncmp(nvs_namespaces[i], name, sizeof(nvs_namespaces[i]) - 1) == 0) {
+            *out_handle = i + 1;
+            err = ESP_OK;
+            break;
+        }
+        if (nvs_namespaces[i][0] == '\0') {
+            // Like the real NVS, a read-only open of an unknown namespace fails
+            if (open_mode == NVS_READONLY) {
+                err = ESP_ERR_NVS_NOT_FOUND;
+                break;
+            }
+            strncpy(nvs_namespaces[i], name, sizeof(nvs_namespaces[i]) - 1);
+            *out_handle = i + 1;
+            err = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+void nvs_close(nvs_handle_t handle) {
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    return ESP_OK;
+}
+
+static nvs_entry_t **nvs_find(nvs_handle_t handle, const char *key) {
+    nvs_entry_t **entry = &nvs_entries;
+
+    while (*entry && ((*entry)->ns != handle || strcmp((*entry)->key, key) != 0)) {
+        entry = &(*entry)->next;
+    }
+    return entry;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+    if (handle == 0 || handle > HOST_NVS_MAX_NAMESPACES) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    nvs_entry_t *entry = malloc(sizeof(nvs_entry_t) + length);
+    if (entry == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    entry->ns = handle;
+    strncpy(entry->key, key, sizeof(entry->key) - 1);
+    entry->key[sizeof(entry->key) - 1] = '\0';
+    entry->length = length;
+    memcpy(entry->value, value, length);
+
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t **slot = nvs_find(handle, entry->key);
+    if (*slot) {
+        entry->next = (*slot)->next;
+        free(*slot);
+    } else {
+        entry->next = NULL;
+    }
+    *slot = entry;
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+// With out_value NULL only the stored length is returned, as in ESP-IDF
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length) {
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t *entry = *nvs_find(handle, key);
+    if (entry == NULL) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (out_value == NULL) {
+        *length = entry->length;
+    } else if (*length < entry->length) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(out_value, entry->value, entry->length);
+        *length = entry->length;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t **slot = nvs_find(handle, key);
+    if (*slot) {
+        nvs_entry_t *entry = *slot;
+        *slot = entry->next;
+        free(entry);
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+// Journal partition: RAM image with NOR semantics, writes can only clear bits
+
+static uint8_t journal_image[HOST_JOURNAL_SIZE];
+static bool journal_erased = false;
+
+static const esp_partition_t journal_partition = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = 0x40,
+    .address = 0x120000,
+    .size = HOST_JOURNAL_SIZE,
+    .erase_size = 4096,
+    .label = "journal"
+};
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+    if (label && strcmp(label, journal_partition.label) != 0) {
+        return NULL;
+    }
+    if (!journal_erased) {
+        memset(journal_image, 0xFF, sizeof(journal_image));
+        journal_erased = true;
+    }
+    return &journal_partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    if (src_offset > partition->size || size > partition->size - src_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, journal_image + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    if (dst_offset > partition->size || size > partition->size - dst_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < size; i++) {
+        journal_image[dst_offset + i] &= ((const uint8_t *)src)[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (offset % partition->erase_size || size % partition->erase_size ||
+        offset > partition->size || size > partition->size - offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(journal_image + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+// Heap accounting. The Makefile links with --wrap=malloc and friends, so the
+// firmware's calls land in __wrap_* and __real_* are the C library's
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_heap_stats_t heap_stats;
+static int64_t heap_peak_bytes = 0;
+
+static void heap_account(int64_t delta, bool allocated, bool freed) {
+    pthread_mutex_lock(&heap_lock);
+    heap_stats.live_bytes += delta;
+    heap_stats.allocations += allocated;
+    heap_stats.frees += freed;
+    if (heap_stats.live_bytes > heap_peak_bytes) {
+        heap_peak_bytes = heap_stats.live_bytes;
+    }
+    if (heap_stats.live_bytes > heap_stats.peak_bytes) {
+        heap_stats.peak_bytes = heap_stats.live_bytes;
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void *__wrap_malloc(size_t size) {
+    void *ptr = __real_malloc(size);
+    if (ptr) {
+        heap_account((int64_t)malloc_usable_size(ptr), true, false);
+    }
+    return ptr;
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    void *ptr = __real_calloc(count, size);
+    if (ptr) {
+        heap_account((int64_t)malloc_usable_size(ptr), true, false);
+    }
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    int64_t before = ptr ? (int64_t)malloc_usable_size(ptr) : 0;
+    void *moved = __real_realloc(ptr, size);
+    if (moved) {
+        heap_account((int64_t)malloc_usable_size(moved) - before, true, false);
+    } else if (size == 0 && ptr) {
+        heap_account(-before, false, true);
+    }
+    return moved;
+}
+
+char *__wrap_strdup(const char *str) {
+    size_t len = strlen(str) + 1;
+    char *copy = __wrap_malloc(len);
+    if (copy) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+void __wrap_free(void *ptr) {
+    if (ptr) {
+        heap_account(-(int64_t)malloc_usable_size(ptr), false, true);
+    }
+    __real_free(ptr);
+}
+
+void host_heap_get_stats(host_heap_stats_t *stats) {
+    pthread_mutex_lock(&heap_lock);
+    memcpy(stats, &heap_stats, sizeof(host_heap_stats_t));
+    pthread_mutex_unlock(&heap_lock);
+}
+
+// Start a new peak_bytes window; the low-water mark behind
+// heap_caps_get_minimum_free_size is kept since boot
+void host_heap_reset_peak(void) {
+    pthread_mutex_lock(&heap_lock);
+    heap_stats.peak_bytes = heap_stats.live_bytes;
+    pthread_mutex_unlock(&heap_lock);
+}
+
+static size_t heap_free_for(int64_t used) {
+    return used >= HOST_HEAP_SIZE ? 0 : (size_t)(HOST_HEAP_SIZE - (used > 0 ? used : 0));
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    host_heap_stats_t stats;
+    host_heap_get_stats(&stats);
+    return heap_free_for(stats.live_bytes);
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    pthread_mutex_lock(&heap_lock);
+    int64_t peak = heap_peak_bytes;
+    pthread_mutex_unlock(&heap_lock);
+    return heap_free_for(peak);
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    return heap_caps_get_free_size(caps);
+}
@@ -0,0 +1,662 @@
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include <ctype.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static const char *TAG = "HTTP_CLIENT";
+
+#define HOST_HTTP_MAX_HEADERS 16
+#define HOST_HTTP_RX_BUFFER_SIZE 4096
+#define HOST_HTTP_LINE_SIZE 1024
+#define HOST_HTTP_MAX_REDIRECTS 10
+
+typedef struct {
+    char *key;
+    char *value;
+} http_header_t;
+
+struct esp_http_client {
+    // From the configuration
+    http_event_handle_cb event_handler;
+    void *user_data;
+    int timeout_ms;
+    bool disable_auto_redirect;
+    int max_redirection_count;
+
+    // Request
+    bool https;
+    char host[128];
+    int port;
+    char *path;             // Path and query string
+    esp_http_client_method_t method;
+    http_header_t headers[HOST_HTTP_MAX_HEADERS];
+    const char *post_data;
+    int post_len;
+
+    // Connection, kept open between requests unless the server closes it
+    int sock;
+    char connected_host[128];
+    int connected_port;
+
+    // Response
+    int status_code;
+    int64_t content_length; // -1 when the body is chunked or runs until close
+    bool chunked;
+    bool close_after;       // Server asked to close, or HTTP/1.0
+    int64_t body_remaining; // Left in the body (Content-Length) or the current chunk
+    bool body_done;
+    char *location;
+    char rx[HOST_HTTP_RX_BUFFER_SIZE];
+    int rx_pos;
+    int rx_len;
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_http_stats_t wire_stats;
+
+static const char *method_names[HTTP_METHOD_MAX] = {"GET", "POST", "PUT", "PATCH", "DELETE", "HEAD"};
+
+static void count_bytes(uint64_t sent, uint64_t received, uint32_t connects) {
+    pthread_mutex_lock(&stats_lock);
+    wire_stats.bytes_sent += sent;
+    wire_stats.bytes_received += received;
+    wire_stats.connects += connects;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void host_http_get_stats(host_http_stats_t *stats) {
+    pthread_mutex_lock(&stats_lock);
+    *stats = wire_stats;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void dispatch(esp_http_client_handle_t client, esp_http_client_event_id_t id, void *data, int len,
+                     char *key, char *value) {
+    if (client->event_handler == NULL) {
+        return;
+    }
+    esp_http_client_event_t evt = {
+        .event_id = id,
+        .client = client,
+        .data = data,
+        .data_len = len,
+        .user_data = client->user_data,
+        .header_key = key,
+        .header_value = value
+    };
+    client->event_handler(&evt);
+}
+
+// http://host[:port]/path?query, or a path-only redirect target on the same server
+static esp_err_t parse_url(esp_http_client_handle_t client, const char *url) {
+    const char *rest = url;
+
+    if (strncmp(url, "http://", 7) == 0 || strncmp(url, "https://", 8) == 0) {
+        client->https = (url[4] == 's');
+        rest = url + (client->https ? 8 : 7);
+
+        size_t host_len = strcspn(rest, ":/?");
+        if (host_len == 0 || host_len >= sizeof(client->host)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        memcpy(client->host, rest, host_len);
+        client->host[host_len] = '\0';
+        rest += host_len;
+
+        client->port = client->https ? 443 : 80;
+        if (*rest == ':') {
+            client->port = (int)strtol(rest + 1, (char **)&rest, 10);
+        }
+    } else if (url[0] != '/') {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    char *path = strdup(*rest ? rest : "/");
+    if (path == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (path[0] == '?') {
+        // "host?query" has an implicit root path
+        char *rooted = malloc(strlen(path) + 2);
+        if (rooted == NULL) {
+            free(path);
+            return ESP_ERR_NO_MEM;
+        }
+        rooted[0] = '/';
+        strcpy(rooted + 1, path);
+        free(path);
+        path = rooted;
+    }
+    free(client->path);
+    client->path = path;
+    return ESP_OK;
+}
+
+static void close_socket(esp_http_client_handle_t client) {
+    if (client->sock >= 0) {
+        close(client->sock);
+        client->sock = -1;
+        client->rx_pos = client->rx_len = 0;
+        dispatch(client, HTTP_EVENT_DISCONNECTED, NULL, 0, NULL, NULL);
+    }
+}
+
+static void apply_timeout(esp_http_client_handle_t client) {
+    if (client->sock >= 0) {
+        struct timeval tv = {.tv_sec = client->timeout_ms / 1000, .tv_usec = (client->timeout_ms % 1000) * 1000};
+        setsockopt(client->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(client->sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+}
+
+static esp_err_t connect_socket(esp_http_client_handle_t client) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addrs = NULL;
+    char port[8];
+
+    snprintf(port, sizeof(port), "%d", client->port);
+    if (getaddrinfo(client->host, port, &hints, &addrs) != 0) {
+        ESP_LOGE(TAG, "Cannot resolve %s", client->host);
+        return ESP_ERR_HTTP_CONNECT;
+    }
+
+    for (struct addrinfo *ai = addrs; ai; ai = ai->ai_next) {
+        int sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+        if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0) {
+            // Headers and body go out as separate writes; without this the
+            // body waits for a delayed ACK and every write gains ~40 ms
+            int one = 1;
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            client->sock = sock;
+            break;
+        }
+        close(sock);
+    }
+    freeaddrinfo(addrs);
+
+    if (client->sock < 0) {
+        ESP_LOGE(TAG, "Connection to %s:%d failed: %s", client->host, client->port, strerror(errno));
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    strcpy(client->connected_host, client->host);
+    client->connected_port = client->port;
+    apply_timeout(client);
+    count_bytes(0, 0, 1);
+    dispatch(client, HTTP_EVENT_ON_CONNECTED, NULL, 0, NULL, NULL);
+    return ESP_OK;
+}
+
+static int send_all(esp_http_client_handle_t client, const char *data, int len) {
+    int sent = 0;
+
+    while (sent < len) {
+        ssize_t n = send(client->sock, data + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent += (int)n;
+    }
+    count_bytes(sent, 0, 0);
+    return sent;
+}
+
+// Refill the receive buffer: bytes read, 0 when the peer closed, -1 on error or timeout
+static int fill(esp_http_client_handle_t client) {
+    ssize_t n;
+
+    do {
+        n = recv(client->sock, client->rx, sizeof(client->rx), 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        return -1;
+    }
+    client->rx_pos = 0;
+    client->rx_len = (int)n;
+    count_bytes(0, n, 0);
+    return (int)n;
+}
+
+static int read_raw(esp_http_client_handle_t client, char *buffer, int len) {
+    if (client->rx_pos == client->rx_len) {
+        int n = fill(client);
+        if (n <= 0) {
+            return n;
+        }
+    }
+    int available = client->rx_len - client->rx_pos;
+    if (len > available) {
+        len = available;
+    }
+    memcpy(buffer, client->rx + client->rx_pos, len);
+    client->rx_pos += len;
+    return len;
+}
+
+// One CRLF-terminated line without its terminator; -1 on error or overlong line
+static int read_line(esp_http_client_handle_t client, char *line, int size) {
+    int len = 0;
+
+    while (1) {
+        if (client->rx_pos == client->rx_len && fill(client) <= 0) {
+            return -1;
+        }
+        char c = client->rx[client->rx_pos++];
+        if (c == '\n') {
+            if (len > 0 && line[len - 1] == '\r') {
+                len--;
+            }
+            line[len] = '\0';
+            return len;
+        }
+        if (len >= size - 1) {
+            return -1;
+        }
+        line[len++] = c;
+    }
+}
+
+static void reset_response(esp_http_client_handle_t client) {
+    client->status_code = 0;
+    client->content_length = -1;
+    client->chunked = false;
+    client->close_after = false;
+    client->body_remaining = 0;
+    client->body_done = false;
+    free(client->location);
+    client->location = NULL;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config) {
+    esp_http_client_handle_t client = calloc(1, sizeof(struct esp_http_client));
+    if (client == NULL) {
+        return NULL;
+    }
+    client->sock = -1;
+    client->event_handler = config->event_handler;
+    client->user_data = config->user_data;
+    client->timeout_ms = config->timeout_ms > 0 ? config->timeout_ms : 5000;
+    client->disable_auto_redirect = config->disable_auto_redirect;
+    client->max_redirection_count = config->max_redirection_count > 0 ? config->max_redirection_count
+                                                                      : HOST_HTTP_MAX_REDIRECTS;
+    client->method = HTTP_METHOD_GET;
+
+    if (config->url == NULL || parse_url(client, config->url) != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid URL");
+        free(client->path);
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url) {
+    esp_err_t err = parse_url(client, url);
+
+    // A different server needs a new connection
+    if (err == ESP_OK && client->sock >= 0 &&
+        (strcmp(client->host, client->connected_host) != 0 || client->port != client->connected_port)) {
+        close_socket(client);
+    }
+    return err;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method) {
+    if (method >= HTTP_METHOD_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    client->method = method;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value) {
+    http_header_t *free_slot = NULL;
+
+    for (int i = 0; i < HOST_HTTP_MAX_HEADERS; i++) {
+        http_header_t *header = &client->headers[i];
+        if (header->key && strcasecmp(header->key, key) == 0) {
+            char *copy = strdup(value);
+            if (copy == NULL) {
+                return ESP_ERR_NO_MEM;
+            }
+            free(header->value);
+            header->value = copy;
+            return ESP_OK;
+        }
+        if (header->key == NULL && free_slot == NULL) {
+            free_slot = header;
+        }
+    }
+    if (free_slot == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    free_slot->key = strdup(key);
+    free_slot->value = strdup(value);
+    if (free_slot->key == NULL || free_slot->value == NULL) {
+        free(free_slot->key);
+        free(free_slot->value);
+        free_slot->key = free_slot->value = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key) {
+    for (int i = 0; i < HOST_HTTP_MAX_HEADERS; i++) {
+        http_header_t *header = &client->headers[i];
+        if (header->key && strcasecmp(header->key, key) == 0) {
+            free(header->key);
+            free(header->value);
+            header->key = header->value = NULL;
+        }
+    }
+    return ESP_OK;
+}
+
+// The data is not copied; it must outlive the request, as in ESP-IDF
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len) {
+    client->post_data = data;
+    client->post_len = data ? len : 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void *data) {
+    client->user_data = data;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_timeout_ms(esp_http_client_handle_t client, int timeout_ms) {
+    client->timeout_ms = timeout_ms;
+    apply_timeout(client);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client) {
+    if (client->location == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_http_client_set_url(client, client->location);
+}
+
+// Connect if needed and send the request line and headers
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len) {
+    if (client->https) {
+        ESP_LOGE(TAG, "HTTPS is not supported by the host client, point FIREBASE_HOST at http://");
+        return ESP_ERR_HTTP_INVALID_TRANSPORT;
+    }
+    reset_response(client);
+
+    if (client->sock < 0) {
+        esp_err_t err = connect_socket(client);
+        if (err != ESP_OK) {
+            dispatch(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+            return err;
+        }
+    }
+
+    char *request = NULL;
+    size_t request_len = 0;
+    FILE *out = open_memstream(&request, &request_len);
+    if (out == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    fprintf(out, "%s %s HTTP/1.1\r\nHost: %s:%d\r\nUser-Agent: ESP32 HTTP Client/1.0\r\n",
+            method_names[client->method], client->path, client->host, client->port);
+    for (int i = 0; i < HOST_HTTP_MAX_HEADERS; i++) {
+        if (client->headers[i].key) {
+            fprintf(out, "%s: %s\r\n", client->headers[i].key, client->headers[i].value);
+        }
+    }
+    if (write_len > 0 || client->method == HTTP_METHOD_POST || client->method == HTTP_METHOD_PUT ||
+        client->method == HTTP_METHOD_PATCH) {
+        fprintf(out, "Content-Length: %d\r\n", write_len);
+    }
+    fputs("\r\n", out);
+    fclose(out);
+
+    int sent = send_all(client, request, (int)request_len);
+    free(request);
+    if (sent < 0) {
+        ESP_LOGE(TAG, "Failed to send request: %s", strerror(errno));
+        close_socket(client);
+        dispatch(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+        return ESP_ERR_HTTP_WRITE_DATA;
+    }
+    dispatch(client, HTTP_EVENT_HEADER_SENT, NULL, 0, NULL, NULL);
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t client, const char *buffer, int len) {
+    if (client->sock < 0) {
+        return -1;
+    }
+    return send_all(client, buffer, len);
+}
+
+static char *trim(char *s) {
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    char *end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t')) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+// Read the status line and headers; returns the content length, 0 for
+// chunked or close-delimited bodies, or ESP_FAIL
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client) {
+    char line[HOST_HTTP_LINE_SIZE];
+    int minor_version = 1;
+
+    if (client->sock < 0 || read_line(client, line, sizeof(line)) < 0 ||
+        sscanf(line, "HTTP/1.%d %d", &minor_version, &client->status_code) != 2) {
+        ESP_LOGE(TAG, "Failed to read response status");
+        close_socket(client);
+        return ESP_FAIL;
+    }
+    client->close_after = (minor_version == 0);
+
+    while (1) {
+        int len = read_line(client, line, sizeof(line));
+        if (len < 0) {
+            close_socket(client);
+            return ESP_FAIL;
+        }
+        if (len == 0) {
+            break;
+        }
+        char *colon = strchr(line, ':');
+        if (colon == NULL) {
+            continue;
+        }
+        *colon = '\0';
+        char *key = trim(line);
+        char *value = trim(colon + 1);
+
+        if (strcasecmp(key, "Content-Length") == 0) {
+            client->content_length = strtoll(value, NULL, 10);
+        } else if (strcasecmp(key, "Transfer-Encoding") == 0 && strcasecmp(value, "chunked") == 0) {
+            client->chunked = true;
+        } else if (strcasecmp(key, "Connection") == 0) {
+            client->close_after = (strcasecmp(value, "close") == 0);
+        } else if (strcasecmp(key, "Location") == 0) {
+            free(client->location);
+            client->location = strdup(value);
+        }
+        dispatch(client, HTTP_EVENT_ON_HEADER, NULL, 0, key, value);
+    }
+
+    bool no_body = client->method == HTTP_METHOD_HEAD || client->status_code == 204 ||
+                   client->status_code == 304 || (client->status_code >= 100 && client->status_code < 200);
+    if (client->chunked) {
+        client->content_length = -1;
+    } else if (no_body) {
+        client->content_length = 0;
+    }
+    client->body_remaining = client->chunked ? 0 : client->content_length;
+    client->body_done = no_body || client->content_length == 0;
+
+    return client->content_length > 0 ? client->content_length : 0;
+}
+
+// Next piece of the decoded body; 0 at its end, -1 on error or timeout
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len) {
+    char line[64];
+    int n;
+
+    if (client->body_done || len <= 0) {
+        return 0;
+    }
+    if (client->sock < 0) {
+        return -1;
+    }
+
+    if (client->chunked) {
+        if (client->body_remaining == 0) {
+            if (read_line(client, line, sizeof(line)) < 0) {
+                return -1;
+            }
+            client->body_remaining = strtoll(line, NULL, 16);
+            if (client->body_remaining == 0) {
+                // Skip trailers up to the blank line ending the body
+                int trailer;
+                while ((trailer = read_line(client, line, sizeof(line))) > 0) {
+                }
+                client->body_done = true;
+                return trailer < 0 ? -1 : 0;
+            }
+        }
+        n = read_raw(client, buffer, len < client->body_remaining ? len : (int)client->body_remaining);
+        if (n > 0) {
+            client->body_remaining -= n;
+            if (client->body_remaining == 0 && read_line(client, line, sizeof(line)) != 0) {
+                return -1;
+            }
+        }
+    } else if (client->content_length >= 0) {
+        n = read_raw(client, buffer, len < client->body_remaining ? len : (int)client->body_remaining);
+        if (n > 0) {
+            client->body_remaining -= n;
+            client->body_done = (client->body_remaining == 0);
+        }
+    } else {
+        // Delimited by the server closing the connection
+        n = read_raw(client, buffer, len);
+        if (n == 0) {
+            client->body_done = true;
+            client->close_after = true;
+            return 0;
+        }
+    }
+
+    if (n <= 0) {
+        return -1;
+    }
+    dispatch(client, HTTP_EVENT_ON_DATA, buffer, n, NULL, NULL);
+    return n;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client) {
+    return client->status_code;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client) {
+    return client->content_length;
+}
+
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client) {
+    return client->chunked;
+}
+
+// Whole request: send, follow redirects, deliver the body as ON_DATA events
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client) {
+    char buffer[HOST_HTTP_RX_BUFFER_SIZE];
+
+    for (int redirects = 0; ; redirects++) {
+        esp_err_t err = esp_http_client_open(client, client->post_len);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (client->post_len > 0 && esp_http_client_write(client, client->post_data, client->post_len) < 0) {
+            close_socket(client);
+            dispatch(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+            return ESP_ERR_HTTP_WRITE_DATA;
+        }
+        if (esp_http_client_fetch_headers(client) < 0) {
+            dispatch(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+            return ESP_ERR_HTTP_FETCH_HEADER;
+        }
+
+        int status = client->status_code;
+        bool redirect = (status == 301 || status == 302 || status == 303 || status == 307 || status == 308) &&
+                        client->location != NULL && !client->disable_auto_redirect;
+
+        int n;
+        while ((n = esp_http_client_read(client, buffer, sizeof(buffer))) > 0) {
+        }
+        if (n < 0) {
+            close_socket(client);
+            dispatch(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+            return ESP_FAIL;
+        }
+
+        if (!redirect) {
+            dispatch(client, HTTP_EVENT_ON_FINISH, NULL, 0, NULL, NULL);
+            break;
+        }
+        if (redirects >= client->max_redirection_count) {
+            ESP_LOGE(TAG, "Too many redirects");
+            return ESP_ERR_HTTP_MAX_REDIRECT;
+        }
+        if (client->close_after) {
+            close_socket(client);
+        }
+        esp_http_client_set_redirection(client);
+        dispatch(client, HTTP_EVENT_REDIRECT, NULL, 0, NULL, NULL);
+    }
+
+    if (client->close_after) {
+        close_socket(client);
+    }
+    return ESP_OK;
+}
+
+// Drop the connection; the next request opens a new one
+esp_err_t esp_http_client_close(esp_http_client_handle_t client) {
+    close_socket(client);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+    if (client == NULL) {
+        return ESP_FAIL;
+    }
+    close_socket(client);
+    for (int i = 0; i < HOST_HTTP_MAX_HEADERS; i++) {
+        free(client->headers[i].key);
+        free(client->headers[i].value);
+    }
+    free(client->location);
+    free(client->path);
+    free(client);
+    return ESP_OK;
+}
@@ -0,0 +1,306 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// FreeRTOS primitives on pthreads. Every blocking call converts its tick
+// timeout to an absolute CLOCK_MONOTONIC deadline
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t function;
+    void *parameters;
+    pthread_mutex_t lock;
+    pthread_cond_t notified;
+    uint32_t notify_count;
+};
+
+struct host_semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+    uint32_t count;
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+static __thread struct host_task *current_task = NULL;
+
+static void cond_init_monotonic(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static struct timespec deadline_after(TickType_t ticks) {
+    struct timespec ts;
+    uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+// Wait on cond until woken or the deadline passes; portMAX_DELAY waits forever
+static bool cond_wait_ticks(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks,
+                            const struct timespec *deadline) {
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+static struct host_task *task_alloc(void) {
+    struct host_task *task = calloc(1, sizeof(struct host_task));
+    if (task) {
+        pthread_mutex_init(&task->lock, NULL);
+        cond_init_monotonic(&task->notified);
+    }
+    return task;
+}
+
+static void *task_entry(void *arg) {
+    struct host_task *task = arg;
+
+    current_task = task;
+    task->function(task->parameters);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task) {
+    struct host_task *task = task_alloc();
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->function = function;
+    task->parameters = parameters;
+
+    if (pthread_create(&task->thread, NULL, task_entry, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    if (created_task) {
+        *created_task = task;
+    }
+    return pdPASS;
+}
+
+// Only self-deletion is supported, as in the firmware tasks
+void vTaskDelete(TaskHandle_t task) {
+    if (task == NULL || task == current_task) {
+        pthread_exit(NULL);
+    }
+}
+
+void vTaskDelay(TickType_t ticks) {
+    uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+    struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L};
+
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+TickType_t xTaskGetTickCount(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / portTICK_PERIOD_MS);
+}
+
+// The main thread gets its task record on first use
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    if (current_task == NULL) {
+        current_task = task_alloc();
+        current_task->thread = pthread_self();
+    }
+    return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    pthread_mutex_lock(&task->lock);
+    task->notify_count++;
+    pthread_cond_signal(&task->notified);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+    struct host_task *task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    uint32_t value;
+
+    pthread_mutex_lock(&task->lock);
+    while (task->notify_count == 0 && ticks_to_wait > 0) {
+        if (!cond_wait_ticks(&task->notified, &task->lock, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+    value = task->notify_count;
+    if (value > 0) {
+        task->notify_count = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+static SemaphoreHandle_t semaphore_create(uint32_t count) {
+    struct host_semaphore *semaphore = calloc(1, sizeof(struct host_semaphore));
+    if (semaphore) {
+        pthread_mutex_init(&semaphore->lock, NULL);
+        cond_init_monotonic(&semaphore->available);
+        semaphore->count = count;
+    }
+    return semaphore;
+}
+
+// Mutexes are plain binary semaphores here: no priority inheritance or
+// recursion, neither of which the Firebase modules use
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return semaphore_create(1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return semaphore_create(0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    BaseType_t taken = pdFALSE;
+
+    pthread_mutex_lock(&semaphore->lock);
+    while (semaphore->count == 0 && ticks_to_wait > 0) {
+        if (!cond_wait_ticks(&semaphore->available, &semaphore->lock, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+    if (semaphore->count > 0) {
+        semaphore->count--;
+        taken = pdTRUE;
+    }
+    pthread_mutex_unlock(&semaphore->lock);
+    return taken;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    BaseType_t given = pdFALSE;
+
+    pthread_mutex_lock(&semaphore->lock);
+    if (semaphore->count == 0) {
+        semaphore->count = 1;
+        pthread_cond_signal(&semaphore->available);
+        given = pdTRUE;
+    }
+    pthread_mutex_unlock(&semaphore->lock);
+    return given;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    if (semaphore) {
+        pthread_mutex_destroy(&semaphore->lock);
+        pthread_cond_destroy(&semaphore->available);
+        free(semaphore);
+    }
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct host_queue *queue = calloc(1, sizeof(struct host_queue));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->items = calloc(length, item_size);
+    if (queue->items == NULL) {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    cond_init_monotonic(&queue->not_empty);
+    cond_init_monotonic(&queue->not_full);
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    BaseType_t sent = pdFALSE;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length && ticks_to_wait > 0) {
+        if (!cond_wait_ticks(&queue->not_full, &queue->lock, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+    if (queue->count < queue->length) {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+        queue->count++;
+        pthread_cond_signal(&queue->not_empty);
+        sent = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return sent;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait) {
+    struct timespec deadline = deadline_after(ticks_to_wait);
+    BaseType_t received = pdFALSE;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && ticks_to_wait > 0) {
+        if (!cond_wait_ticks(&queue->not_empty, &queue->lock, ticks_to_wait, &deadline)) {
+            break;
+        }
+    }
+    if (queue->count > 0) {
+        memcpy(buffer, queue->items + queue->head * queue->item_size, queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+        received = pdTRUE;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return received;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    UBaseType_t count;
+
+    pthread_mutex_lock(&queue->lock);
+    count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    if (queue) {
+        pthread_mutex_destroy(&queue->lock);
+        pthread_cond_destroy(&queue->not_empty);
+        pthread_cond_destroy(&queue->not_full);
+        free(queue->items);
+        free(queue);
+    }
+}
@@ -0,0 +1,388 @@
+#include "firebase.h"
+#include "firebase_async.h"
+#include "card_stream.h"
+#include "journey_outbox.h"
+#include "journey_record.h"
+#include "journey_json.h"
+#include "esp_http_client.h"
+#include "esp_heap_caps.h"
+#include "json_arena.h"
+#include "stations.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Host tap benchmark: boots the Firebase modules against the local RTDB
+// stand-in and replays gate taps, alternating entry and exit per card.
+// load_gen.py runs one of these per simulated gate
+
+#define BENCH_MAX_CARDS 32
+#define BENCH_STATION 2             // Default gate the taps are made at
+#define BENCH_DESTINATION 5         // Destination chosen at entry
+#define BENCH_DRAIN_TIMEOUT_MS 30000
+
+typedef enum {
+    PHASE_VERIFY,
+    PHASE_CHECK,
+    PHASE_RECORD,
+    PHASE_TOTAL,
+    PHASE_COUNT
+} bench_phase_t;
+
+static const char *const phase_names[PHASE_COUNT] = {"verify", "check", "start/end", "tap"};
+
+typedef struct {
+    uint8_t uid[10];
+    uint8_t size;
+} bench_card_t;
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static bool parse_uid(const char *hex, bench_card_t *card) {
+    card->size = 0;
+    for (const char *p = hex; p[0] && p[1] && card->size < sizeof(card->uid); p += 2) {
+        unsigned int byte;
+        if (sscanf(p, "%2x", &byte) != 1) {
+            return false;
+        }
+        card->uid[card->size++] = (uint8_t)byte;
+    }
+    return card->size > 0;
+}
+
+static void print_latency(const char *name, uint32_t *samples, size_t count) {
+    if (count == 0) {
+        printf("  %-10s      no samples\n", name);
+        return;
+    }
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    qsort(samples, count, sizeof(uint32_t), compare_u32);
+    printf("  %-10s mean %7.2f  p50 %7.2f  p95 %7.2f  p99 %7.2f  max %7.2f ms\n", name,
+           sum / 1000.0 / count, samples[count / 2] / 1000.0, samples[count * 95 / 100] / 1000.0,
+           samples[count * 99 / 100] / 1000.0, samples[count - 1] / 1000.0);
+}
+
+// Percentiles read back from the firmware's bucketed request histograms
+static void print_request_phases(firebase_latency_op_t op) {
+    firebase_latency_stats_t stats;
+    firebase_get_latency_stats(op, &stats);
+    if (stats.phases[FIREBASE_PHASE_TOTAL].count == 0) {
+        return;
+    }
+    printf("  %-7s %5lu", firebase_latency_op_name(op), (unsigned long)stats.phases[FIREBASE_PHASE_TOTAL].count);
+    for (int p = 0; p < FIREBASE_PHASE_COUNT; p++) {
+        const firebase_latency_histogram_t *h = &stats.phases[p];
+        if (h->count == 0) {
+            printf("  %-7s %-12s", firebase_phase_name(p), "    -");
+        } else {
+            printf("  %-7s %5.2f/%-6.2f", firebase_phase_name(p), firebase_latency_percentile_us(h, 50) / 1000.0,
+                   firebase_latency_percentile_us(h, 95) / 1000.0);
+        }
+    }
+    printf("\n");
+}
+
+// Card i of the set rtdb_server.py --cards synthesizes (08000000, 08000001, ...)
+static void synthetic_card(uint32_t index, bench_card_t *card) {
+    card->uid[0] = 0x08;
+    card->uid[1] = (uint8_t)(index >> 16);
+    card->uid[2] = (uint8_t)(index >> 8);
+    card->uid[3] = (uint8_t)index;
+    card->size = 4;
+}
+
+static uint32_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (uint32_t)(*state >> 32);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-n taps] [-c uid-hex]... [-C cards] [-g station] [-s seed] [-w wait-ms] [-j] [-v]\n"
+                    "  -n  taps to replay (default 100)\n"
+                    "  -c  card UID to tap, repeatable (default: the cards in seed.json)\n"
+                    "  -C  tap random cards out of the first N rtdb_server.py --cards cards\n"
+                    "  -g  station of this gate (default %d); entries pick a random destination\n"
+                    "  -s  seed for the card and destination choice (default 1)\n"
+                    "  -w  pause between taps (default 0)\n"
+                    "  -j  print a JSON summary with every tap's latency instead of the report\n"
+                    "  -v  firmware logs at INFO instead of WARN\n", argv0, BENCH_STATION);
+}
+
+// One line for load_gen.py: counters plus the raw per-tap latencies, so tails
+// can be computed across gates
+static void print_json_summary(int station, int taps, int entries, int exits, int rejected, int failed,
+                               int64_t boot_us, int64_t ready_us, int64_t run_us, const uint32_t *tap_us, size_t tap_count,
+                               const host_http_stats_t *wire_before, const host_http_stats_t *wire,
+                               const firebase_session_stats_t *session_before, const firebase_session_stats_t *session,
+                               const outbox_stats_t *outbox) {
+    printf("{\"station\":%d,\"taps\":%d,\"entries\":%d,\"exits\":%d,\"rejected\":%d,\"failed\":%d,"
+           "\"boot_us\":%lld,\"ready_us\":%lld,\"run_us\":%lld,\"tap_requests\":%lu,\"handshakes\":%lu,"
+           "\"tap_bytes_sent\":%llu,\"tap_bytes_received\":%llu,\"boot_bytes_received\":%llu,"
+           "\"outbox_pending\":%lu,\"outbox_failures\":%lu,\"tap_us\":[",
+           station, taps, entries, exits, rejected, failed, (long long)boot_us, (long long)ready_us,
+           (long long)run_us,
+           (unsigned long)(session->requests - session_before->requests), (unsigned long)session->handshakes,
+           (unsigned long long)(wire->bytes_sent - wire_before->bytes_sent),
+           (unsigned long long)(wire->bytes_received - wire_before->bytes_received),
+           (unsigned long long)wire_before->bytes_received,
+           (unsigned long)outbox->pending, (unsigned long)outbox->failures);
+    for (size_t i = 0; i < tap_count; i++) {
+        printf(i ? ",%lu" : "%lu", (unsigned long)tap_us[i]);
+    }
+    printf("]}\n");
+}
+
+int main(int argc, char **argv) {
+    static const char *const default_cards[] = {"04A1B2C3", "04D4E5F6", "04112233445566"};
+    bench_card_t cards[BENCH_MAX_CARDS];
+    size_t card_count = 0;
+    int taps = 100;
+    int wait_ms = 0;
+    uint32_t synthetic_cards = 0;
+    int station = BENCH_STATION;
+    uint64_t random_state = 1;
+    bool json = false;
+    esp_log_level_t level = ESP_LOG_WARN;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:C:g:s:w:jv")) != -1) {
+        switch (opt) {
+            case 'n':
+                taps = atoi(optarg);
+                break;
+            case 'c':
+                if (card_count < BENCH_MAX_CARDS && parse_uid(optarg, &cards[card_count])) {
+                    card_count++;
+                } else {
+                    fprintf(stderr, "Bad or too many card UIDs: %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'C':
+                synthetic_cards = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'g':
+                station = atoi(optarg);
+                break;
+            case 's':
+                random_state = strtoull(optarg, NULL, 0) * 2 + 1;
+                break;
+            case 'w':
+                wait_ms = atoi(optarg);
+                break;
+            case 'j':
+                json = true;
+                break;
+            case 'v':
+                level = ESP_LOG_INFO;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (station < 1 || station > get_number_of_destinations()) {
+        fprintf(stderr, "Station must be 1-%d\n", get_number_of_destinations());
+        return 2;
+    }
+    if (card_count == 0 && synthetic_cards == 0) {
+        for (size_t i = 0; i < sizeof(default_cards) / sizeof(default_cards[0]); i++) {
+            parse_uid(default_cards[i], &cards[card_count++]);
+        }
+    }
+    esp_log_level_set("*", level);
+
+    int64_t boot_start = esp_timer_get_time();
+    firebase_init();
+    int64_t boot_us = esp_timer_get_time() - boot_start;
+
+    // Let the card stream deliver its snapshot so taps see the steady state;
+    // the snapshot is done once nothing more has arrived for 100 ms
+    for (int i = 0; i < 200 && !card_stream_is_connected(); i++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    host_http_stats_t settle;
+    uint64_t last_received = 0;
+    for (int quiet = 0, i = 0; quiet < 10 && i < 1000; i++) {
+        host_http_get_stats(&settle);
+        quiet = (settle.bytes_received == last_received) ? quiet + 1 : 0;
+        last_received = settle.bytes_received;
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    int64_t ready_us = esp_timer_get_time() - boot_start;
+
+    uint32_t *samples[PHASE_COUNT];
+    size_t sample_count[PHASE_COUNT] = {0};
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        samples[p] = calloc(taps > 0 ? taps : 1, sizeof(uint32_t));
+    }
+    int rejected = 0;
+    int failed = 0;
+    int entries = 0;
+    int exits = 0;
+
+    host_http_stats_t wire_before;
+    host_http_get_stats(&wire_before);
+    host_heap_stats_t heap_before;
+    host_heap_get_stats(&heap_before);
+    firebase_session_stats_t session_before;
+    firebase_get_session_stats(&session_before, NULL);
+    int64_t run_start = esp_timer_get_time();
+
+    for (int i = 0; i < taps; i++) {
+        bench_card_t synthetic;
+        const bench_card_t *card = &cards[i % (card_count ? card_count : 1)];
+        if (synthetic_cards > 0) {
+            synthetic_card(next_random(&random_state) % synthetic_cards, &synthetic);
+            card = &synthetic;
+        }
+        user_t user;
+        journey_session_t journey;
+
+        firebase_tap_begin();
+        int64_t t0 = esp_timer_get_time();
+        bool valid = firebase_verify_rfid(card->uid, card->size, &user);
+        int64_t t1 = esp_timer_get_time();
+        samples[PHASE_VERIFY][sample_count[PHASE_VERIFY]++] = (uint32_t)(t1 - t0);
+
+        if (!valid) {
+            rejected++;
+        } else {
+            memset(&journey, 0, sizeof(journey));
+            esp_err_t check = firebase_check_active_journey(card->uid, card->size, &journey);
+            int64_t t2 = esp_timer_get_time();
+            samples[PHASE_CHECK][sample_count[PHASE_CHECK]++] = (uint32_t)(t2 - t1);
+
+            bool ok;
+            if (check != ESP_OK && check != ESP_ERR_NOT_FOUND) {
+                // As the gate does: no journey is started on an unknown answer
+                ok = false;
+            } else if (check == ESP_OK) {
+                // As the gate does: the fare is priced once, before the journey is ended
+                journey.actual_destination = station;
+                journey.fare = get_journey_fare(journey.origin_station, journey.selected_destination,
+                                                journey.actual_destination, journey.selected_class);
+                ok = firebase_end_journey(&journey);
+                exits++;
+            } else {
+                memcpy(journey.rfid_uid, card->uid, card->size);
+                journey.uid_size = card->size;
+                journey.origin_station = station;
+                journey.selected_destination = BENCH_DESTINATION;
+                if (synthetic_cards > 0 || journey.selected_destination == station) {
+                    do {
+                        journey.selected_destination = 1 + next_random(&random_state) % get_number_of_destinations();
+                    } while (journey.selected_destination == station);
+                }
+                journey.selected_class = 2;
+                ok = firebase_start_journey(&journey);
+                entries++;
+            }
+            int64_t t3 = esp_timer_get_time();
+            samples[PHASE_RECORD][sample_count[PHASE_RECORD]++] = (uint32_t)(t3 - t2);
+            failed += !ok;
+        }
+        samples[PHASE_TOTAL][sample_count[PHASE_TOTAL]++] = (uint32_t)(esp_timer_get_time() - t0);
+        firebase_tap_end();
+
+        if (wait_ms > 0) {
+            vTaskDelay(pdMS_TO_TICKS(wait_ms));
+        }
+    }
+    int64_t run_us = esp_timer_get_time() - run_start;
+    host_heap_stats_t heap_after;
+    host_heap_get_stats(&heap_after);
+
+    // Time until the outbox has uploaded everything the taps logged
+    outbox_stats_t outbox;
+    int64_t drain_start = esp_timer_get_time();
+    do {
+        journey_outbox_get_stats(&outbox);
+        if (outbox.pending == 0) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    } while (esp_timer_get_time() - drain_start < (int64_t)BENCH_DRAIN_TIMEOUT_MS * 1000);
+    int64_t drain_us = esp_timer_get_time() - drain_start;
+
+    host_http_stats_t wire;
+    host_http_get_stats(&wire);
+    firebase_session_stats_t session, last_tap;
+    firebase_get_session_stats(&session, &last_tap);
+    card_sync_stats_t sync;
+    firebase_get_card_sync_stats(&sync);
+    firebase_heap_stats_t heap;
+    firebase_get_heap_stats(&heap);
+    json_arena_stats_t arena;
+    json_arena_get_stats(&arena);
+
+    if (json) {
+        print_json_summary(station, taps, entries, exits, rejected, failed, boot_us, ready_us, run_us,
+                           samples[PHASE_TOTAL], sample_count[PHASE_TOTAL], &wire_before, &wire, &session_before, &session,
+                           &outbox);
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            free(samples[p]);
+        }
+        return failed ? 1 : 0;
+    }
+
+    printf("Boot: %.1f ms (outbox recovery, card sync), %.1f ms until the card stream settled\n",
+           boot_us / 1000.0, ready_us / 1000.0);
+    printf("Taps: %d in %.1f ms, %d entries, %d exits, %d rejected, %d failed\n",
+           taps, run_us / 1000.0, entries, exits, rejected, failed);
+    printf("Latency:\n");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        print_latency(phase_names[p], samples[p], sample_count[p]);
+    }
+    printf("Request phases, p50/p95 ms by histogram bucket:\n");
+    for (int op = 0; op < FIREBASE_LATENCY_OP_COUNT; op++) {
+        print_request_phases(op);
+    }
+    printf("Requests: %lu (%.2f per tap), %lu connections opened, %lu reused, %lu reconnects\n",
+           (unsigned long)session.requests, taps ? (double)session.requests / taps : 0.0,
+           (unsigned long)session.handshakes, (unsigned long)session.reused, (unsigned long)session.reconnects);
+    printf("Wire during taps: %llu bytes sent, %llu received (%.0f per tap)\n",
+           (unsigned long long)(wire.bytes_sent - wire_before.bytes_sent),
+           (unsigned long long)(wire.bytes_received - wire_before.bytes_received),
+           taps ? (double)(wire.bytes_sent - wire_before.bytes_sent +
+                           wire.bytes_received - wire_before.bytes_received) / taps : 0.0);
+    printf("Outbox: %lu appended, %lu uploaded in %lu batches, %lu failures, %lu pending after %.1f ms\n",
+           (unsigned long)outbox.appended, (unsigned long)outbox.uploaded, (unsigned long)outbox.batches,
+           (unsigned long)outbox.failures, (unsigned long)outbox.pending, drain_us / 1000.0);
+    printf("Outbox record: %d bytes packed in %d byte slots (JSON up to %d bytes)\n",
+           JOURNEY_RECORD_SIZE, OUTBOX_SLOT_SIZE, JOURNEY_JSON_MAX_LEN);
+    // Includes the outbox uploader and card stream running alongside the taps
+    uint64_t allocations = heap_after.allocations - heap_before.allocations;
+    printf("Heap during taps: %llu allocations (%.2f per tap), %llu frees, net %+lld bytes\n",
+           (unsigned long long)allocations, taps ? (double)allocations / taps : 0.0,
+           (unsigned long long)(heap_after.frees - heap_before.frees),
+           (long long)(heap_after.live_bytes - heap_before.live_bytes));
+    printf("Heap after last tap: %lu free (%+ld over the tap), %lu lowest, largest block %lu\n",
+           (unsigned long)heap.free_bytes, (long)heap.tap_delta, (unsigned long)heap.minimum_free_bytes,
+           (unsigned long)heap.largest_free_block);
+    printf("JSON arena: %lu parses, peak %lu of %d bytes, %lu heap fallbacks\n",
+           (unsigned long)arena.parses, (unsigned long)arena.peak_bytes, JSON_ARENA_SIZE,
+           (unsigned long)arena.heap_fallbacks);
+    printf("Card sync: %lu reloads, %lu not modified, %lu deltas, %lu failed; stream %s\n",
+           (unsigned long)sync.reloaded, (unsigned long)sync.not_modified, (unsigned long)sync.deltas,
+           (unsigned long)sync.failed, card_stream_is_connected() ? "connected" : "down");
+
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        free(samples[p]);
+    }
+    return failed ? 1 : 0;
+}
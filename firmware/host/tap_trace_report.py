@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+"""Per-state latency breakdown of gate taps from tap trace console dumps.
+
+The firmware (main/tap_trace.c) prints its tap trace to the console as
+Chrome trace JSON between TAP_TRACE_BEGIN and TAP_TRACE_END lines. Capture
+the console and feed it here:
+
+  idf.py monitor | tee gate.log
+  python3 tap_trace_report.py gate.log [more.log ...] [--chrome taps.json]
+
+A tap runs from the card being detected until the gate is back at WELCOME;
+card reads that never got that far are counted but not broken down.
+For every tap the time in each state and the time the state machine spent
+waiting (network, fixed UI pauses, buzzer patterns, RFID, keypad input,
+loop pacing) is summed, then reported over all taps as mean / p50 / p95 /
+max. Waits nested in other waits (a beep during keypad input) count for the
+innermost one only; "other" is the rest of the tap, LCD writes and CPU.
+--chrome writes every event into one file for chrome://tracing or Perfetto.
+"""
+
+import argparse
+import json
+import sys
+from collections import defaultdict
+
+DUMP_BEGIN = "TAP_TRACE_BEGIN"
+DUMP_END = "TAP_TRACE_END"
+TAP_START_MARK = "card"
+TAP_END_MARK = "tap done"
+TAP_END_STATE = "WELCOME"
+STATE_TRACK = 1
+WAIT_CATEGORIES = ["network", "ui", "buzzer", "rfid", "input", "poll"]
+
+
+def read_dumps(stream, source):
+    """Yield the trace documents in a console capture.
+
+    Log lines from other tasks can land between the lines of a dump; only
+    lines that belong to the JSON document are kept.
+    """
+    lines = None
+    for number, line in enumerate(stream, 1):
+        line = line.strip()
+        if line.endswith(DUMP_BEGIN):
+            lines = []
+        elif line.endswith(DUMP_END) and lines is not None:
+            try:
+                yield json.loads("".join(lines))
+            except ValueError as error:
+                print(f"{source}:{number}: skipping damaged dump ({error})", file=sys.stderr)
+            lines = None
+        elif lines is not None and line[:1] in ("{", "]"):
+            lines.append(line)
+
+
+def percentile(values, percent):
+    ordered = sorted(values)
+    rank = max(1, -(-len(ordered) * percent // 100))
+    return ordered[rank - 1]
+
+
+def self_times(waits, start, end):
+    """Exclusive time per wait inside [start, end), nested waits subtracted."""
+    clipped = []
+    for event in waits:
+        begin = max(event["ts"], start)
+        finish = min(event["ts"] + event["dur"], end)
+        if finish > begin:
+            clipped.append((begin, finish, event))
+    clipped.sort(key=lambda item: (item[0], -item[1]))
+
+    result = []
+    stack = []  # [finish, event, self time] of the enclosing waits
+    for begin, finish, event in clipped:
+        while stack and stack[-1][0] <= begin:
+            result.append(tuple(stack.pop()[1:]))
+        if stack:
+            stack[-1][2] -= min(finish, stack[-1][0]) - begin
+        stack.append([finish, event, finish - begin])
+    result.extend(tuple(entry[1:]) for entry in stack)
+    return result
+
+
+def split_taps(events):
+    """Per-tap totals in microseconds, keyed by state, wait category and wait name."""
+    events.sort(key=lambda event: event["ts"])
+    states = [e for e in events if e.get("ph") == "X" and e.get("tid") == STATE_TRACK]
+    waits = [e for e in events if e.get("ph") == "X" and e.get("tid") != STATE_TRACK]
+    marks = [e for e in events if e.get("ph") == "i" and e.get("name") == TAP_START_MARK]
+    # Back at WELCOME; its state span is only recorded once the next card is awaited
+    ends = sorted([e["ts"] for e in events if e.get("ph") == "i" and e.get("name") == TAP_END_MARK] +
+                  [s["ts"] for s in states if s["name"] == TAP_END_STATE])
+
+    taps = []
+    for number, mark in enumerate(marks):
+        start = mark["ts"]
+        next_card = marks[number + 1]["ts"] if number + 1 < len(marks) else None
+        end = next((ts for ts in ends if ts >= start), None)
+        if end is None or (next_card is not None and end > next_card):
+            continue
+        tap = {"total": end - start, "state": defaultdict(int), "category": defaultdict(int),
+               "wait": defaultdict(int)}
+        for state in states:
+            overlap = min(state["ts"] + state["dur"], end) - max(state["ts"], start)
+            if overlap > 0:
+                tap["state"][state["name"]] += overlap
+        for event, elapsed in self_times(waits, start, end):
+            tap["category"][event["cat"]] += elapsed
+            tap["wait"][(event["cat"], event["name"])] += elapsed
+        tap["category"]["other"] = tap["total"] - sum(tap["category"].values())
+        taps.append(tap)
+    return taps, len(marks)
+
+
+def print_row(label, values, grand_total):
+    ms = [value / 1000.0 for value in values]
+    print(f"  {label:<34} {len(ms):>5} {sum(ms) / len(ms):9.1f} {percentile(ms, 50):9.1f} "
+          f"{percentile(ms, 95):9.1f} {max(ms):9.1f} {100.0 * sum(values) / grand_total:6.1f}%")
+
+
+def print_header(title):
+    print(f"\n{title}")
+    print(f"  {'':<34} {'taps':>5} {'mean ms':>9} {'p50':>9} {'p95':>9} {'max':>9} {'share':>7}")
+
+
+def print_table(title, taps, key, labels, grand_total):
+    print_header(title)
+    for label in labels:
+        values = [tap[key][label] for tap in taps if label in tap[key]]
+        if values:
+            name = label if isinstance(label, str) else f"{label[0]}: {label[1]}"
+            print_row(name, values, grand_total)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("logs", nargs="*", help="console captures (default: stdin)")
+    parser.add_argument("--chrome", metavar="FILE", help="write all events as one Chrome trace")
+    parser.add_argument("--top", type=int, default=15, help="individual waits to list (default 15)")
+    args = parser.parse_args()
+
+    events = []
+    seen = set()
+    metadata = []
+    dumps = 0
+    lost = {}  # Ring overflow count per capture; each dump carries the count since boot
+    sources = [(open(path, errors="replace"), path) for path in args.logs] or [(sys.stdin, "stdin")]
+    for stream, source in sources:
+        with stream:
+            for document in read_dumps(stream, source):
+                dumps += 1
+                lost[source] = max(lost.get(source, 0), document.get("otherData", {}).get("lost", 0))
+                for event in document.get("traceEvents", []):
+                    if event.get("ph") == "M":
+                        if event not in metadata:
+                            metadata.append(event)
+                        continue
+                    key = (event.get("ts"), event.get("name"), event.get("cat"), event.get("tid"))
+                    if key not in seen:
+                        seen.add(key)
+                        events.append(event)
+
+    if args.chrome:
+        with open(args.chrome, "w") as out:
+            json.dump({"traceEvents": events + metadata, "displayTimeUnit": "ms"}, out)
+
+    taps, cards = split_taps(events)
+    print(f"{dumps} dumps, {len(events)} events, {cards} cards detected, {len(taps)} complete taps"
+          + (f", {sum(lost.values())} events lost to ring overflow" if any(lost.values()) else ""))
+    if not taps:
+        return 1
+
+    grand_total = sum(tap["total"] for tap in taps)
+    print_header("Tap")
+    print_row("card to WELCOME", [tap["total"] for tap in taps], grand_total)
+
+    state_order = []
+    for tap in taps:
+        state_order.extend(name for name in tap["state"] if name not in state_order)
+    print_table("Time in state", taps, "state", state_order, grand_total)
+
+    print_table("Time waiting, by cause", taps, "category", WAIT_CATEGORIES + ["other"], grand_total)
+
+    totals = defaultdict(int)
+    for tap in taps:
+        for wait, elapsed in tap["wait"].items():
+            totals[wait] += elapsed
+    longest = sorted(totals, key=totals.get, reverse=True)[:args.top]
+    print_table("Longest waits", taps, "wait", longest, grand_total)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,4 +1,5 @@
 #include "buzzer.h"
+#include "tap_trace.h"
 #include "esp_log.h"
 #include "driver/spi_master.h"
 #include "driver/gpio.h"
@@ -13,14 +14,14 @@ void buzzer_init(void)
 
 void buzzer_short_beep(void)
 {
-    gpio_set_level(BUZZER_PIN, 1);        // Turn on the buzzer
-    vTaskDelay(100 / portTICK_PERIOD_MS); // Beep for 100ms
-    gpio_set_level(BUZZER_PIN, 0);        // Turn off the buzzer
+    gpio_set_level(BUZZER_PIN, 1);                          // Turn on the buzzer
+    tap_trace_delay(TAP_TRACE_BUZZER, "short beep", 100);   // Beep for 100ms
+    gpio_set_level(BUZZER_PIN, 0);                          // Turn off the buzzer
 }
 
 void buzzer_long_beep(void)
 {
-    gpio_set_level(BUZZER_PIN, 1);         // Turn on the buzzer
-    vTaskDelay(1000 / portTICK_PERIOD_MS); // Beep for 1 second
-    gpio_set_level(BUZZER_PIN, 0);         // Turn off the buzzer
+    gpio_set_level(BUZZER_PIN, 1);                          // Turn on the buzzer
+    tap_trace_delay(TAP_TRACE_BUZZER, "long beep", 1000);   // Beep for 1 second
+    gpio_set_level(BUZZER_PIN, 0);                          // Turn off the buzzer
 }
@@ -0,0 +1,341 @@
+#include "card_cache.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "CARD_CACHE";
+
+// Live table, replaced as a whole by card_cache_swap
+static card_table_t *live_table = NULL;
+static SemaphoreHandle_t cache_mutex = NULL;
+
+// Cleared when a change could not be stored, so a miss no longer proves the
+// card unknown. Set again by the next full table swapped in
+static bool live_complete = false;
+
+// FNV-1a hash of the canonical UID
+static uint32_t card_hash(const char *key) {
+    uint32_t hash = 2166136261u;
+    while (*key) {
+        hash ^= (uint8_t)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Build the canonical key from the UID bytes read from the card
+void card_uid_key_from_bytes(const uint8_t *uid, uint8_t size, char *key) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t len = 0;
+
+    for (uint8_t i = 0; i < size && len < CARD_UID_KEY_LEN; i++) {
+        key[len++] = hex[uid[i] >> 4];
+        key[len++] = hex[uid[i] & 0x0F];
+    }
+    key[len] = '\0';
+}
+
+// Build the canonical key from a UID typed in by the admin. Case, a leading
+// "0x" and ':', '-' or ' ' separators are ignored, and a 4-byte UID may carry
+// its trailing check byte. Anything else is rejected rather than guessed at, so
+// that a typo can never land on another card's key
+bool card_uid_key_from_string(const char *uid_string, char *key) {
+    char digits[CARD_UID_KEY_LEN + 3];
+    size_t len = 0;
+
+    key[0] = '\0';
+    if (uid_string == NULL) {
+        return false;
+    }
+
+    const char *p = uid_string;
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        p += 2;
+    }
+
+    for (; *p; p++) {
+        if (*p == ':' || *p == '-' || *p == ' ') {
+            continue;
+        }
+        if (!isxdigit((unsigned char)*p) || len == sizeof(digits) - 1) {
+            return false;
+        }
+        digits[len++] = toupper((unsigned char)*p);
+    }
+    digits[len] = '\0';
+
+    // 4-byte UID followed by its BCC (XOR of the UID bytes), as the reader sees it
+    if (len == 10) {
+        uint8_t bcc = 0;
+        for (size_t i = 0; i < 10; i += 2) {
+            char byte[3] = {digits[i], digits[i + 1], '\0'};
+            bcc ^= (uint8_t)strtoul(byte, NULL, 16);
+        }
+        if (bcc != 0) {
+            return false;
+        }
+        len = 8;
+        digits[len] = '\0';
+    }
+
+    // Single, double and triple size UIDs are 4, 7 and 10 bytes
+    if (len != 8 && len != 14 && len != 20) {
+        return false;
+    }
+
+    memcpy(key, digits, len + 1);
+    return true;
+}
+
+// Allocate an empty table
+card_table_t *card_table_create(size_t capacity) {
+    card_table_t *table = calloc(1, sizeof(card_table_t));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    table->slots = calloc(capacity, sizeof(card_entry_t));
+    if (table->slots == NULL) {
+        free(table);
+        return NULL;
+    }
+    table->capacity = capacity;
+    return table;
+}
+
+// Free a table and its slots
+void card_table_free(card_table_t *table) {
+    if (table) {
+        free(table->slots);
+        free(table);
+    }
+}
+
+// Find the slot holding key, or the empty slot where it would go
+static card_entry_t *card_table_slot(const card_table_t *table, const char *key) {
+    size_t index = card_hash(key) % table->capacity;
+
+    for (size_t probe = 0; probe < table->capacity; probe++) {
+        card_entry_t *slot = &table->slots[(index + probe) % table->capacity];
+        if (slot->uid[0] == '\0' || strcmp(slot->uid, key) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// Double the slots and rehash every entry into them
+static bool card_table_grow(card_table_t *table) {
+    card_table_t bigger = {
+        .slots = calloc(table->capacity * 2, sizeof(card_entry_t)),
+        .capacity = table->capacity * 2,
+        .count = table->count
+    };
+    if (bigger.slots == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].uid[0] != '\0') {
+            memcpy(card_table_slot(&bigger, table->slots[i].uid), &table->slots[i], sizeof(card_entry_t));
+        }
+    }
+
+    free(table->slots);
+    table->slots = bigger.slots;
+    table->capacity = bigger.capacity;
+    return true;
+}
+
+// Insert or replace an entry, growing the table to keep the load factor at or
+// below 3/4. Fails only when the bigger table cannot be allocated
+bool card_table_put(card_table_t *table, const card_entry_t *entry) {
+    if (table == NULL || entry == NULL || entry->uid[0] == '\0') {
+        return false;
+    }
+
+    card_entry_t *slot = card_table_slot(table, entry->uid);
+    if (slot != NULL && slot->uid[0] == '\0' && (table->count + 1) * 4 > table->capacity * 3) {
+        if (!card_table_grow(table)) {
+            ESP_LOGE(TAG, "No memory to grow card table past %u slots for %s",
+                     (unsigned)table->capacity, entry->uid);
+            return false;
+        }
+        slot = card_table_slot(table, entry->uid);
+    }
+    if (slot == NULL) {
+        return false;
+    }
+
+    if (slot->uid[0] == '\0') {
+        table->count++;
+    }
+    memcpy(slot, entry, sizeof(card_entry_t));
+    return true;
+}
+
+// Remove an entry, shifting later entries of the probe chain back so lookups
+// never stop early at the freed slot
+bool card_table_remove(card_table_t *table, const char *key) {
+    card_entry_t *slot = card_table_slot(table, key);
+    if (slot == NULL || slot->uid[0] == '\0') {
+        return false;
+    }
+
+    size_t hole = slot - table->slots;
+    size_t next = (hole + 1) % table->capacity;
+
+    while (table->slots[next].uid[0] != '\0') {
+        size_t home = card_hash(table->slots[next].uid) % table->capacity;
+
+        // Move the entry into the hole unless its home lies cyclically in (hole, next]
+        bool stays = (hole <= next) ? (home > hole && home <= next) : (home > hole || home <= next);
+        if (!stays) {
+            memcpy(&table->slots[hole], &table->slots[next], sizeof(card_entry_t));
+            hole = next;
+        }
+        next = (next + 1) % table->capacity;
+    }
+
+    memset(&table->slots[hole], 0, sizeof(card_entry_t));
+    table->count--;
+    return true;
+}
+
+// Initialize the live cache
+void card_cache_init(void) {
+    if (cache_mutex == NULL) {
+        cache_mutex = xSemaphoreCreateMutex();
+    }
+}
+
+// Install a freshly built table and free the previous one
+void card_cache_swap(card_table_t *table) {
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    card_table_t *old = live_table;
+    live_table = table;
+    live_complete = true;
+    xSemaphoreGive(cache_mutex);
+
+    card_table_free(old);
+    ESP_LOGI(TAG, "Card cache updated: %u approved cards", (unsigned)(table ? table->count : 0));
+}
+
+// O(1) lookup of a canonical UID, copying the entry out on a hit
+bool card_cache_lookup(const char *key, card_entry_t *entry) {
+    bool found = false;
+
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    if (live_table != NULL) {
+        card_entry_t *slot = card_table_slot(live_table, key);
+        if (slot != NULL && slot->uid[0] != '\0') {
+            if (entry) {
+                memcpy(entry, slot, sizeof(card_entry_t));
+            }
+            found = true;
+        }
+    }
+    xSemaphoreGive(cache_mutex);
+
+    return found;
+}
+
+// Copy out the ETag of the card list behind the live table. False before the
+// first swap and for tables built without one (stream snapshots)
+bool card_cache_get_etag(char *etag, size_t size) {
+    bool known = false;
+
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    if (live_table != NULL && live_table->etag[0] != '\0') {
+        snprintf(etag, size, "%s", live_table->etag);
+        known = true;
+    }
+    xSemaphoreGive(cache_mutex);
+
+    return known;
+}
+
+// Remove every card issued to a user (there is normally at most one)
+static bool remove_user_locked(const char *user_id) {
+    bool removed = false;
+    bool again = (live_table != NULL);
+
+    // Removal shifts entries around, so restart the scan after each hit
+    while (again) {
+        again = false;
+        for (size_t i = 0; i < live_table->capacity; i++) {
+            card_entry_t *slot = &live_table->slots[i];
+            if (slot->uid[0] != '\0' && strcmp(slot->user_id, user_id) == 0) {
+                char key[CARD_UID_KEY_LEN + 1];
+                strcpy(key, slot->uid);
+                card_table_remove(live_table, key);
+                removed = again = true;
+                break;
+            }
+        }
+    }
+    return removed;
+}
+
+// Apply a single approved card to the live cache, replacing any card
+// previously issued to the same user. Dropped until a full snapshot has been
+// swapped in, which will carry the card anyway: a table made of single
+// changes would look ready and turn away every other card
+bool card_cache_upsert(const card_entry_t *entry) {
+    bool ok;
+
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    if (live_table == NULL) {
+        xSemaphoreGive(cache_mutex);
+        ESP_LOGW(TAG, "Card %s for user %s dropped, no card list loaded yet", entry->uid, entry->user_id);
+        return false;
+    }
+    remove_user_locked(entry->user_id);
+    ok = card_table_put(live_table, entry);
+    if (!ok) {
+        live_complete = false;
+    }
+    xSemaphoreGive(cache_mutex);
+
+    ESP_LOGI(TAG, "Card %s %s for user %s", entry->uid, ok ? "added" : "not added", entry->user_id);
+    return ok;
+}
+
+// Drop the cards of a user whose application was revoked or deleted
+bool card_cache_remove_user(const char *user_id) {
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    bool removed = remove_user_locked(user_id);
+    xSemaphoreGive(cache_mutex);
+
+    if (removed) {
+        ESP_LOGI(TAG, "Removed card of user %s", user_id);
+    }
+    return removed;
+}
+
+// True once the first sync has completed
+bool card_cache_is_ready(void) {
+    return live_table != NULL;
+}
+
+// True while the live cache holds every approved card it was sent
+bool card_cache_is_complete(void) {
+    return live_table != NULL && live_complete;
+}
+
+// Number of cards in the live cache
+size_t card_cache_count(void) {
+    size_t count = 0;
+
+    xSemaphoreTake(cache_mutex, portMAX_DELAY);
+    if (live_table) {
+        count = live_table->count;
+    }
+    xSemaphoreGive(cache_mutex);
+
+    return count;
+}
@@ -0,0 +1,57 @@
+#ifndef CARD_CACHE_H
+#define CARD_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Cache sizing
+#define CARD_CACHE_CAPACITY 512     // Initial hash slots, tables double past 3/4 load
+#define CARD_UID_KEY_LEN 20         // Canonical UID is every UID byte as uppercase hex, up to 10 bytes
+#define CARD_ETAG_SIZE 64           // Longest ETag kept with a table
+
+// Card status as stored in /rfidApplications
+typedef enum {
+    CARD_STATUS_PENDING = 0,
+    CARD_STATUS_APPROVED = 1,
+    CARD_STATUS_REVOKED = 2
+} card_status_t;
+
+// One approved card
+typedef struct {
+    char uid[CARD_UID_KEY_LEN + 1];
+    card_status_t status;
+    char name[64];       // Same sizes as user_t, which the entry is copied into
+    char user_id[64];
+} card_entry_t;
+
+// Open addressing hash table of cards
+typedef struct {
+    card_entry_t *slots;
+    size_t capacity;
+    size_t count;
+    char etag[CARD_ETAG_SIZE];   // ETag of the card list the table was built from, empty if unknown
+} card_table_t;
+
+// Canonical UID keys
+void card_uid_key_from_bytes(const uint8_t *uid, uint8_t size, char *key);
+bool card_uid_key_from_string(const char *uid_string, char *key);
+
+// Standalone tables (used to build a new index before swapping it in)
+card_table_t *card_table_create(size_t capacity);
+void card_table_free(card_table_t *table);
+bool card_table_put(card_table_t *table, const card_entry_t *entry);
+bool card_table_remove(card_table_t *table, const char *key);
+
+// Live cache shared by the ticket task and the sync task
+void card_cache_init(void);
+void card_cache_swap(card_table_t *table);
+bool card_cache_lookup(const char *key, card_entry_t *entry);
+bool card_cache_get_etag(char *etag, size_t size);
+bool card_cache_upsert(const card_entry_t *entry);
+bool card_cache_remove_user(const char *user_id);
+bool card_cache_is_ready(void);
+bool card_cache_is_complete(void);
+size_t card_cache_count(void);
+
+#endif // CARD_CACHE_H
@@ -0,0 +1,292 @@
+#include "card_stream.h"
+#include "card_cache.h"
+#include "firebase.h"
+#include "esp_log.h"
+#include "esp_http_client.h"
+#include "esp_crt_bundle.h"
+#include "cJSON.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "CARD_STREAM";
+
+static TaskHandle_t stream_task_handle = NULL;
+static volatile bool stream_connected = false;
+static bool reconnect_requested = false;
+
+// Current SSE line and event name
+static char line[CARD_STREAM_LINE_SIZE];
+static size_t line_len = 0;
+static bool line_truncated = false;
+static char event_name[24];
+
+// Apply one full /rfidApplications/{id} record (or its deletion) to the cache
+static void apply_application(const char *app_id, const cJSON *app) {
+    cJSON *stored_rfid = cJSON_GetObjectItem(app, "rfidUid");
+    cJSON *status = cJSON_GetObjectItem(app, "status");
+    cJSON *name = cJSON_GetObjectItem(app, "name");
+    card_entry_t entry = {0};
+
+    if (!cJSON_IsObject(app) ||
+        !cJSON_IsString(stored_rfid) || !cJSON_IsString(name) ||
+        !cJSON_IsString(status) || strcmp(status->valuestring, "approved") != 0 ||
+        !card_uid_key_from_string(stored_rfid->valuestring, entry.uid)) {
+        // Deleted, rejected, revoked or not yet approved
+        card_cache_remove_user(app_id);
+        return;
+    }
+
+    entry.status = CARD_STATUS_APPROVED;
+    snprintf(entry.name, sizeof(entry.name), "%s", name->valuestring);
+    snprintf(entry.user_id, sizeof(entry.user_id), "%s", app_id);
+    card_cache_upsert(&entry);
+}
+
+// Re-read a single application after a partial update to it
+static void refresh_application(const char *app_id) {
+    char path[96];
+    char response[1024];
+
+    snprintf(path, sizeof(path), "/rfidApplications/%s", app_id);
+    if (!firebase_get(path, response, sizeof(response))) {
+        ESP_LOGW(TAG, "Failed to refresh application %s", app_id);
+        return;
+    }
+
+    cJSON *app = cJSON_Parse(response);
+    apply_application(app_id, app);
+    cJSON_Delete(app);
+}
+
+// Copy the "path" value out of an event payload; it comes first, so this also
+// works on payloads that were too long to keep in full
+static bool extract_path(const char *data, char *path, size_t size) {
+    const char *start = strstr(data, "\"path\":\"");
+    if (start == NULL) {
+        return false;
+    }
+    start += strlen("\"path\":\"");
+
+    const char *end = strchr(start, '"');
+    if (end == NULL || (size_t)(end - start) >= size) {
+        return false;
+    }
+    memcpy(path, start, end - start);
+    path[end - start] = '\0';
+    return true;
+}
+
+// First segment of an event path ("/abc/status" -> "abc"), empty for the root
+static void path_application_id(const char *path, char *app_id, size_t size) {
+    while (*path == '/') {
+        path++;
+    }
+    size_t len = strcspn(path, "/");
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(app_id, path, len);
+    app_id[len] = '\0';
+}
+
+// Rebuild the cache from a complete snapshot of /rfidApplications
+static void apply_snapshot(const cJSON *apps) {
+    card_table_t *table = card_table_create(CARD_CACHE_CAPACITY);
+    if (table == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate card table");
+        return;
+    }
+
+    cJSON *app = NULL;
+    cJSON_ArrayForEach(app, apps) {
+        cJSON *stored_rfid = cJSON_GetObjectItem(app, "rfidUid");
+        cJSON *status = cJSON_GetObjectItem(app, "status");
+        cJSON *name = cJSON_GetObjectItem(app, "name");
+        card_entry_t entry = {0};
+
+        if (app->string == NULL ||
+            !cJSON_IsString(stored_rfid) || !cJSON_IsString(name) ||
+            !cJSON_IsString(status) || strcmp(status->valuestring, "approved") != 0 ||
+            !card_uid_key_from_string(stored_rfid->valuestring, entry.uid)) {
+            continue;
+        }
+        entry.status = CARD_STATUS_APPROVED;
+        snprintf(entry.name, sizeof(entry.name), "%s", name->valuestring);
+        snprintf(entry.user_id, sizeof(entry.user_id), "%s", app->string);
+        if (!card_table_put(table, &entry)) {
+            // Keep the previous table rather than one missing this card
+            ESP_LOGE(TAG, "Snapshot card %s not stored, keeping previous card list", entry.uid);
+            card_table_free(table);
+            return;
+        }
+    }
+
+    card_cache_swap(table);
+}
+
+// Handle one put or patch event
+static void handle_event(const char *event, const char *data, bool truncated) {
+    char path[96];
+    char app_id[64];
+    bool is_put = (strcmp(event, "put") == 0);
+
+    if (!extract_path(data, path, sizeof(path))) {
+        ESP_LOGW(TAG, "Ignoring %s event without a path", event);
+        return;
+    }
+    path_application_id(path, app_id, sizeof(app_id));
+
+    // Too large to apply in place: only the root snapshot sent on (re)connect
+    // gets this big, reload it through the streaming sync, which first waits
+    // for a background sync that may be running
+    if (truncated) {
+        if (app_id[0] == '\0') {
+            firebase_sync_cards();
+        } else {
+            refresh_application(app_id);
+        }
+        return;
+    }
+
+    cJSON *root = cJSON_Parse(data);
+    cJSON *payload = cJSON_GetObjectItem(root, "data");
+    cJSON *children = cJSON_IsObject(payload) ? payload : NULL;
+
+    if (app_id[0] == '\0') {
+        if (is_put) {
+            apply_snapshot(children);
+        } else {
+            // Root patch, every key names (a field of) an application
+            cJSON *child = NULL;
+            cJSON_ArrayForEach(child, children) {
+                char child_id[64];
+                path_application_id(child->string, child_id, sizeof(child_id));
+                refresh_application(child_id);
+            }
+        }
+    } else if (is_put && strchr(path + 1, '/') == NULL) {
+        // A whole application was written or deleted
+        apply_application(app_id, payload);
+    } else {
+        // Some fields changed, the event alone does not carry the full record
+        refresh_application(app_id);
+    }
+
+    cJSON_Delete(root);
+}
+
+// Process one complete SSE line
+static void handle_line(void) {
+    if (strncmp(line, "event: ", 7) == 0) {
+        strncpy(event_name, line + 7, sizeof(event_name) - 1);
+        event_name[sizeof(event_name) - 1] = '\0';
+    } else if (strncmp(line, "data: ", 6) == 0) {
+        if (strcmp(event_name, "put") == 0 || strcmp(event_name, "patch") == 0) {
+            handle_event(event_name, line + 6, line_truncated);
+        } else if (strcmp(event_name, "cancel") == 0 || strcmp(event_name, "auth_revoked") == 0) {
+            ESP_LOGW(TAG, "Stream closed by server (%s)", event_name);
+            reconnect_requested = true;
+        }
+    }
+}
+
+// Split received bytes into lines
+static void feed_lines(const char *data, int len) {
+    for (int i = 0; i < len; i++) {
+        char c = data[i];
+
+        if (c == '\n') {
+            line[line_len] = '\0';
+            handle_line();
+            line_len = 0;
+            line_truncated = false;
+        } else if (c != '\r') {
+            if (line_len < CARD_STREAM_LINE_SIZE - 1) {
+                line[line_len++] = c;
+            } else {
+                line_truncated = true;
+            }
+        }
+    }
+}
+
+// Keep a text/event-stream subscription to /rfidApplications open
+static void card_stream_task(void *pvParameter) {
+    char url[256];
+    char chunk[512];
+
+    snprintf(url, sizeof(url), "%srfidApplications.json?auth=%s", FIREBASE_HOST, FIREBASE_AUTH);
+
+    esp_http_client_config_t config = {
+        .url = url,
+        .timeout_ms = CARD_STREAM_TIMEOUT_MS,
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .keep_alive_enable = true,
+        .save_client_session = true    // Reconnects resume the TLS session
+    };
+
+    // One client for the lifetime of the task, so its saved TLS session
+    // survives reconnects
+    esp_http_client_handle_t client = NULL;
+    while ((client = esp_http_client_init(&config)) == NULL) {
+        ESP_LOGE(TAG, "Failed to initialize stream client");
+        vTaskDelay(CARD_STREAM_RETRY_DELAY_MS / portTICK_PERIOD_MS);
+    }
+    esp_http_client_set_header(client, "Accept", "text/event-stream");
+
+    while (1) {
+        // Undo any redirect followed by the previous connection
+        esp_http_client_set_url(client, url);
+
+        int status_code = 0;
+        for (int redirects = 0; redirects < 3; redirects++) {
+            if (esp_http_client_open(client, 0) != ESP_OK || esp_http_client_fetch_headers(client) < 0) {
+                status_code = 0;
+                break;
+            }
+            status_code = esp_http_client_get_status_code(client);
+
+            // Firebase may move the stream to another server
+            if (status_code != 301 && status_code != 302 && status_code != 307) {
+                break;
+            }
+            esp_http_client_set_redirection(client);
+            esp_http_client_close(client);
+        }
+
+        if (status_code == 200) {
+            ESP_LOGI(TAG, "Card stream connected");
+            stream_connected = true;
+            reconnect_requested = false;
+            line_len = 0;
+            line_truncated = false;
+            event_name[0] = '\0';
+
+            int len;
+            while (!reconnect_requested && (len = esp_http_client_read(client, chunk, sizeof(chunk))) > 0) {
+                feed_lines(chunk, len);
+            }
+        } else {
+            ESP_LOGW(TAG, "Card stream request failed, status %d", status_code);
+        }
+
+        stream_connected = false;
+        esp_http_client_close(client);
+
+        ESP_LOGW(TAG, "Card stream disconnected, reconnecting in %d ms", CARD_STREAM_RETRY_DELAY_MS);
+        vTaskDelay(CARD_STREAM_RETRY_DELAY_MS / portTICK_PERIOD_MS);
+    }
+}
+
+// Start the subscription task
+void card_stream_start(void) {
+    if (stream_task_handle == NULL) {
+        xTaskCreate(card_stream_task, "card_stream_task", 8192, NULL, 4, &stream_task_handle);
+    }
+}
+
+// True while the subscription is delivering events
+bool card_stream_is_connected(void) {
+    return stream_connected;
+}
@@ -0,0 +1,14 @@
+#ifndef CARD_STREAM_H
+#define CARD_STREAM_H
+
+#include <stdbool.h>
+
+// Streaming (Server-Sent Events) subscription settings
+#define CARD_STREAM_LINE_SIZE 2048        // Longest SSE line applied in place
+#define CARD_STREAM_TIMEOUT_MS 60000      // Firebase sends keep-alive events every 30 s
+#define CARD_STREAM_RETRY_DELAY_MS 5000   // Wait before reconnecting a dropped stream
+
+void card_stream_start(void);
+bool card_stream_is_connected(void);
+
+#endif // CARD_STREAM_H
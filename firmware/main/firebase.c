@@ -1,4 +1,12 @@
 #include "firebase.h"
+#include "firebase_async.h"
+#include "card_cache.h"
+#include "card_stream.h"
+#include "journey_outbox.h"
+#include "journey_json.h"
+#include "json_arena.h"
+#include "json_stream.h"
+#include "retry_policy.h"
 #include "esp_log.h"
 #include "esp_http_client.h"
 #include "esp_wifi.h"
@@ -6,17 +14,93 @@
 #include "nvs_flash.h"
 #include "esp_crt_bundle.h"
 #include "esp_tls.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "cJSON.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <sys/time.h>
 
 static const char *TAG = "FIREBASE";
 
+// HTTP response buffer structure
+typedef struct {
+    char *buffer;        // Pointer to the buffer
+    size_t max_len;      // Maximum length of the buffer
+    size_t current_len;  // Current length of data in buffer
+    bool overflow;       // Flag to indicate if buffer overflowed
+    json_stream_t *stream; // When set, body chunks are tokenized instead of buffered
+    char *etag;            // When set, the response ETag is requested and stored here
+    size_t etag_size;
+    const char *known_etag; // ETag of the copy already held; a match stops the stream
+    bool not_modified;     // The response ETag equals known_etag
+    const char *if_match;  // When set, a write only lands on a stored copy with this ETag
+} http_response_buffer_t;
+
 // Global active journey session
 static journey_session_t active_journey;
 static bool journey_active = false;
 
+// Long-lived HTTPS client shared by every Firebase request so that one TLS
+// connection is kept open across the verify / check / start / end calls of a tap
+static esp_http_client_handle_t firebase_client = NULL;
+static SemaphoreHandle_t firebase_client_mutex = NULL;
+static SemaphoreHandle_t journey_buffer_mutex = NULL;
+static atomic_uint priority_waiters = 0;   // Tap requests waiting for the connection
+
+// Session statistics (guarded by firebase_client_mutex)
+static firebase_session_stats_t session_stats;
+static firebase_session_stats_t tap_stats;
+static firebase_heap_stats_t heap_stats;
+static size_t tap_heap_free_at_begin = 0;
+static bool tls_session_saved = false;   // A handshake on this client has stored a session ticket
+static int64_t request_start_us = 0;
+
+// Phase timestamps of the attempt in flight, set by the event handler (0 until reached)
+static struct {
+    int64_t connected_us;
+    int64_t sent_us;
+    int64_t first_header_us;
+    int64_t finish_us;
+} request_timing;
+
+// Request phase histograms per operation (guarded by firebase_client_mutex)
+static firebase_latency_stats_t latency_stats[FIREBASE_LATENCY_OP_COUNT];
+static const char *const op_names[FIREBASE_LATENCY_OP_COUNT] = {"verify", "check", "start", "end", "upload", "sync"};
+static const char *const phase_names[FIREBASE_PHASE_COUNT] = {"queue", "connect", "send", "wait", "body", "total"};
+
+// Card record fetched for the current tap, so that the active journey check
+// that follows verification needs no second round trip
+static struct {
+    bool valid;
+    char uid[32];
+    bool journey_active;
+    journey_session_t journey;
+} tap_card;
+
+// Retry budgets and the breaker shared by every request on the connection
+static const retry_policy_t tap_policy = RETRY_POLICY_TAP;
+static const retry_policy_t background_policy = RETRY_POLICY_BACKGROUND;
+static circuit_breaker_t breaker;
+
+// Background whitelist refresh task. Full and delta syncs also run from the
+// card stream task, card_sync_mutex lets one at a time use the sync state
+static TaskHandle_t card_sync_task_handle = NULL;
+static SemaphoreHandle_t card_sync_mutex = NULL;
+static card_sync_stats_t card_sync_stats;
+static int64_t card_watermark = 0;      // Newest updatedAt applied, 0 until a full sync saw one
+static uint32_t deltas_since_full = 0;
+static void card_sync_task(void *pvParameter);
+static bool firebase_verify_rfid_online(const uint8_t *rfid_uid, uint8_t uid_size, user_t *user);
+static bool parse_active_journey(const cJSON *journey_item, const char *uid_string,
+                                 const uint8_t *rfid_uid, uint8_t uid_size, journey_session_t *journey);
+
 // Generates a random string for ticket ID
 void generate_ticket_id(char *ticket_id, size_t size) {
     const char charset[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
@@ -50,11 +134,96 @@ time_t get_current_timestamp(void) {
     return now;
 }
 
-// Format timestamp as ISO 8601 string
-static void format_timestamp(time_t timestamp, char *buffer, size_t size) {
-    struct tm timeinfo;
-    localtime_r(&timestamp, &timeinfo);
-    strftime(buffer, size, "%Y-%m-%dT%H:%M:%SZ", &timeinfo);
+// Seconds since the epoch for a UTC calendar time (newlib has no timegm)
+static time_t utc_to_time(int year, int month, int day, int hour, int minute, int second) {
+    // Days from civil: years start in March so the leap day comes last
+    year -= (month <= 2);
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int year_of_era = year - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    int64_t days = (int64_t)era * 146097 + day_of_era - 719468;
+
+    return (time_t)(days * 86400 + hour * 3600 + minute * 60 + second);
+}
+
+// Until SNTP has synced, set the clock from the Date header of a Firebase
+// response ("Sun, 06 Nov 1994 08:49:37 GMT"), so taps right after boot get
+// real timestamps instead of waiting for NTP
+static void seed_clock_from_http_date(const char *value) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    int day, year, hour, minute, second;
+    
+    if (get_current_timestamp() >= FIREBASE_CLOCK_VALID_AFTER) {
+        return;
+    }
+    if (sscanf(value, "%*[^,], %d %3s %d %d:%d:%d", &day, month, &year, &hour, &minute, &second) != 6) {
+        return;
+    }
+    const char *found = strstr(months, month);
+    if (found == NULL || (found - months) % 3 != 0) {
+        return;
+    }
+    
+    struct timeval now = {
+        .tv_sec = utc_to_time(year, (found - months) / 3 + 1, day, hour, minute, second),
+        .tv_usec = 0
+    };
+    if (now.tv_sec >= FIREBASE_CLOCK_VALID_AFTER && settimeofday(&now, NULL) == 0) {
+        ESP_LOGI(TAG, "Clock set from server Date header: %s", value);
+    }
+}
+
+// Journey times are ISO 8601 strings, or server milliseconds for events
+// logged before the gate's clock was set
+static bool parse_journey_timestamp(const cJSON *item, time_t *timestamp) {
+    int year, month, day, hour, minute, second;
+    
+    if (cJSON_IsNumber(item)) {
+        *timestamp = (time_t)(item->valuedouble / 1000);
+        return true;
+    }
+    if (cJSON_IsString(item) && item->valuestring &&
+        sscanf(item->valuestring, "%d-%d-%dT%d:%d:%d", &year, &month, &day, &hour, &minute, &second) == 6) {
+        *timestamp = utc_to_time(year, month, day, hour, minute, second);
+        return true;
+    }
+    return false;
+}
+
+static esp_err_t http_event_handler(esp_http_client_event_t *evt);
+
+// Create the persistent HTTP client if it does not exist yet
+static esp_http_client_handle_t firebase_client_get(void) {
+    if (firebase_client != NULL) {
+        return firebase_client;
+    }
+    
+    esp_http_client_config_t config = {
+        .url = FIREBASE_HOST,
+        .event_handler = http_event_handler,
+        .buffer_size = 4096,    // Increased buffer size
+        .timeout_ms = FIREBASE_ATTEMPT_TIMEOUT_MS,
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .keep_alive_enable = true,
+        .keep_alive_idle = 5,
+        .keep_alive_interval = 5,
+        .keep_alive_count = 3,
+        .disable_auto_redirect = false,
+        .save_client_session = true     // Keep the TLS session ticket for abbreviated reconnects
+    };
+    
+    firebase_client = esp_http_client_init(&config);
+    if (firebase_client == NULL) {
+        ESP_LOGE(TAG, "Failed to initialize HTTP client");
+        return NULL;
+    }
+    
+    // Set for good: harmless on GETs, and toggling it per request would
+    // allocate and free a header entry every time
+    esp_http_client_set_header(firebase_client, "Content-Type", "application/json");
+    return firebase_client;
 }
 
 // Initialize Firebase connection
@@ -64,19 +233,247 @@ void firebase_init(void) {
     // Reset active journey flag
     journey_active = false;
     
-    // Initialize cJSON (if needed)
-    // Any other initialization for Firebase
+    if (firebase_client_mutex == NULL) {
+        firebase_client_mutex = xSemaphoreCreateMutex();
+    }
+    if (journey_buffer_mutex == NULL) {
+        journey_buffer_mutex = xSemaphoreCreateMutex();
+    }
+    if (card_sync_mutex == NULL) {
+        card_sync_mutex = xSemaphoreCreateMutex();
+    }
+    
+    memset(&session_stats, 0, sizeof(session_stats));
+    memset(&tap_stats, 0, sizeof(tap_stats));
+    
+    // Tap-path JSON is parsed into a static arena instead of the heap
+    json_arena_init();
+    
+    // Create the long-lived client up front; the TLS connection itself is
+    // opened by the first request and then kept alive between requests
+    if (firebase_client_get() == NULL) {
+        ESP_LOGE(TAG, "Firebase client could not be created, will retry on first request");
+    }
+    
+    // Recover journey events logged before the last reboot and start uploading them
+    if (journey_outbox_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Journey outbox unavailable, journeys are written synchronously");
+    }
+    
+    // Load the approved card whitelist once, then keep it fresh in the background
+    card_cache_init();
+    if (!firebase_sync_cards()) {
+        ESP_LOGW(TAG, "Initial card sync failed, verification falls back to online lookups");
+    }
+    if (card_sync_task_handle == NULL) {
+        xTaskCreate(card_sync_task, "card_sync_task", 6144, NULL, 4, &card_sync_task_handle);
+    }
+    
+    // Apply approvals and revocations as they happen instead of waiting for the next poll
+    card_stream_start();
     
     ESP_LOGI(TAG, "Firebase initialized");
 }
 
+// Start counting requests and handshakes for a new tap
+void firebase_tap_begin(void) {
+    if (firebase_client_mutex) xSemaphoreTake(firebase_client_mutex, portMAX_DELAY);
+    memset(&tap_stats, 0, sizeof(tap_stats));
+    tap_card.valid = false;
+    tap_heap_free_at_begin = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    if (firebase_client_mutex) xSemaphoreGive(firebase_client_mutex);
+}
+
+// Finish the current tap and log how many connections it needed
+void firebase_tap_end(void) {
+    if (firebase_client_mutex) xSemaphoreTake(firebase_client_mutex, portMAX_DELAY);
+    tap_stats.taps = 1;
+    session_stats.taps++;
+    tap_card.valid = false;
+    
+    ESP_LOGI(TAG, "Tap used %lu requests: %lu handshakes (%lu resumed), %lu reused, %lu reconnects",
+             (unsigned long)tap_stats.requests, (unsigned long)tap_stats.handshakes,
+             (unsigned long)tap_stats.resumed_handshakes,
+             (unsigned long)tap_stats.reused, (unsigned long)tap_stats.reconnects);
+    ESP_LOGI(TAG, "Session totals: %lu taps, %lu requests, %lu handshakes (%.2f per tap)",
+             (unsigned long)session_stats.taps, (unsigned long)session_stats.requests,
+             (unsigned long)session_stats.handshakes,
+             (double)session_stats.handshakes / session_stats.taps);
+    
+    uint32_t full = session_stats.handshakes - session_stats.resumed_handshakes;
+    ESP_LOGI(TAG, "Connect time: %lu full handshakes avg %llu ms, %lu resumed avg %llu ms",
+             (unsigned long)full,
+             (unsigned long long)(full ? session_stats.full_handshake_us / full / 1000 : 0),
+             (unsigned long)session_stats.resumed_handshakes,
+             (unsigned long long)(session_stats.resumed_handshakes ?
+                 session_stats.resumed_handshake_us / session_stats.resumed_handshakes / 1000 : 0));
+    ESP_LOGI(TAG, "Request p95 since boot: verify %.1f ms, check %.1f ms, start %.1f ms, end %.1f ms",
+             firebase_latency_percentile_us(&latency_stats[FIREBASE_LATENCY_VERIFY].phases[FIREBASE_PHASE_TOTAL], 95) / 1000.0,
+             firebase_latency_percentile_us(&latency_stats[FIREBASE_LATENCY_CHECK].phases[FIREBASE_PHASE_TOTAL], 95) / 1000.0,
+             firebase_latency_percentile_us(&latency_stats[FIREBASE_LATENCY_START].phases[FIREBASE_PHASE_TOTAL], 95) / 1000.0,
+             firebase_latency_percentile_us(&latency_stats[FIREBASE_LATENCY_END].phases[FIREBASE_PHASE_TOTAL], 95) / 1000.0);
+    if (breaker.trips) {
+        ESP_LOGI(TAG, "Circuit breaker %s: %lu trips, %lu requests failed fast",
+                 breaker.state == BREAKER_CLOSED ? "closed" : "open",
+                 (unsigned long)breaker.trips, (unsigned long)breaker.rejected);
+    }
+    
+    // Fragmentation shows as a shrinking largest block while free space holds
+    json_arena_stats_t arena;
+    json_arena_get_stats(&arena);
+    heap_stats.free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    heap_stats.tap_delta = (int32_t)heap_stats.free_bytes - (int32_t)tap_heap_free_at_begin;
+    heap_stats.minimum_free_bytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    heap_stats.largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    ESP_LOGI(TAG, "Heap: %lu free (%+ld this tap), %lu lowest, largest block %lu; "
+             "JSON arena %lu of %d bytes (peak %lu), %lu heap fallbacks",
+             (unsigned long)heap_stats.free_bytes, (long)heap_stats.tap_delta,
+             (unsigned long)heap_stats.minimum_free_bytes, (unsigned long)heap_stats.largest_free_block,
+             (unsigned long)arena.last_bytes, JSON_ARENA_SIZE, (unsigned long)arena.peak_bytes,
+             (unsigned long)arena.heap_fallbacks);
+    if (firebase_client_mutex) xSemaphoreGive(firebase_client_mutex);
+}
+
+// Copy out the cumulative and last-tap connection statistics
+void firebase_get_session_stats(firebase_session_stats_t *total, firebase_session_stats_t *last_tap) {
+    if (firebase_client_mutex) xSemaphoreTake(firebase_client_mutex, portMAX_DELAY);
+    if (total) {
+        memcpy(total, &session_stats, sizeof(firebase_session_stats_t));
+    }
+    if (last_tap) {
+        memcpy(last_tap, &tap_stats, sizeof(firebase_session_stats_t));
+    }
+    if (firebase_client_mutex) xSemaphoreGive(firebase_client_mutex);
+}
+
+// Copy out the heap figures taken at the end of the last tap
+void firebase_get_heap_stats(firebase_heap_stats_t *stats) {
+    if (firebase_client_mutex) xSemaphoreTake(firebase_client_mutex, portMAX_DELAY);
+    memcpy(stats, &heap_stats, sizeof(firebase_heap_stats_t));
+    if (firebase_client_mutex) xSemaphoreGive(firebase_client_mutex);
+}
+
+const char *firebase_latency_op_name(firebase_latency_op_t op) {
+    return (op >= 0 && op < FIREBASE_LATENCY_OP_COUNT) ? op_names[op] : "unknown";
+}
+
+const char *firebase_phase_name(firebase_phase_t phase) {
+    return (phase >= 0 && phase < FIREBASE_PHASE_COUNT) ? phase_names[phase] : "unknown";
+}
+
+// Copy out the phase histograms of one operation
+void firebase_get_latency_stats(firebase_latency_op_t op, firebase_latency_stats_t *stats) {
+    if (op < 0 || op >= FIREBASE_LATENCY_OP_COUNT) {
+        memset(stats, 0, sizeof(firebase_latency_stats_t));
+        return;
+    }
+    if (firebase_client_mutex) xSemaphoreTake(firebase_client_mutex, portMAX_DELAY);
+    memcpy(stats, &latency_stats[op], sizeof(firebase_latency_stats_t));
+    if (firebase_client_mutex) xSemaphoreGive(firebase_client_mutex);
+}
+
+// Upper bound of the bucket holding the given percentile, capped at the slowest sample
+uint32_t firebase_latency_percentile_us(const firebase_latency_histogram_t *histogram, uint32_t percent) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+    uint32_t rank = (uint32_t)(((uint64_t)histogram->count * percent + 99) / 100);
+    uint32_t seen = 0;
+    for (int i = 0; i < FIREBASE_LATENCY_BUCKETS - 1; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint32_t bound = (uint32_t)FIREBASE_LATENCY_BUCKET0_US << i;
+            return bound < histogram->max_us ? bound : histogram->max_us;
+        }
+    }
+    return histogram->max_us;
+}
+
+// Add one sample to a phase histogram (firebase_client_mutex held)
+static void latency_record(firebase_latency_op_t op, firebase_phase_t phase, int64_t elapsed_us) {
+    firebase_latency_histogram_t *histogram = &latency_stats[op].phases[phase];
+    uint32_t us = elapsed_us <= 0 ? 0 : elapsed_us >= UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed_us;
+    
+    int bucket = 0;
+    while (bucket < FIREBASE_LATENCY_BUCKETS - 1 && us >= ((uint32_t)FIREBASE_LATENCY_BUCKET0_US << bucket)) {
+        bucket++;
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum_us += us;
+    if (us > histogram->max_us) {
+        histogram->max_us = us;
+    }
+}
+
+// Split the attempt just performed into phases and record the ones it reached.
+// A failed attempt stops at the last event it got to
+static void record_attempt_phases(firebase_latency_op_t op, uint32_t *phase_us) {
+    int64_t end_us = request_timing.finish_us ? request_timing.finish_us : esp_timer_get_time();
+    int64_t send_from_us = request_start_us;
+    
+    memset(phase_us + FIREBASE_PHASE_CONNECT, 0, (FIREBASE_PHASE_TOTAL - FIREBASE_PHASE_CONNECT) * sizeof(uint32_t));
+    if (request_timing.connected_us) {
+        phase_us[FIREBASE_PHASE_CONNECT] = (uint32_t)(request_timing.connected_us - request_start_us);
+        latency_record(op, FIREBASE_PHASE_CONNECT, phase_us[FIREBASE_PHASE_CONNECT]);
+        send_from_us = request_timing.connected_us;
+    }
+    if (request_timing.sent_us == 0) {
+        return;
+    }
+    phase_us[FIREBASE_PHASE_SEND] = (uint32_t)(request_timing.sent_us - send_from_us);
+    latency_record(op, FIREBASE_PHASE_SEND, phase_us[FIREBASE_PHASE_SEND]);
+    if (request_timing.first_header_us == 0) {
+        return;
+    }
+    phase_us[FIREBASE_PHASE_WAIT] = (uint32_t)(request_timing.first_header_us - request_timing.sent_us);
+    phase_us[FIREBASE_PHASE_BODY] = (uint32_t)(end_us - request_timing.first_header_us);
+    latency_record(op, FIREBASE_PHASE_WAIT, phase_us[FIREBASE_PHASE_WAIT]);
+    latency_record(op, FIREBASE_PHASE_BODY, phase_us[FIREBASE_PHASE_BODY]);
+}
+
 // HTTP event handler with improved buffer management
 static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
     // Cast user data to a response buffer structure
     http_response_buffer_t *response_buffer = (http_response_buffer_t *)evt->user_data;
     
-    if (response_buffer == NULL) {
-        ESP_LOGW(TAG, "No user data (response buffer) provided");
+    // Firebase's Date header sets the clock until SNTP has synced
+    if (evt->event_id == HTTP_EVENT_ON_HEADER && strcasecmp(evt->header_key, "Date") == 0) {
+        seed_clock_from_http_date(evt->header_value);
+    }
+    
+    // Phase boundaries of the current attempt
+    int64_t now_us = esp_timer_get_time();
+    if (evt->event_id == HTTP_EVENT_HEADER_SENT && request_timing.sent_us == 0) {
+        request_timing.sent_us = now_us;
+    } else if (evt->event_id == HTTP_EVENT_ON_HEADER && request_timing.first_header_us == 0) {
+        request_timing.first_header_us = now_us;
+    } else if (evt->event_id == HTTP_EVENT_ON_FINISH) {
+        request_timing.finish_us = now_us;
+    }
+    
+    // Every new connection means a TCP + TLS handshake; once the client holds a
+    // session ticket the handshake is abbreviated (unless the server declines it)
+    if (evt->event_id == HTTP_EVENT_ON_CONNECTED) {
+        uint32_t elapsed_us = (uint32_t)(now_us - request_start_us);
+        
+        request_timing.connected_us = now_us;
+        session_stats.handshakes++;
+        tap_stats.handshakes++;
+        if (tls_session_saved) {
+            session_stats.resumed_handshakes++;
+            tap_stats.resumed_handshakes++;
+            session_stats.resumed_handshake_us += elapsed_us;
+            tap_stats.resumed_handshake_us += elapsed_us;
+        } else {
+            session_stats.full_handshake_us += elapsed_us;
+            tap_stats.full_handshake_us += elapsed_us;
+        }
+        tls_session_saved = true;
+    }
+    
+    // Writes such as the batch PATCH pass no buffer: the status is all they need
+    if (response_buffer == NULL || (response_buffer->buffer == NULL && response_buffer->stream == NULL)) {
         return ESP_OK;
     }
     
@@ -92,10 +489,29 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
             break;
         case HTTP_EVENT_ON_HEADER:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+            if (response_buffer->etag && strcasecmp(evt->header_key, "ETag") == 0) {
+                strncpy(response_buffer->etag, evt->header_value, response_buffer->etag_size - 1);
+                response_buffer->etag[response_buffer->etag_size - 1] = '\0';
+                
+                // Same data as the copy already held: drop the body unparsed
+                if (response_buffer->known_etag && response_buffer->known_etag[0] != '\0' &&
+                    strcmp(response_buffer->known_etag, response_buffer->etag) == 0) {
+                    response_buffer->not_modified = true;
+                    if (response_buffer->stream) {
+                        response_buffer->stream->stopped = true;
+                    }
+                }
+            }
             break;
         case HTTP_EVENT_ON_DATA:
             ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            if (response_buffer) {
+            if (response_buffer->stream) {
+                // Tokenize the chunk in place; once the stream has stopped (match
+                // found) or failed, the remaining chunks are simply dropped
+                if (!response_buffer->stream->stopped && !response_buffer->stream->error) {
+                    json_stream_feed(response_buffer->stream, evt->data, evt->data_len);
+                }
+            } else {
                 // Check if we have space left in the buffer
                 if (response_buffer->current_len + evt->data_len < response_buffer->max_len - 1) {
                     // Copy data to the buffer at the current position
@@ -118,7 +534,7 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
         case HTTP_EVENT_ON_FINISH:
             ESP_LOGI(TAG, "HTTP_EVENT_ON_FINISH");
             // Make extra sure we have null termination
-            if (response_buffer && response_buffer->current_len < response_buffer->max_len) {
+            if (response_buffer->buffer && response_buffer->current_len < response_buffer->max_len) {
                 response_buffer->buffer[response_buffer->current_len] = '\0';
             }
             break;
@@ -132,9 +548,44 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
     return ESP_OK;
 }
 
-// Improved Firebase HTTP request function with retry mechanism and better error handling
-static esp_err_t firebase_http_request(const char *path, const char *method, const char *data, char *response_buffer, size_t response_buffer_size) {
-    if (path == NULL || method == NULL) {
+// Take the connection for one attempt. Background requests step aside while a
+// tap is waiting, so a passenger never queues behind a slow sync or upload
+static bool connection_acquire(const retry_policy_t *policy, int64_t deadline_us) {
+    bool taken = false;
+    
+    if (policy->priority) {
+        atomic_fetch_add(&priority_waiters, 1);
+    }
+    while (!taken) {
+        int64_t remaining_ms = (deadline_us - esp_timer_get_time()) / 1000;
+        if (remaining_ms <= 0) {
+            break;
+        }
+        if (!policy->priority && atomic_load(&priority_waiters) > 0) {
+            vTaskDelay(pdMS_TO_TICKS(FIREBASE_PRIORITY_YIELD_MS));
+            continue;
+        }
+        taken = (xSemaphoreTake(firebase_client_mutex, pdMS_TO_TICKS(remaining_ms)) == pdTRUE);
+        
+        // A tap may have started waiting while this one was queued
+        if (taken && !policy->priority && atomic_load(&priority_waiters) > 0) {
+            xSemaphoreGive(firebase_client_mutex);
+            taken = false;
+        }
+    }
+    if (policy->priority) {
+        atomic_fetch_sub(&priority_waiters, 1);
+    }
+    return taken;
+}
+
+// Firebase HTTP request with retries governed by policy and the circuit breaker.
+// The response goes to user_buffer, either buffered or streamed through its tokenizer.
+// The connection is held for one attempt at a time and released during backoff
+static esp_err_t firebase_http_exchange(const char *path, const char *method, const char *data,
+                                        http_response_buffer_t *user_buffer, const retry_policy_t *policy,
+                                        firebase_latency_op_t op) {
+    if (path == NULL || method == NULL || user_buffer == NULL || policy == NULL || op >= FIREBASE_LATENCY_OP_COUNT) {
         ESP_LOGE(TAG, "Invalid parameters for firebase_http_request");
         return ESP_ERR_INVALID_ARG;
     }
@@ -145,238 +596,922 @@ static esp_err_t firebase_http_request(const char *path, const char *method, con
         return ESP_ERR_INVALID_STATE;
     }
     
-    char url[256];
-    snprintf(url, sizeof(url), "%s%s.json?auth=%s", FIREBASE_HOST, path, FIREBASE_AUTH);
+    // Query parameters may follow the path after a '?'
+    const char *query = strchr(path, '?');
+    int path_len = query ? (int)(query - path) : (int)strlen(path);
+    
+    char url[320];
+    snprintf(url, sizeof(url), "%s%.*s.json?auth=%s%s%s", FIREBASE_HOST, path_len, path, FIREBASE_AUTH,
+             query ? "&" : "", query ? query + 1 : "");
     
     ESP_LOGI(TAG, "Request URL: %s", url);
     
+    esp_http_client_method_t http_method =
+        (strcmp(method, "GET") == 0) ? HTTP_METHOD_GET : 
+        (strcmp(method, "POST") == 0) ? HTTP_METHOD_POST : 
+        (strcmp(method, "PUT") == 0) ? HTTP_METHOD_PUT : 
+        (strcmp(method, "PATCH") == 0) ? HTTP_METHOD_PATCH : HTTP_METHOD_DELETE;
+    
+    // Only one request at a time may use the shared connection; waiting for it
+    // counts against the deadline
+    int64_t call_start_us = esp_timer_get_time();
+    int64_t deadline_us = call_start_us + (int64_t)policy->deadline_ms * 1000;
+    if (firebase_client_mutex == NULL) {
+        firebase_client_mutex = xSemaphoreCreateMutex();
+    }
+    
+    uint32_t phase_us[FIREBASE_PHASE_COUNT] = {0};
+    esp_err_t err = ESP_FAIL;
+    retry_class_t result = RETRY_TRANSIENT;
+    bool locked = false;
+    int attempt = 0;
+    
+    while (1) {
+        attempt++;
+        
+        int64_t queue_start_us = esp_timer_get_time();
+        locked = connection_acquire(policy, deadline_us);
+        phase_us[FIREBASE_PHASE_QUEUE] += (uint32_t)(esp_timer_get_time() - queue_start_us);
+        if (!locked) {
+            ESP_LOGW(TAG, "Connection busy, giving up after %lu ms", (unsigned long)policy->deadline_ms);
+            err = ESP_ERR_TIMEOUT;
+            break;
+        }
+        
+        // Backend known to be down: fail fast and let the caller go offline
+        if (attempt == 1 && !breaker_allow(&breaker)) {
+            ESP_LOGW(TAG, "Circuit open, skipping %s %s", method, path);
+            err = ESP_ERR_INVALID_STATE;
+            break;
+        }
+        
+        // An attempt may not outlive the operation's deadline
+        int64_t remaining_ms = (deadline_us - esp_timer_get_time()) / 1000;
+        if (remaining_ms <= 0) {
+            err = ESP_ERR_TIMEOUT;
+            break;
+        }
+        
+        esp_http_client_handle_t client = firebase_client_get();
+        if (client == NULL) {
+            err = ESP_FAIL;
+            break;
+        }
+        
+        // Point the persistent client at this request; the open connection is kept
+        // because the host does not change. Requests in between may have changed
+        // any of it, so it is set again for every attempt
+        esp_http_client_set_url(client, url);
+        esp_http_client_set_method(client, http_method);
+        esp_http_client_set_user_data(client, user_buffer);
+        
+        // Set post data if needed, clearing leftovers from the previous request
+        if (data != NULL) {
+            esp_http_client_set_post_field(client, data, strlen(data));
+        } else {
+            esp_http_client_set_post_field(client, NULL, 0);
+        }
+        if (user_buffer->etag) {
+            esp_http_client_set_header(client, "X-Firebase-ETag", "true");
+        } else {
+            esp_http_client_delete_header(client, "X-Firebase-ETag");
+        }
+        if (user_buffer->if_match) {
+            esp_http_client_set_header(client, "if-match", user_buffer->if_match);
+        } else {
+            esp_http_client_delete_header(client, "if-match");
+        }
+        
+        ESP_LOGI(TAG, "Attempting request (attempt %d of %d)", attempt, policy->max_attempts);
+        
+        // Reset response buffer position (or tokenizer) before each attempt
+        if (user_buffer->buffer) {
+            user_buffer->current_len = 0;
+            user_buffer->overflow = false;
+            user_buffer->buffer[0] = '\0';
+        }
+        if (user_buffer->stream) {
+            json_stream_reset(user_buffer->stream);
+        }
+        if (user_buffer->etag) {
+            user_buffer->etag[0] = '\0';
+            user_buffer->not_modified = false;
+        }
+        
+        esp_http_client_set_timeout_ms(client, remaining_ms < FIREBASE_ATTEMPT_TIMEOUT_MS ?
+                                               (int)remaining_ms : FIREBASE_ATTEMPT_TIMEOUT_MS);
+        
+        memset(&request_timing, 0, sizeof(request_timing));
+        request_start_us = esp_timer_get_time();
+        err = esp_http_client_perform(client);
+        record_attempt_phases(op, phase_us);
+        
+        session_stats.requests++;
+        tap_stats.requests++;
+        if (request_timing.connected_us == 0) {
+            session_stats.reused++;
+            tap_stats.reused++;
+        }
+        
+        int status_code = (err == ESP_OK) ? esp_http_client_get_status_code(client) : 0;
+        result = retry_classify(err, status_code);
+        breaker_record(&breaker, result);
+        
+        // Detach the caller's buffer; the client and its connection stay open
+        esp_http_client_set_user_data(client, NULL);
+        
+        // The stored copy changed since it was read; the body and ETag are the
+        // new copy. Also the answer to a repeated attempt whose first one landed
+        if (status_code == 412 && user_buffer->if_match) {
+            ESP_LOGI(TAG, "Precondition failed, stored copy has changed");
+            err = ESP_ERR_INVALID_VERSION;
+            break;
+        }
+        
+        if (result == RETRY_SUCCESS) {
+            ESP_LOGI(TAG, "HTTP request successful with status code: %d", status_code);
+            break;
+        }
+        
+        if (err == ESP_OK) {
+            ESP_LOGW(TAG, "HTTP request returned error status code: %d", status_code);
+            err = ESP_FAIL;
+        } else {
+            ESP_LOGW(TAG, "HTTP request failed: %s", esp_err_to_name(err));
+            // The kept-alive connection was most likely dropped by the server or
+            // the access point; close it so the next attempt reconnects cleanly
+            esp_http_client_close(client);
+            session_stats.reconnects++;
+            tap_stats.reconnects++;
+        }
+        
+        if (result == RETRY_PERMANENT || attempt >= policy->max_attempts || breaker.state == BREAKER_OPEN) {
+            break;
+        }
+        
+        uint32_t delay_ms = retry_backoff_ms(policy, attempt);
+        if (esp_timer_get_time() + (int64_t)delay_ms * 1000 >= deadline_us) {
+            ESP_LOGW(TAG, "Deadline of %lu ms reached", (unsigned long)policy->deadline_ms);
+            break;
+        }
+        
+        // Let other requests, taps above all, use the connection meanwhile
+        xSemaphoreGive(firebase_client_mutex);
+        locked = false;
+        ESP_LOGI(TAG, "Retrying in %lu ms", (unsigned long)delay_ms);
+        vTaskDelay(delay_ms / portTICK_PERIOD_MS);
+    }
+    
+    // Check for response buffer overflow, a truncated document is never valid JSON
+    if (user_buffer->buffer && user_buffer->overflow) {
+        ESP_LOGW(TAG, "Response was truncated due to buffer size limitations");
+        if (err == ESP_OK) {
+            err = ESP_ERR_INVALID_SIZE;
+        }
+    }
+    
+    // Phases are those of the last attempt, the total spans every attempt
+    // and queue every wait for the connection
+    if (locked) {
+        phase_us[FIREBASE_PHASE_TOTAL] = (uint32_t)(esp_timer_get_time() - call_start_us);
+        latency_record(op, FIREBASE_PHASE_QUEUE, phase_us[FIREBASE_PHASE_QUEUE]);
+        latency_record(op, FIREBASE_PHASE_TOTAL, phase_us[FIREBASE_PHASE_TOTAL]);
+        ESP_LOGI(TAG, "%s %s took %.1f ms: queue %.1f, connect %.1f, send %.1f, wait %.1f, body %.1f ms",
+                 method, op_names[op], phase_us[FIREBASE_PHASE_TOTAL] / 1000.0,
+                 phase_us[FIREBASE_PHASE_QUEUE] / 1000.0, phase_us[FIREBASE_PHASE_CONNECT] / 1000.0,
+                 phase_us[FIREBASE_PHASE_SEND] / 1000.0, phase_us[FIREBASE_PHASE_WAIT] / 1000.0,
+                 phase_us[FIREBASE_PHASE_BODY] / 1000.0);
+        xSemaphoreGive(firebase_client_mutex);
+    }
+    
+    if (err != ESP_OK && err != ESP_ERR_INVALID_VERSION) {
+        ESP_LOGE(TAG, "HTTP request failed after %d attempts (%s)", attempt,
+                 result == RETRY_PERMANENT ? "permanent error" : "transient error");
+    }
+    
+    return err;
+}
+
+// Request with the whole response body copied into response_buffer
+static esp_err_t firebase_http_request(const char *path, const char *method, const char *data,
+                                       char *response_buffer, size_t response_buffer_size,
+                                       const retry_policy_t *policy, firebase_latency_op_t op) {
     // Create response buffer structure for the event handler
     http_response_buffer_t user_buffer = {
         .buffer = response_buffer,
         .max_len = response_buffer_size,
         .current_len = 0,
-        .overflow = false
+        .overflow = false,
+        .stream = NULL
     };
     
-    esp_http_client_config_t config = {
-        .url = url,
-        .method = (strcmp(method, "GET") == 0) ? HTTP_METHOD_GET : 
-                 (strcmp(method, "POST") == 0) ? HTTP_METHOD_POST : 
-                 (strcmp(method, "PUT") == 0) ? HTTP_METHOD_PUT : 
-                 (strcmp(method, "PATCH") == 0) ? HTTP_METHOD_PATCH : HTTP_METHOD_DELETE,
-        .event_handler = http_event_handler,
-        .user_data = response_buffer ? &user_buffer : NULL,
-        .buffer_size = 4096,    // Increased buffer size
-        .timeout_ms = 20000,    // 20 second timeout
-        .crt_bundle_attach = esp_crt_bundle_attach,
-        .keep_alive_enable = true,
-        .disable_auto_redirect = false
+    return firebase_http_exchange(path, method, data, &user_buffer, policy, op);
+}
+
+// Read a small document, such as a single record, as a string
+bool firebase_get(const char *path, char *response_buffer, size_t response_buffer_size) {
+    return firebase_http_request(path, "GET", NULL, response_buffer, response_buffer_size, &background_policy,
+                                 FIREBASE_LATENCY_SYNC) == ESP_OK;
+}
+
+// GET whose body is tokenized chunk by chunk as it arrives, so peak memory does
+// not depend on the size of the document
+static esp_err_t firebase_http_stream(const char *path, json_stream_t *stream, const retry_policy_t *policy,
+                                      firebase_latency_op_t op) {
+    http_response_buffer_t user_buffer = {
+        .buffer = NULL,
+        .max_len = 0,
+        .current_len = 0,
+        .overflow = false,
+        .stream = stream
     };
     
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+    esp_err_t err = firebase_http_exchange(path, "GET", NULL, &user_buffer, policy, op);
+    if (err == ESP_OK && !json_stream_finish(stream)) {
+        ESP_LOGE(TAG, "Malformed or truncated JSON in streamed response");
+        err = ESP_FAIL;
+    }
+    return err;
+}
+
+// Fields captured from each /rfidApplications record while streaming
+static const char *const application_fields[] = {"rfidUid", "status", "name", "updatedAt"};
+enum { APP_FIELD_RFID, APP_FIELD_STATUS, APP_FIELD_NAME, APP_FIELD_UPDATED_AT, APP_FIELD_COUNT };
+
+// Turn the current streamed application into a card entry if it is an approved card
+static bool application_to_card(const json_stream_t *stream, card_entry_t *entry) {
+    const char *rfid = json_stream_field(stream, APP_FIELD_RFID);
+    const char *status = json_stream_field(stream, APP_FIELD_STATUS);
+    const char *name = json_stream_field(stream, APP_FIELD_NAME);
+    
+    // Only approved cards with a name are allowed through the gate
+    if (rfid == NULL || name == NULL || status == NULL || strcmp(status, "approved") != 0) {
+        return false;
+    }
     
-    // Check if client initialization was successful
-    if (client == NULL) {
-        ESP_LOGE(TAG, "Failed to initialize HTTP client");
-        return ESP_FAIL;
+    // A truncated key would name a different record, so skip it instead
+    size_t key_len = strlen(stream->record_key);
+    if (key_len >= sizeof(entry->user_id)) {
+        return false;
     }
     
-    // Set headers and post data if needed
-    if (data != NULL) {
-        esp_http_client_set_header(client, "Content-Type", "application/json");
-        esp_http_client_set_post_field(client, data, strlen(data));
+    memset(entry, 0, sizeof(card_entry_t));
+    if (!card_uid_key_from_string(rfid, entry->uid)) {
+        return false;
+    }
+    entry->status = CARD_STATUS_APPROVED;
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    memcpy(entry->user_id, stream->record_key, key_len + 1);
+    return true;
+}
+
+// State of a full or delta sync while its response streams in
+typedef struct {
+    card_table_t *table;    // Full sync: table being built
+    int64_t watermark;      // Newest updatedAt seen so far
+    uint32_t changes;       // Delta sync: records applied to the live cache
+    bool incomplete;        // Full sync: a card could not be stored
+} card_sync_ctx_t;
+
+// Raise the watermark to the record's updatedAt (admin app server timestamp)
+static void track_watermark(const json_stream_t *stream, card_sync_ctx_t *sync) {
+    const char *updated_at = json_stream_field(stream, APP_FIELD_UPDATED_AT);
+    if (updated_at) {
+        int64_t value = strtoll(updated_at, NULL, 10);
+        if (value > sync->watermark) {
+            sync->watermark = value;
+        }
+    }
+}
+
+// Streaming callback that adds every approved card to the table being built.
+// Stops at the first card that cannot be stored: a table missing it would turn
+// the card away at every gate
+static bool sync_card_record(json_stream_t *stream, void *ctx) {
+    card_sync_ctx_t *sync = (card_sync_ctx_t *)ctx;
+    card_entry_t entry;
+    
+    if (application_to_card(stream, &entry) && !card_table_put(sync->table, &entry)) {
+        sync->incomplete = true;
+        return false;
+    }
+    track_watermark(stream, sync);
+    return true;
+}
+
+// Streaming callback that applies a changed application to the live cache.
+// Anything no longer approved (rejected or revoked tombstones) drops the card
+static bool delta_card_record(json_stream_t *stream, void *ctx) {
+    card_sync_ctx_t *sync = (card_sync_ctx_t *)ctx;
+    card_entry_t entry;
+    
+    if (application_to_card(stream, &entry)) {
+        card_cache_upsert(&entry);
+    } else {
+        card_cache_remove_user(stream->record_key);
+    }
+    sync->changes++;
+    track_watermark(stream, sync);
+    return true;
+}
+
+// Download /rfidApplications and rebuild the local whitelist of approved cards.
+// The tree is tokenized as it arrives, so its size is bounded only by the table.
+// Firebase only honours ETags on writes, so an unchanged tree is still sent,
+// but it is recognised from the headers and neither parsed nor swapped in.
+// The ETag travels with the table, so it always names the list being served.
+// Called with card_sync_mutex held
+static bool sync_cards_full(void) {
+    char known_etag[CARD_ETAG_SIZE];
+    bool etag_known = card_cache_get_etag(known_etag, sizeof(known_etag));
+    
+    card_table_t *table = card_table_create(CARD_CACHE_CAPACITY);
+    if (table == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate card table");
+        card_sync_stats.failed++;
+        return false;
     }
     
-    // Add retry logic
-    int retry_count = 0;
-    const int max_retries = 3;
-    esp_err_t err = ESP_FAIL;
+    card_sync_ctx_t sync = {
+        .table = table,
+        .watermark = 0,
+        .changes = 0,
+        .incomplete = false
+    };
+    static json_stream_t stream;
+    json_stream_init(&stream, application_fields, APP_FIELD_COUNT, sync_card_record, &sync);
+    
+    http_response_buffer_t user_buffer = {
+        .stream = &stream,
+        .etag = table->etag,
+        .etag_size = sizeof(table->etag),
+        .known_etag = etag_known ? known_etag : NULL,
+        .not_modified = false
+    };
+    
+    esp_err_t err = firebase_http_exchange("/rfidApplications", "GET", NULL, &user_buffer, &background_policy,
+                                           FIREBASE_LATENCY_SYNC);
+    if (err == ESP_OK && !json_stream_finish(&stream)) {
+        ESP_LOGE(TAG, "Malformed or truncated JSON in streamed response");
+        err = ESP_FAIL;
+    }
+    if (err == ESP_OK && sync.incomplete) {
+        err = ESP_ERR_NO_MEM;
+    }
+    if (err != ESP_OK) {
+        // Keep serving the previous whitelist rather than a partial one
+        ESP_LOGE(TAG, "Failed to fetch RFID data for card sync: %s", esp_err_to_name(err));
+        card_table_free(table);
+        card_sync_stats.failed++;
+        return false;
+    }
     
-    while (retry_count < max_retries) {
-        ESP_LOGI(TAG, "Attempting request (attempt %d of %d)", retry_count + 1, max_retries);
+    if (user_buffer.not_modified) {
+        card_table_free(table);
+        card_sync_stats.not_modified++;
+        ESP_LOGI(TAG, "Card list unchanged (%lu not modified, %lu reloaded)",
+                 (unsigned long)card_sync_stats.not_modified, (unsigned long)card_sync_stats.reloaded);
+        return true;
+    }
+    
+    ESP_LOGI(TAG, "Card sync scanned %u applications", (unsigned)stream.records);
+    card_cache_swap(table);
+    card_watermark = sync.watermark;
+    card_sync_stats.reloaded++;
+    return true;
+}
+
+// Full sync, waiting for any sync already running in another task
+bool firebase_sync_cards(void) {
+    xSemaphoreTake(card_sync_mutex, portMAX_DELAY);
+    bool synced = sync_cards_full();
+    xSemaphoreGive(card_sync_mutex);
+    return synced;
+}
+
+// Download only the applications changed since the last sync and apply them
+// to the live cache, so the cost follows the churn rather than the card count.
+// startAt is inclusive, re-applying the records at the watermark is harmless.
+// The query needs the updatedAt index in software/database.rules.json, without
+// it the database refuses the orderBy. Called with card_sync_mutex held
+static bool firebase_sync_cards_delta(void) {
+    card_sync_ctx_t sync = {
+        .table = NULL,
+        .watermark = card_watermark,
+        .changes = 0,
+        .incomplete = false
+    };
+    static json_stream_t stream;
+    json_stream_init(&stream, application_fields, APP_FIELD_COUNT, delta_card_record, &sync);
+    
+    char path[128];
+    snprintf(path, sizeof(path), "/rfidApplications?orderBy=%%22updatedAt%%22&startAt=%lld",
+             (long long)card_watermark);
+    
+    esp_err_t err = firebase_http_stream(path, &stream, &background_policy, FIREBASE_LATENCY_SYNC);
+    if (err != ESP_OK) {
+        // Records applied before the failure stay, the watermark does not move
+        ESP_LOGE(TAG, "Delta card sync failed: %s", esp_err_to_name(err));
+        card_sync_stats.failed++;
+        return false;
+    }
+    
+    card_watermark = sync.watermark;
+    card_sync_stats.deltas++;
+    card_sync_stats.delta_changes += sync.changes;
+    ESP_LOGI(TAG, "Delta card sync applied %lu changes, %u cards cached",
+             (unsigned long)sync.changes, (unsigned)card_cache_count());
+    return true;
+}
+
+// Copy out the whitelist refresh counters
+void firebase_get_card_sync_stats(card_sync_stats_t *stats) {
+    memcpy(stats, &card_sync_stats, sizeof(card_sync_stats_t));
+}
+
+// Periodically refresh the card whitelist while the event stream is down
+static void card_sync_task(void *pvParameter) {
+    while (1) {
+        vTaskDelay(CARD_SYNC_INTERVAL_MS / portTICK_PERIOD_MS);
         
-        // Reset response buffer position before each attempt
-        if (response_buffer) {
-            user_buffer.current_len = 0;
-            user_buffer.overflow = false;
-            response_buffer[0] = '\0';
+        // A cache that failed to store a change is reloaded in full even
+        // while the event stream is up
+        bool complete = card_cache_is_complete();
+        if (card_stream_is_connected() && complete) {
+            continue;
         }
         
-        err = esp_http_client_perform(client);
-        
-        if (err == ESP_OK) {
-            int status_code = esp_http_client_get_status_code(client);
-            ESP_LOGI(TAG, "HTTP request successful with status code: %d", status_code);
-            
-            // Check for successful HTTP status codes (2xx)
-            if (status_code >= 200 && status_code < 300) {
-                break; // Success
-            } else {
-                ESP_LOGW(TAG, "HTTP request returned error status code: %d", status_code);
-                // For client or server errors, we might want to retry
-                retry_count++;
-                vTaskDelay(1000 / portTICK_PERIOD_MS);
-            }
-        } else {
-            ESP_LOGW(TAG, "HTTP request failed: %s. Retrying in 1 second...", esp_err_to_name(err));
-            retry_count++;
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
+        // Deltas by watermark, with a periodic full pass to pick up edits made
+        // outside the admin app (which carry no updatedAt)
+        bool synced = false;
+        xSemaphoreTake(card_sync_mutex, portMAX_DELAY);
+        if (complete && card_watermark > 0 && deltas_since_full < CARD_FULL_SYNC_EVERY) {
+            synced = firebase_sync_cards_delta();
+            deltas_since_full++;
+        }
+        if (!synced) {
+            synced = sync_cards_full();
+            deltas_since_full = 0;
+        }
+        xSemaphoreGive(card_sync_mutex);
+        if (!synced) {
+            ESP_LOGW(TAG, "Background card sync failed, keeping %u cached cards", (unsigned)card_cache_count());
         }
     }
-    
-    // Check for response buffer overflow
-    if (response_buffer && user_buffer.overflow) {
-        ESP_LOGW(TAG, "Response was truncated due to buffer size limitations");
+}
+
+// Look a card up in the local whitelist, no network round trip
+static bool firebase_verify_rfid_cached(const uint8_t *rfid_uid, uint8_t uid_size, user_t *user) {
+    char key[CARD_UID_KEY_LEN + 1];
+    card_entry_t entry;
+    
+    card_uid_key_from_bytes(rfid_uid, uid_size, key);
+    if (!card_cache_lookup(key, &entry) || entry.status != CARD_STATUS_APPROVED) {
+        ESP_LOGE(TAG, "RFID %s not in approved card cache", key);
+        return false;
     }
     
-    // Safe cleanup
-    esp_http_client_cleanup(client);
+    snprintf(user->name, sizeof(user->name), "%s", entry.name);
+    snprintf(user->user_id, sizeof(user->user_id), "%s", entry.user_id);
+    memcpy(user->rfid_uid, rfid_uid, uid_size);
+    user->uid_size = uid_size;
     
-    if (retry_count >= max_retries && err != ESP_OK) {
-        ESP_LOGE(TAG, "HTTP request failed after %d attempts", max_retries);
-    }
-    
-    return err;
+    ESP_LOGI(TAG, "Found valid RFID for user: %s with ID: %s", user->name, user->user_id);
+    return true;
 }
 
-// Improved firebase_verify_rfid function with robust error handling
+// Verify an RFID card, using the local whitelist once it has been loaded
 bool firebase_verify_rfid(const uint8_t *rfid_uid, uint8_t uid_size, user_t *user) {
     if (rfid_uid == NULL || user == NULL || uid_size == 0) {
         ESP_LOGE(TAG, "Invalid parameters for verify_rfid");
         return false;
     }
     
-    // Clear user struct to avoid stale data
-    memset(user, 0, sizeof(user_t));
+    if (card_cache_is_ready()) {
+        memset(user, 0, sizeof(user_t));
+        if (firebase_verify_rfid_cached(rfid_uid, uid_size, user)) {
+            return true;
+        }
+        if (card_cache_is_complete()) {
+            return false;
+        }
+        
+        // A change the cache failed to store may be this card
+        ESP_LOGW(TAG, "Card cache incomplete, checking the card online");
+    }
+    
+    return firebase_verify_rfid_online(rfid_uid, uid_size, user);
+}
+
+// Search state for an online lookup
+typedef struct {
+    char key[CARD_UID_KEY_LEN + 1];
+    user_t *user;
+    bool found;
+} verify_search_t;
+
+// Streaming callback that stops the scan as soon as the card is found
+static bool verify_card_record(json_stream_t *stream, void *ctx) {
+    verify_search_t *search = (verify_search_t *)ctx;
+    card_entry_t entry;
     
-    // Convert RFID UID to string format
+    if (!application_to_card(stream, &entry) || strcmp(entry.uid, search->key) != 0) {
+        return true;
+    }
+    
+    snprintf(search->user->name, sizeof(search->user->name), "%s", entry.name);
+    snprintf(search->user->user_id, sizeof(search->user->user_id), "%s", entry.user_id);
+    search->found = true;
+    return false;
+}
+
+// Read the card's /cardsByUid/{uid} record, which answers both who the card
+// belongs to and whether it is mid-journey. Returns ESP_ERR_NOT_FOUND when the
+// card has no record (unknown, or approved before the record existed)
+static esp_err_t firebase_lookup_card(const uint8_t *rfid_uid, uint8_t uid_size, user_t *user) {
     char uid_string[32] = {0};
     rfid_uid_to_string(rfid_uid, uid_size, uid_string, sizeof(uid_string));
-    ESP_LOGI(TAG, "Looking for RFID: %s", uid_string);
-    
-    // For comparison, ensure we're using the right number of chars for the database format
-    // RFID cards can have different formats - your database may store UIDs in different formats
-    // Using just 8 characters (4 bytes) for comparison
-    char uid_prefix[9] = {0}; // 8 chars + null terminator
-    size_t prefix_len = uid_size > 4 ? 8 : uid_size * 2;
-    strncpy(uid_prefix, uid_string, prefix_len);
-    uid_prefix[prefix_len] = '\0';
-    ESP_LOGI(TAG, "Using RFID prefix for comparison: %s", uid_prefix);
-    
-    // Request the rfidApplications data
+    
     char path[64];
-    snprintf(path, sizeof(path), "/rfidApplications");
+    snprintf(path, sizeof(path), "/cardsByUid/%s", uid_string);
     
-    // Allocate response buffer in heap rather than stack to avoid stack overflow
-    char *response = malloc(8192); // 8KB buffer
-    if (response == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for response buffer");
-        return false;
+    // Status, names and one embedded journey record
+    char response[ACTIVE_JOURNEY_BUFFER_SIZE] = {0};
+    esp_err_t err = firebase_http_request(path, "GET", NULL, response, sizeof(response), &tap_policy,
+                                          FIREBASE_LATENCY_VERIFY);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to fetch card record from Firebase");
+        return err;
     }
-    memset(response, 0, 8192);
     
-    esp_err_t err = firebase_http_request(path, "GET", NULL, response, 8192);
+    cJSON *root = json_arena_parse(response);
+    if (!cJSON_IsObject(root)) {
+        json_arena_release(root);
+        return ESP_ERR_NOT_FOUND;
+    }
     
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to fetch RFID data from Firebase");
-        free(response);
+    cJSON *status = cJSON_GetObjectItem(root, "status");
+    cJSON *name = cJSON_GetObjectItem(root, "name");
+    cJSON *user_id = cJSON_GetObjectItem(root, "userId");
+    bool approved = cJSON_IsString(status) && strcmp(status->valuestring, "approved") == 0 &&
+                    cJSON_IsString(name) && cJSON_IsString(user_id);
+    
+    if (approved) {
+        snprintf(user->name, sizeof(user->name), "%s", name->valuestring);
+        snprintf(user->user_id, sizeof(user->user_id), "%s", user_id->valuestring);
+    }
+    
+    // Remember the journey part for firebase_check_active_journey
+    xSemaphoreTake(firebase_client_mutex, portMAX_DELAY);
+    memset(&tap_card, 0, sizeof(tap_card));
+    snprintf(tap_card.uid, sizeof(tap_card.uid), "%s", uid_string);
+    tap_card.journey_active = parse_active_journey(cJSON_GetObjectItem(root, "activeJourney"), uid_string,
+                                                   rfid_uid, uid_size, &tap_card.journey);
+    tap_card.valid = true;
+    xSemaphoreGive(firebase_client_mutex);
+    
+    json_arena_release(root);
+    return approved ? ESP_OK : ESP_FAIL;
+}
+
+// Online verification used until the card cache is loaded. Reads the card's
+// own record, falling back to streaming /rfidApplications and stopping at the
+// first approved match for cards that have no record
+static bool firebase_verify_rfid_online(const uint8_t *rfid_uid, uint8_t uid_size, user_t *user) {
+    if (rfid_uid == NULL || user == NULL || uid_size == 0) {
+        ESP_LOGE(TAG, "Invalid parameters for verify_rfid");
         return false;
     }
     
-    // Check if response is empty or null
-    if (response[0] == '\0' || strcmp(response, "null") == 0) {
-        ESP_LOGE(TAG, "Empty response or null data");
-        free(response);
+    // Clear user struct to avoid stale data
+    memset(user, 0, sizeof(user_t));
+    
+    esp_err_t err = firebase_lookup_card(rfid_uid, uid_size, user);
+    if (err == ESP_OK) {
+        memcpy(user->rfid_uid, rfid_uid, uid_size);
+        user->uid_size = uid_size;
+        ESP_LOGI(TAG, "Found valid RFID for user: %s with ID: %s", user->name, user->user_id);
+        return true;
+    }
+    if (err != ESP_ERR_NOT_FOUND) {
+        // Record exists but is not approved, or the backend is unreachable
         return false;
     }
     
-    // Parse the JSON response
-    cJSON *root = cJSON_Parse(response);
+    verify_search_t search = {
+        .user = user,
+        .found = false
+    };
+    card_uid_key_from_bytes(rfid_uid, uid_size, search.key);
+    ESP_LOGI(TAG, "Looking for RFID: %s", search.key);
     
-    // We don't need the response buffer anymore since it's parsed
-    free(response);
+    static json_stream_t stream;
+    json_stream_init(&stream, application_fields, APP_FIELD_COUNT, verify_card_record, &search);
     
-    if (root == NULL) {
-        const char *error_ptr = cJSON_GetErrorPtr();
-        ESP_LOGE(TAG, "Failed to parse JSON response. Error: %s", error_ptr ? error_ptr : "Unknown error");
+    err = firebase_http_stream("/rfidApplications", &stream, &tap_policy, FIREBASE_LATENCY_VERIFY);
+    
+    // A hit counts even if the rest of the transfer failed
+    if (!search.found) {
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to fetch RFID data from Firebase");
+        } else {
+            ESP_LOGE(TAG, "RFID not found or not valid");
+        }
         return false;
     }
     
-    bool found = false;
+    // Copy RFID UID
+    memcpy(user->rfid_uid, rfid_uid, uid_size);
+    user->uid_size = uid_size;
+    
+    ESP_LOGI(TAG, "Found valid RFID for user: %s with ID: %s", user->name, user->user_id);
+    return true;
+}
+
+// GET or write one location together with the ETag of its stored copy. With
+// if_match set a write only lands if the stored copy is still that one;
+// otherwise ESP_ERR_INVALID_VERSION is returned with the stored copy in
+// response and its ETag in etag. if_match and etag may be the same buffer
+static esp_err_t firebase_http_conditional(const char *path, const char *method, const char *data,
+                                           const char *if_match, char *response, size_t response_size,
+                                           char *etag, const retry_policy_t *policy, firebase_latency_op_t op) {
+    // etag is cleared before every attempt, so a retry needs its own copy of
+    // the expected ETag
+    char expected[FIREBASE_ETAG_SIZE] = {0};
+    if (if_match) {
+        memcpy(expected, if_match, strnlen(if_match, sizeof(expected) - 1));
+    }
     
-    // Correctly iterate through the rfidApplications - check if it's an object
-    if (cJSON_IsObject(root)) {
-        cJSON *app_id = NULL;
-        cJSON *app_data = NULL;
+    http_response_buffer_t user_buffer = {
+        .buffer = response,
+        .max_len = response_size,
+        .current_len = 0,
+        .overflow = false,
+        .stream = NULL,
+        .etag = etag,
+        .etag_size = FIREBASE_ETAG_SIZE,
+        .if_match = if_match ? expected : NULL
+    };
+    
+    return firebase_http_exchange(path, method, data, &user_buffer, policy, op);
+}
+
+// Event number of a stored journey record, its ticket and start time, 0 when
+// there is none. Records written before eventSeq existed are numbered by their state
+static uint32_t stored_event_seq(const char *response, char *ticket_id, size_t ticket_size,
+                                 time_t *start_timestamp) {
+    uint32_t seq = 0;
+    
+    if (ticket_id) {
+        ticket_id[0] = '\0';
+    }
+    if (start_timestamp) {
+        *start_timestamp = 0;
+    }
+    if (response[0] == '\0' || strcmp(response, "null") == 0) {
+        return 0;
+    }
+    
+    cJSON *root = json_arena_parse(response);
+    cJSON *event_seq = cJSON_GetObjectItem(root, "eventSeq");
+    cJSON *current_state = cJSON_GetObjectItem(root, "currentState");
+    cJSON *stored_ticket = cJSON_GetObjectItem(root, "ticketID");
+    
+    if (cJSON_IsNumber(event_seq)) {
+        seq = (uint32_t)event_seq->valuedouble;
+    } else if (cJSON_IsNumber(current_state)) {
+        seq = current_state->valueint == JOURNEY_STATE_ACTIVE ? JOURNEY_EVENT_SEQ_START : JOURNEY_EVENT_SEQ_END;
+    }
+    if (ticket_id && cJSON_IsString(stored_ticket) && stored_ticket->valuestring) {
+        strncpy(ticket_id, stored_ticket->valuestring, ticket_size - 1);
+        ticket_id[ticket_size - 1] = '\0';
+    }
+    if (start_timestamp) {
+        parse_journey_timestamp(cJSON_GetObjectItem(root, "startTimestamp"), start_timestamp);
+    }
+    
+    json_arena_release(root);
+    return seq;
+}
+
+// Ticket ID held by a stored activeTicketId, a JSON string or null
+static void stored_ticket_id(const char *response, char *ticket_id, size_t ticket_size) {
+    size_t len = 0;
+    
+    if (response[0] == '"') {
+        const char *end = strchr(response + 1, '"');
+        len = end ? (size_t)(end - response - 1) : 0;
+    }
+    if (len >= ticket_size) {
+        len = ticket_size - 1;
+    }
+    memcpy(ticket_id, response + 1, len);
+    ticket_id[len] = '\0';
+}
+
+// Deliver one journey event with conditional writes, for events whose earlier
+// upload may or may not have landed, or that waited behind a failed upload.
+// Each round reads the journey record with its ETag and skips the event if the
+// record already holds it or a later one. It then settles the card's active
+// journey and ticket ID, each written only over the copy it read, and writes
+// the record last. A round that loses a race to another gate starts over from
+// the new copies
+static bool write_journey_conditional(const journey_session_t *journey, const retry_policy_t *policy,
+                                      firebase_latency_op_t op) {
+    // Guarded by journey_buffer_mutex like the batch buffer
+    static char record[JOURNEY_JSON_MAX_LEN + 1];
+    static char response[ACTIVE_JOURNEY_BUFFER_SIZE];
+    static char journey_etag[FIREBASE_ETAG_SIZE];
+    static char card_etag[FIREBASE_ETAG_SIZE];
+    static char ticket_etag[FIREBASE_ETAG_SIZE];
+    
+    uint32_t seq = journey_event_seq(journey);
+    bool active = (journey->current_state == JOURNEY_STATE_ACTIVE);
+    char uid_string[32] = {0};
+    char ticket_id[sizeof(journey->ticket_id)];
+    char journey_path[48];
+    char card_path[80];
+    char ticket_path[80];
+    char ticket_value[sizeof(journey->ticket_id) + 2];
+    
+    if (journey_json_encode(journey, record, sizeof(record)) == 0) {
+        ESP_LOGE(TAG, "Failed to encode journey %s", journey->ticket_id);
+        return false;
+    }
+    rfid_uid_to_string(journey->rfid_uid, journey->uid_size, uid_string, sizeof(uid_string));
+    snprintf(journey_path, sizeof(journey_path), "/journeys/%s", journey->ticket_id);
+    snprintf(card_path, sizeof(card_path), "/cardsByUid/%s/activeJourney", uid_string);
+    snprintf(ticket_path, sizeof(ticket_path), "/cardsByUid/%s/activeTicketId", uid_string);
+    snprintf(ticket_value, sizeof(ticket_value), "\"%s\"", journey->ticket_id);
+    
+    for (int round = 0; round < JOURNEY_CONDITIONAL_ROUNDS; round++) {
+        esp_err_t err = firebase_http_conditional(journey_path, "GET", NULL, NULL, response, sizeof(response),
+                                                  journey_etag, policy, op);
+        if (err != ESP_OK) {
+            return false;
+        }
+        uint32_t stored_seq = stored_event_seq(response, NULL, 0, NULL);
+        if (stored_seq >= seq) {
+            ESP_LOGI(TAG, "Journey %s already holds event %lu, event %lu skipped", journey->ticket_id,
+                     (unsigned long)stored_seq, (unsigned long)seq);
+            return true;
+        }
         
-        // Iterate through all child objects
-        cJSON_ArrayForEach(app_data, root) {
-            // Get the application ID (key)
-            const char *id_str = app_data->string;
-            if (id_str == NULL) {
-                ESP_LOGW(TAG, "Application without ID, skipping");
+        // A start points the card at this ticket unless a journey started after
+        // it holds the card by now; an end clears the pointer only while it
+        // still points here, never a later journey's
+        err = firebase_http_conditional(card_path, "GET", NULL, NULL, response, sizeof(response),
+                                        card_etag, policy, op);
+        if (err != ESP_OK) {
+            return false;
+        }
+        time_t stored_start;
+        stored_event_seq(response, ticket_id, sizeof(ticket_id), &stored_start);
+        bool points_here = strcmp(ticket_id, journey->ticket_id) == 0;
+        bool superseded = !points_here && ticket_id[0] != '\0' && stored_start > journey->start_timestamp;
+        
+        if (active ? (!points_here && !superseded) : points_here) {
+            err = firebase_http_conditional(card_path, active ? "PUT" : "DELETE", active ? record : NULL, card_etag,
+                                            response, sizeof(response), card_etag, policy, op);
+            if (err == ESP_ERR_INVALID_VERSION) {
                 continue;
             }
-            
-            ESP_LOGI(TAG, "Checking application ID: %s", id_str);
-            
-            // Get application properties
-            cJSON *stored_rfid = cJSON_GetObjectItem(app_data, "rfidUid");
-            cJSON *status = cJSON_GetObjectItem(app_data, "status");
-            
-            // Check if stored_rfid exists and is a string
-            if (stored_rfid && cJSON_IsString(stored_rfid) && stored_rfid->valuestring != NULL) {
-                ESP_LOGI(TAG, "Comparing RFID prefix: %s with stored: %s", uid_prefix, stored_rfid->valuestring);
-                
-                // Safer comparison: check if our UID prefix appears in the stored RFID
-                // This allows for different RFID formats (e.g. with or without checksum bytes)
-                if (strstr(stored_rfid->valuestring, uid_prefix) != NULL) {
-                    ESP_LOGI(TAG, "RFID match found!");
-                    
-                    // Check if approved (if status field exists)
-                    if (status && cJSON_IsString(status) && status->valuestring != NULL) {
-                        ESP_LOGI(TAG, "Application status: %s", status->valuestring);
-                        if (strcmp(status->valuestring, "approved") != 0) {
-                            ESP_LOGW(TAG, "RFID found but not approved");
-                            continue;  // Skip non-approved RFIDs
-                        }
-                    }
-                    
-                    // Get user details
-                    cJSON *name = cJSON_GetObjectItem(app_data, "name");
-                    
-                    if (name && cJSON_IsString(name) && name->valuestring != NULL) {
-                        // Copy user data with bounds checking
-                        strncpy(user->name, name->valuestring, sizeof(user->name) - 1);
-                        user->name[sizeof(user->name) - 1] = '\0';
-                        
-                        // Use the application ID as user_id
-                        strncpy(user->user_id, id_str, sizeof(user->user_id) - 1);
-                        user->user_id[sizeof(user->user_id) - 1] = '\0';
-                        
-                        // Copy RFID UID
-                        memcpy(user->rfid_uid, rfid_uid, uid_size);
-                        user->uid_size = uid_size;
-                        
-                        ESP_LOGI(TAG, "Found valid RFID for user: %s with ID: %s", user->name, user->user_id);
-                        found = true;
-                        break;
-                    }
-                }
+            if (err != ESP_OK) {
+                return false;
             }
         }
-    } else {
-        ESP_LOGE(TAG, "Root JSON is not an object");
+        if (active && superseded) {
+            ESP_LOGI(TAG, "Card of journey %s has moved on to %s, pointer left alone", journey->ticket_id,
+                     ticket_id);
+        }
+        
+        // The ticket ID mirrors the pointer, which taps read. A start sets it
+        // and an end clears it while it names this ticket; a ticket an earlier
+        // round failed to write is put right here. Another ticket is only
+        // replaced once the pointer is confirmed to be this journey's
+        err = firebase_http_conditional(ticket_path, "GET", NULL, NULL, response, sizeof(response),
+                                        ticket_etag, policy, op);
+        if (err != ESP_OK) {
+            return false;
+        }
+        stored_ticket_id(response, ticket_id, sizeof(ticket_id));
+        bool ticket_here = strcmp(ticket_id, journey->ticket_id) == 0;
+        
+        if (active && !superseded && !ticket_here && ticket_id[0] != '\0') {
+            err = firebase_http_conditional(card_path, "GET", NULL, NULL, response, sizeof(response),
+                                            card_etag, policy, op);
+            if (err != ESP_OK) {
+                return false;
+            }
+            stored_event_seq(response, ticket_id, sizeof(ticket_id), NULL);
+            if (strcmp(ticket_id, journey->ticket_id) != 0) {
+                continue;
+            }
+        }
+        if (active ? (!superseded && !ticket_here) : ticket_here) {
+            err = firebase_http_conditional(ticket_path, active ? "PUT" : "DELETE", active ? ticket_value : NULL,
+                                            ticket_etag, response, sizeof(response), ticket_etag, policy, op);
+            if (err == ESP_ERR_INVALID_VERSION) {
+                continue;
+            }
+            if (err != ESP_OK) {
+                return false;
+            }
+        }
+        
+        // The journey record goes last: once it holds the event, so does the card
+        err = firebase_http_conditional(journey_path, "PUT", record, journey_etag, response, sizeof(response),
+                                        journey_etag, policy, op);
+        if (err == ESP_OK) {
+            ESP_LOGI(TAG, "Journey %s event %lu written conditionally", journey->ticket_id, (unsigned long)seq);
+            return true;
+        }
+        if (err != ESP_ERR_INVALID_VERSION) {
+            return false;
+        }
     }
     
-    // Clean up
-    cJSON_Delete(root);
+    ESP_LOGW(TAG, "Journey %s kept changing, event %lu left for a later upload", journey->ticket_id,
+             (unsigned long)seq);
+    return false;
+}
+
+// Write journey events to Firebase, in log order, and return how many of them
+// are stored. They normally go in a single multi-path PATCH on the database
+// root: an active journey together with this card's active journey pointer, a
+// finished one replacing the record and deleting the pointer, all atomically.
+// That PATCH is attempted once. A write that timed out may still have landed,
+// and sending it again blindly could undo a later event another gate wrote
+// meanwhile. An event held back by failed uploads is as risky: the card may
+// have started a later journey elsewhere in the meantime. Those events (resend,
+// or a failed PATCH) are settled one by one with conditional writes instead
+static size_t write_journeys(const journey_session_t *journeys, size_t count, bool resend,
+                             const retry_policy_t *policy, firebase_latency_op_t op) {
+    // Compact body encoded in place, no heap use and a fixed upper bound
+    static char update_buffer[OUTBOX_BATCH_SIZE * JOURNEY_JSON_UPDATE_MAX_LEN + 2];
+    
+    if (journeys == NULL || count == 0) {
+        ESP_LOGE(TAG, "Invalid journey parameter");
+        return 0;
+    }
+    
+    xSemaphoreTake(journey_buffer_mutex, portMAX_DELAY);
     
-    if (!found) {
-        ESP_LOGE(TAG, "RFID not found or not valid");
+    if (!resend) {
+        // Events are in log order, so the newest state of each path wins
+        size_t len = journey_json_encode_updates(journeys, count, update_buffer, sizeof(update_buffer));
+        if (len == 0) {
+            xSemaphoreGive(journey_buffer_mutex);
+            ESP_LOGE(TAG, "Failed to encode %u journey events", (unsigned)count);
+            return 0;
+        }
+        ESP_LOGD(TAG, "Encoded %u journey events into %u bytes", (unsigned)count, (unsigned)len);
+        
+        retry_policy_t once = *policy;
+        once.max_attempts = 1;
+        if (firebase_http_request("", "PATCH", update_buffer, NULL, 0, &once, op) == ESP_OK) {
+            xSemaphoreGive(journey_buffer_mutex);
+            return count;
+        }
+        ESP_LOGW(TAG, "Batch of %u journey events unconfirmed, writing them conditionally", (unsigned)count);
+    }
+    
+    size_t written = 0;
+    while (written < count && write_journey_conditional(&journeys[written], policy, op)) {
+        written++;
+    }
+    xSemaphoreGive(journey_buffer_mutex);
+    
+    if (written < count) {
+        ESP_LOGE(TAG, "Failed to save %u of %u journey events to Firebase", (unsigned)(count - written),
+                 (unsigned)count);
+    }
+    return written;
+}
+
+// Write a batch of journey events (used by the outbox uploader). resend marks
+// events that were sent before without an answer or waited behind a failed upload
+size_t firebase_write_journeys(const journey_session_t *journeys, size_t count, bool resend) {
+    return write_journeys(journeys, count, resend, &background_policy, FIREBASE_LATENCY_UPLOAD);
+}
+
+// Write a single journey record to Firebase while the passenger waits
+bool firebase_write_journey(const journey_session_t *journey) {
+    return write_journeys(journey, 1, false, &tap_policy,
+                          journey->current_state == JOURNEY_STATE_ACTIVE ? FIREBASE_LATENCY_START : FIREBASE_LATENCY_END) == 1;
+}
+
+// Record a journey event. The event is confirmed as soon as it is durable in
+// the outbox, which uploads it in the background; without an outbox partition
+// the record is written to Firebase directly
+static bool record_journey_event(outbox_event_t type, const journey_session_t *journey) {
+    esp_err_t err = journey_outbox_append(type, journey);
+    if (err == ESP_OK) {
+        return true;
     }
     
-    return found;
+    ESP_LOGW(TAG, "Outbox append failed (%s), writing journey directly", esp_err_to_name(err));
+    return firebase_write_journey(journey);
 }
 
 // Start a new journey session with improved error handling
@@ -401,159 +1536,140 @@ bool firebase_start_journey(journey_session_t *journey) {
     journey->is_fraud_suspected = false;
     journey->travel_duration = 0;
     
-    // Create JSON for Firebase with proper error handling
-    char rfid_string[32] = {0};
-    rfid_uid_to_string(journey->rfid_uid, journey->uid_size, rfid_string, sizeof(rfid_string));
+    if (record_journey_event(OUTBOX_EVENT_START_JOURNEY, journey)) {
+        // Store the active journey
+        memcpy(&active_journey, journey, sizeof(journey_session_t));
+        journey_active = true;
+        
+        ESP_LOGI(TAG, "Journey started successfully. Ticket ID: %s", journey->ticket_id);
+        return true;
+    } else {
+        ESP_LOGE(TAG, "Failed to save journey");
+        return false;
+    }
+}
+
+// Fill journey from a stored journey record if it is the active journey of this RFID
+static bool parse_active_journey(const cJSON *journey_item, const char *uid_string,
+                                 const uint8_t *rfid_uid, uint8_t uid_size, journey_session_t *journey) {
+    if (!cJSON_IsObject(journey_item)) {
+        return false;
+    }
     
-    char timestamp_str[32] = {0};
-    format_timestamp(journey->start_timestamp, timestamp_str, sizeof(timestamp_str));
+    cJSON *stored_rfid = cJSON_GetObjectItem(journey_item, "rfidUid");
+    cJSON *current_state = cJSON_GetObjectItem(journey_item, "currentState");
     
-    // Use cJSON for more reliable JSON creation
-    cJSON *journey_json = cJSON_CreateObject();
-    if (journey_json == NULL) {
-        ESP_LOGE(TAG, "Failed to create JSON object");
+    if (!(stored_rfid && cJSON_IsString(stored_rfid) && stored_rfid->valuestring &&
+          current_state && cJSON_IsNumber(current_state))) {
         return false;
     }
     
-    // Add all journey properties
-    cJSON_AddStringToObject(journey_json, "ticketID", journey->ticket_id);
-    cJSON_AddStringToObject(journey_json, "rfidUid", rfid_string);
-    cJSON_AddStringToObject(journey_json, "startTimestamp", timestamp_str);
-    cJSON_AddNumberToObject(journey_json, "originStation", journey->origin_station);
-    cJSON_AddNumberToObject(journey_json, "selectedClass", journey->selected_class);
-    cJSON_AddNumberToObject(journey_json, "selectedDestinationStation", journey->selected_destination);
-    cJSON_AddNumberToObject(journey_json, "currentState", journey->current_state);
-    
-    // Convert to string
-    char *json_str = cJSON_Print(journey_json);
-    cJSON_Delete(journey_json);
+    if (strcmp(stored_rfid->valuestring, uid_string) != 0 || 
+        current_state->valueint != JOURNEY_STATE_ACTIVE) {
+        return false;
+    }
     
-    if (json_str == NULL) {
-        ESP_LOGE(TAG, "Failed to convert JSON to string");
+    cJSON *ticket_id = cJSON_GetObjectItem(journey_item, "ticketID");
+    cJSON *start_timestamp = cJSON_GetObjectItem(journey_item, "startTimestamp");
+    cJSON *origin_station = cJSON_GetObjectItem(journey_item, "originStation");
+    cJSON *selected_class = cJSON_GetObjectItem(journey_item, "selectedClass");
+    cJSON *selected_destination = cJSON_GetObjectItem(journey_item, "selectedDestinationStation");
+    time_t start_time;
+    
+    if (!(ticket_id && cJSON_IsString(ticket_id) && ticket_id->valuestring &&
+          parse_journey_timestamp(start_timestamp, &start_time) &&
+          origin_station && cJSON_IsNumber(origin_station) &&
+          selected_class && cJSON_IsNumber(selected_class) &&
+          selected_destination && cJSON_IsNumber(selected_destination))) {
         return false;
     }
     
-    // Save to Firebase
-    char path[64];
-    snprintf(path, sizeof(path), "/journeys/%s", journey->ticket_id);
+    // Copy journey data with proper bounds checking
+    strncpy(journey->ticket_id, ticket_id->valuestring, sizeof(journey->ticket_id) - 1);
+    journey->ticket_id[sizeof(journey->ticket_id) - 1] = '\0';
     
-    esp_err_t err = firebase_http_request(path, "PUT", json_str, NULL, 0);
+    memcpy(journey->rfid_uid, rfid_uid, uid_size);
+    journey->uid_size = uid_size;
+    journey->start_timestamp = start_time;
     
-    // Free the JSON string
-    free(json_str);
+    journey->origin_station = origin_station->valueint;
+    journey->selected_class = selected_class->valueint;
+    journey->selected_destination = selected_destination->valueint;
+    journey->current_state = JOURNEY_STATE_ACTIVE;
     
-    if (err == ESP_OK) {
-        // Store the active journey
-        memcpy(&active_journey, journey, sizeof(journey_session_t));
-        journey_active = true;
-        
-        ESP_LOGI(TAG, "Journey started successfully. Ticket ID: %s", journey->ticket_id);
-        return true;
-    } else {
-        ESP_LOGE(TAG, "Failed to save journey to Firebase");
-        return false;
-    }
+    return true;
 }
 
-// Check if there is an active journey for this RFID with improved error handling
-bool firebase_check_active_journey(const uint8_t *rfid_uid, uint8_t uid_size, journey_session_t *journey) {
+// Check if there is an active journey for this RFID. Reads the active journey
+// embedded in the card's /cardsByUid/{uid} record, so the cost does not grow
+// with journey history. ESP_OK fills in journey, ESP_ERR_NOT_FOUND means there
+// is none, anything else that the lookup failed and the answer is unknown
+esp_err_t firebase_check_active_journey(const uint8_t *rfid_uid, uint8_t uid_size, journey_session_t *journey) {
     if (rfid_uid == NULL || journey == NULL || uid_size == 0) {
         ESP_LOGE(TAG, "Invalid parameters for check_active_journey");
-        return false;
+        return ESP_ERR_INVALID_ARG;
     }
     
     // Clear journey struct to avoid stale data
     memset(journey, 0, sizeof(journey_session_t));
     
+    // Events this gate has logged but not uploaded yet are newer than anything
+    // on the server
+    if (journey_outbox_find_latest(rfid_uid, uid_size, journey)) {
+        bool active = (journey->current_state == JOURNEY_STATE_ACTIVE);
+        ESP_LOGI(TAG, "Using pending outbox event for ticket %s", journey->ticket_id);
+        if (!active) {
+            memset(journey, 0, sizeof(journey_session_t));
+        }
+        return active ? ESP_OK : ESP_ERR_NOT_FOUND;
+    }
+    
     char uid_string[32] = {0};
     rfid_uid_to_string(rfid_uid, uid_size, uid_string, sizeof(uid_string));
     
-    // Create query to find active journeys for this RFID
-    char path[128];
-    snprintf(path, sizeof(path), "/journeys");
-    
-    // Allocate response buffer in heap
-    char *response = malloc(8192);
-    if (response == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate memory for response buffer");
-        return false;
+    // Already answered by the card record read during verification
+    xSemaphoreTake(firebase_client_mutex, portMAX_DELAY);
+    bool memo_hit = tap_card.valid && strcmp(tap_card.uid, uid_string) == 0;
+    bool memo_active = memo_hit && tap_card.journey_active;
+    if (memo_active) {
+        memcpy(journey, &tap_card.journey, sizeof(journey_session_t));
+    }
+    xSemaphoreGive(firebase_client_mutex);
+    if (memo_hit) {
+        ESP_LOGI(TAG, "Active journey answered by card record");
+        return memo_active ? ESP_OK : ESP_ERR_NOT_FOUND;
     }
-    memset(response, 0, 8192);
     
-    esp_err_t err = firebase_http_request(path, "GET", NULL, response, 8192);
+    char path[80];
+    snprintf(path, sizeof(path), "/cardsByUid/%s/activeJourney", uid_string);
+    
+    // A single journey record always fits in a small buffer
+    char response[ACTIVE_JOURNEY_BUFFER_SIZE] = {0};
+    
+    esp_err_t err = firebase_http_request(path, "GET", NULL, response, sizeof(response), &tap_policy,
+                                          FIREBASE_LATENCY_CHECK);
     
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to fetch journeys data from Firebase");
-        free(response);
-        return false;
+        ESP_LOGE(TAG, "Failed to fetch active journey from Firebase");
+        return err;
     }
     
-    // Parse the response using cJSON
-    cJSON *root = cJSON_Parse(response);
-    free(response); // Free response after parsing
+    // No embedded record means no active journey
+    if (response[0] == '\0' || strcmp(response, "null") == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
     
+    cJSON *root = json_arena_parse(response);
     if (root == NULL) {
+        json_arena_release(root);
         ESP_LOGE(TAG, "Failed to parse JSON response");
-        return false;
+        return ESP_ERR_INVALID_RESPONSE;
     }
     
-    bool found = false;
-    
-    // Iterate through journeys to find active ones for this RFID
-    if (cJSON_IsObject(root)) {
-        cJSON *journey_item = NULL;
-        
-        cJSON_ArrayForEach(journey_item, root) {
-            if (!cJSON_IsObject(journey_item)) continue;
-            
-            cJSON *stored_rfid = cJSON_GetObjectItem(journey_item, "rfidUid");
-            cJSON *current_state = cJSON_GetObjectItem(journey_item, "currentState");
-            
-            if (stored_rfid && cJSON_IsString(stored_rfid) && stored_rfid->valuestring &&
-                current_state && cJSON_IsNumber(current_state)) {
-                
-                if (strcmp(stored_rfid->valuestring, uid_string) == 0 && 
-                    current_state->valueint == JOURNEY_STATE_ACTIVE) {
-                    
-                    // Found an active journey for this RFID
-                    cJSON *ticket_id = cJSON_GetObjectItem(journey_item, "ticketID");
-                    cJSON *start_timestamp_str = cJSON_GetObjectItem(journey_item, "startTimestamp");
-                    cJSON *origin_station = cJSON_GetObjectItem(journey_item, "originStation");
-                    cJSON *selected_class = cJSON_GetObjectItem(journey_item, "selectedClass");
-                    cJSON *selected_destination = cJSON_GetObjectItem(journey_item, "selectedDestinationStation");
-                    
-                    if (ticket_id && cJSON_IsString(ticket_id) && ticket_id->valuestring &&
-                        start_timestamp_str && cJSON_IsString(start_timestamp_str) && start_timestamp_str->valuestring &&
-                        origin_station && cJSON_IsNumber(origin_station) &&
-                        selected_class && cJSON_IsNumber(selected_class) &&
-                        selected_destination && cJSON_IsNumber(selected_destination)) {
-                        
-                        // Copy journey data with proper bounds checking
-                        strncpy(journey->ticket_id, ticket_id->valuestring, sizeof(journey->ticket_id) - 1);
-                        journey->ticket_id[sizeof(journey->ticket_id) - 1] = '\0';
-                        
-                        memcpy(journey->rfid_uid, rfid_uid, uid_size);
-                        journey->uid_size = uid_size;
-                        
-                        // TODO: Parse timestamp string to time_t
-                        // For now, just use current time
-                        journey->start_timestamp = get_current_timestamp();
-                        
-                        journey->origin_station = origin_station->valueint;
-                        journey->selected_class = selected_class->valueint;
-                        journey->selected_destination = selected_destination->valueint;
-                        journey->current_state = JOURNEY_STATE_ACTIVE;
-                        
-                        found = true;
-                        break;
-                    }
-                }
-            }
-        }
-    }
+    bool found = parse_active_journey(root, uid_string, rfid_uid, uid_size, journey);
     
-    cJSON_Delete(root);
-    return found;
+    json_arena_release(root);
+    return found ? ESP_OK : ESP_ERR_NOT_FOUND;
 }
 
 // End a journey session with improved error handling
@@ -566,8 +1682,11 @@ bool firebase_end_journey(journey_session_t *journey) {
     // Set end timestamp
     journey->end_timestamp = get_current_timestamp();
     
-    // Calculate travel duration
-    journey->travel_duration = journey->end_timestamp - journey->start_timestamp;
+    // Calculate travel duration, unless the journey started before the clock was set
+    journey->travel_duration = 0;
+    if (journey->start_timestamp >= FIREBASE_CLOCK_VALID_AFTER && journey->end_timestamp >= journey->start_timestamp) {
+        journey->travel_duration = journey->end_timestamp - journey->start_timestamp;
+    }
     
     // Check if fraud is suspected (actual destination != selected destination)
     journey->is_fraud_suspected = (journey->actual_destination != journey->selected_destination);
@@ -575,55 +1694,7 @@ bool firebase_end_journey(journey_session_t *journey) {
     // Set journey state to inactive
     journey->current_state = JOURNEY_STATE_INACTIVE;
     
-    // Use cJSON for reliable JSON creation
-    cJSON *journey_json = cJSON_CreateObject();
-    if (journey_json == NULL) {
-        ESP_LOGE(TAG, "Failed to create JSON object");
-        return false;
-    }
-    
-    // Format timestamps
-    char rfid_string[32] = {0};
-    rfid_uid_to_string(journey->rfid_uid, journey->uid_size, rfid_string, sizeof(rfid_string));
-    
-    char start_timestamp_str[32] = {0};
-    format_timestamp(journey->start_timestamp, start_timestamp_str, sizeof(start_timestamp_str));
-    
-    char end_timestamp_str[32] = {0};
-    format_timestamp(journey->end_timestamp, end_timestamp_str, sizeof(end_timestamp_str));
-    
-    // Add all journey properties
-    cJSON_AddStringToObject(journey_json, "ticketID", journey->ticket_id);
-    cJSON_AddStringToObject(journey_json, "rfidUid", rfid_string);
-    cJSON_AddStringToObject(journey_json, "startTimestamp", start_timestamp_str);
-    cJSON_AddStringToObject(journey_json, "endTimestamp", end_timestamp_str);
-    cJSON_AddNumberToObject(journey_json, "originStation", journey->origin_station);
-    cJSON_AddNumberToObject(journey_json, "selectedClass", journey->selected_class);
-    cJSON_AddNumberToObject(journey_json, "selectedDestinationStation", journey->selected_destination);
-    cJSON_AddNumberToObject(journey_json, "actualDestinationStation", journey->actual_destination);
-    cJSON_AddNumberToObject(journey_json, "travelDuration", journey->travel_duration);
-    cJSON_AddBoolToObject(journey_json, "isFraudSuspected", journey->is_fraud_suspected);
-    cJSON_AddNumberToObject(journey_json, "currentState", journey->current_state);
-    
-    // Convert to string
-    char *json_str = cJSON_Print(journey_json);
-    cJSON_Delete(journey_json);
-    
-    if (json_str == NULL) {
-        ESP_LOGE(TAG, "Failed to convert JSON to string");
-        return false;
-    }
-    
-    // Update in Firebase
-    char path[64];
-    snprintf(path, sizeof(path), "/journeys/%s", journey->ticket_id);
-    
-    esp_err_t err = firebase_http_request(path, "PUT", json_str, NULL, 0);
-    
-    // Free the JSON string
-    free(json_str);
-    
-    if (err == ESP_OK) {
+    if (record_journey_event(OUTBOX_EVENT_END_JOURNEY, journey)) {
         // Clear active journey
         journey_active = false;
         memset(&active_journey, 0, sizeof(journey_session_t));
@@ -631,7 +1702,7 @@ bool firebase_end_journey(journey_session_t *journey) {
         ESP_LOGI(TAG, "Journey ended successfully. Ticket ID: %s", journey->ticket_id);
         return true;
     } else {
-        ESP_LOGE(TAG, "Failed to update journey in Firebase");
+        ESP_LOGE(TAG, "Failed to update journey");
         return false;
     }
-}
\ No newline at end of file
+}
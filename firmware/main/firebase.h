@@ -6,8 +6,35 @@
 #include <time.h>
 
 // Firebase configuration - replace with your values
+// (the host build points FIREBASE_HOST at the local stand-in, see firmware/host)
+#ifndef FIREBASE_HOST
 #define FIREBASE_HOST "https://smartrailwaypayment-default-rtdb.firebaseio.com/"
+#endif
+#ifndef FIREBASE_AUTH
 #define FIREBASE_AUTH "UuzOpxm3OBREHbeZxf7r3fdxKZaKLJfuLeoOGNBd"
+#endif
+
+// Device times before this (2024-01-01) come from a clock that was never set
+#define FIREBASE_CLOCK_VALID_AFTER 1704067200
+
+// Longest single request attempt, further capped by the operation's deadline
+#define FIREBASE_ATTEMPT_TIMEOUT_MS 20000
+
+// How often a background request waiting for the connection checks whether
+// the taps it stepped aside for are done
+#define FIREBASE_PRIORITY_YIELD_MS 10
+
+// Card whitelist sync settings
+#define CARD_SYNC_INTERVAL_MS 60000     // Fallback refresh period while the card stream is down
+#define FIREBASE_ETAG_SIZE 64           // Longest ETag kept for conditional writes
+#define CARD_FULL_SYNC_EVERY 30         // Delta syncs between full ones (needs ".indexOn": "updatedAt")
+
+// Response buffer for a single /activeJourneys/{uid} record
+#define ACTIVE_JOURNEY_BUFFER_SIZE 1024
+
+// Read-compare-write rounds for one journey event before the upload is retried
+// later, each round lost to a concurrent write from another gate
+#define JOURNEY_CONDITIONAL_ROUNDS 3
 
 // Journey states
 typedef enum {
@@ -35,24 +62,97 @@ typedef struct {
     uint8_t selected_destination;
     uint8_t actual_destination;
     uint32_t travel_duration;
+    uint16_t fare;               // Rupees charged, priced by the gate before the journey is ended
     bool is_fraud_suspected;
     journey_state_t current_state;
 } journey_session_t;
 
-// HTTP response buffer structure
+// Connection statistics for the persistent Firebase session
+typedef struct {
+    uint32_t taps;         // Taps bracketed by firebase_tap_begin/end
+    uint32_t requests;     // HTTP requests issued
+    uint32_t handshakes;   // New TCP + TLS connections opened
+    uint32_t resumed_handshakes;   // Of those, handshakes offering a saved TLS session ticket
+    uint64_t full_handshake_us;    // Time to connect with a full handshake
+    uint64_t resumed_handshake_us; // Time to connect with an abbreviated handshake
+    uint32_t reused;       // Requests served on an already open connection
+    uint32_t reconnects;   // Connections dropped and reopened after an error
+} firebase_session_stats_t;
+
+// Heap use around taps, to confirm the tap path makes no heap allocations
+typedef struct {
+    uint32_t free_bytes;          // Free heap after the last tap
+    int32_t tap_delta;            // Change in free heap over the last tap, all tasks included
+    uint32_t minimum_free_bytes;  // Lowest free heap since boot
+    uint32_t largest_free_block;  // Largest block that could be allocated after the last tap
+} firebase_heap_stats_t;
+
+// Operations whose requests are timed separately
+typedef enum {
+    FIREBASE_LATENCY_VERIFY,    // Card record read on a tap
+    FIREBASE_LATENCY_CHECK,     // Active journey read on a tap
+    FIREBASE_LATENCY_START,     // Journey start written while the passenger waits
+    FIREBASE_LATENCY_END,       // Journey end written while the passenger waits
+    FIREBASE_LATENCY_UPLOAD,    // Outbox batch upload
+    FIREBASE_LATENCY_SYNC,      // Card whitelist refresh
+    FIREBASE_LATENCY_OP_COUNT
+} firebase_latency_op_t;
+
+// Phases of a request. The HTTP client only reports when a connection is up,
+// so DNS, TCP and TLS are timed together as connect
+typedef enum {
+    FIREBASE_PHASE_QUEUE,    // Waiting for the shared connection
+    FIREBASE_PHASE_CONNECT,  // Opening a connection; reused connections add no sample
+    FIREBASE_PHASE_SEND,     // Writing the request line and headers
+    FIREBASE_PHASE_WAIT,     // Writing the body and waiting for the first response header
+    FIREBASE_PHASE_BODY,     // First response header until the response is complete
+    FIREBASE_PHASE_TOTAL,    // Whole call, retries and backoff included
+    FIREBASE_PHASE_COUNT
+} firebase_phase_t;
+
+// Bucket 0 counts samples under FIREBASE_LATENCY_BUCKET0_US and each further
+// bucket doubles the bound; the last one takes everything slower (> 4.2 s)
+#define FIREBASE_LATENCY_BUCKETS 16
+#define FIREBASE_LATENCY_BUCKET0_US 256
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[FIREBASE_LATENCY_BUCKETS];
+} firebase_latency_histogram_t;
+
+typedef struct {
+    firebase_latency_histogram_t phases[FIREBASE_PHASE_COUNT];
+} firebase_latency_stats_t;
+
+// Card whitelist refresh counters
 typedef struct {
-    char *buffer;        // Pointer to the buffer
-    size_t max_len;      // Maximum length of the buffer
-    size_t current_len;  // Current length of data in buffer
-    bool overflow;       // Flag to indicate if buffer overflowed
-} http_response_buffer_t;
+    uint32_t reloaded;     // Refreshes that rebuilt the cache
+    uint32_t not_modified; // Refreshes skipped because the ETag was unchanged
+    uint32_t failed;       // Refreshes that failed, the previous cache was kept
+    uint32_t deltas;       // Delta refreshes by updatedAt watermark
+    uint32_t delta_changes; // Applications applied by delta refreshes
+} card_sync_stats_t;
 
 // Function declarations
 void firebase_init(void);
+void firebase_tap_begin(void);
+void firebase_tap_end(void);
+void firebase_get_session_stats(firebase_session_stats_t *total, firebase_session_stats_t *last_tap);
+void firebase_get_heap_stats(firebase_heap_stats_t *stats);
+void firebase_get_latency_stats(firebase_latency_op_t op, firebase_latency_stats_t *stats);
+uint32_t firebase_latency_percentile_us(const firebase_latency_histogram_t *histogram, uint32_t percent);
+const char *firebase_latency_op_name(firebase_latency_op_t op);
+const char *firebase_phase_name(firebase_phase_t phase);
 bool firebase_verify_rfid(const uint8_t *rfid_uid, uint8_t uid_size, user_t *user);
+bool firebase_sync_cards(void);
+void firebase_get_card_sync_stats(card_sync_stats_t *stats);
+bool firebase_get(const char *path, char *response_buffer, size_t response_buffer_size);
 bool firebase_start_journey(journey_session_t *journey);
-bool firebase_check_active_journey(const uint8_t *rfid_uid, uint8_t uid_size, journey_session_t *journey);
 bool firebase_end_journey(journey_session_t *journey);
+bool firebase_write_journey(const journey_session_t *journey);
+size_t firebase_write_journeys(const journey_session_t *journeys, size_t count, bool resend);
 void generate_ticket_id(char *ticket_id, size_t size);
 void rfid_uid_to_string(const uint8_t *uid, uint8_t size, char *output, size_t output_size);
 time_t get_current_timestamp(void);
@@ -0,0 +1,187 @@
+#include "firebase_async.h"
+#include "esp_log.h"
+#include "freertos/queue.h"
+#include <string.h>
+
+static const char *TAG = "FIREBASE_ASYNC";
+
+static QueueHandle_t request_queue = NULL;
+static TaskHandle_t worker_task_handle = NULL;
+
+// Run queued requests one after another; the blocking calls never hold up
+// the caller's UI loop
+static void firebase_worker_task(void *pvParameter) {
+    firebase_async_t *request;
+
+    while (1) {
+        if (xQueueReceive(request_queue, &request, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        switch (request->op) {
+            case FIREBASE_OP_VERIFY_RFID:
+                request->result = firebase_verify_rfid(request->rfid_uid, request->uid_size, request->user);
+                break;
+            case FIREBASE_OP_SYNC_CARDS:
+                request->result = firebase_sync_cards();
+                break;
+            case FIREBASE_OP_CHECK_ACTIVE_JOURNEY:
+                request->err = firebase_check_active_journey(request->rfid_uid, request->uid_size, request->journey);
+                request->result = (request->err == ESP_OK);
+                break;
+            case FIREBASE_OP_START_JOURNEY:
+                request->result = firebase_start_journey(request->journey);
+                break;
+            case FIREBASE_OP_END_JOURNEY:
+                request->result = firebase_end_journey(request->journey);
+                break;
+            case FIREBASE_OP_WRITE_JOURNEY:
+                request->result = firebase_write_journey(request->journeys);
+                break;
+            case FIREBASE_OP_WRITE_JOURNEYS:
+                request->result = firebase_write_journeys(request->journeys, request->journey_count, false) ==
+                                  request->journey_count;
+                break;
+            default:
+                ESP_LOGE(TAG, "Unknown request type %d", request->op);
+                request->result = false;
+                break;
+        }
+
+        // Copy what is needed before completing: the owner may reuse the
+        // struct as soon as pending drops
+        firebase_async_cb_t on_done = request->on_done;
+        void *ctx = request->ctx;
+        TaskHandle_t waiter = request->waiter;
+
+        if (on_done) {
+            on_done(request, ctx);
+        }
+        request->pending = false;
+        if (waiter) {
+            xTaskNotifyGive(waiter);
+        }
+    }
+}
+
+// Create the request queue and the worker task
+void firebase_async_init(void) {
+    if (request_queue == NULL) {
+        request_queue = xQueueCreate(FIREBASE_ASYNC_QUEUE_LEN, sizeof(firebase_async_t *));
+    }
+    if (worker_task_handle == NULL) {
+        xTaskCreate(firebase_worker_task, "firebase_worker", FIREBASE_ASYNC_STACK_SIZE, NULL, 5, &worker_task_handle);
+    }
+}
+
+// Fill in the common fields and queue the request
+static bool submit(firebase_async_t *request, firebase_op_t op, firebase_async_cb_t on_done, void *ctx) {
+    if (request == NULL || request_queue == NULL || request->pending) {
+        ESP_LOGE(TAG, "Cannot submit request %d", op);
+        return false;
+    }
+
+    request->op = op;
+    request->on_done = on_done;
+    request->ctx = ctx;
+    request->waiter = xTaskGetCurrentTaskHandle();
+    request->result = false;
+    request->err = ESP_FAIL;
+    request->pending = true;
+
+    if (xQueueSend(request_queue, &request, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Request queue full, dropping request %d", op);
+        request->pending = false;
+        return false;
+    }
+    return true;
+}
+
+static void set_uid(firebase_async_t *request, const uint8_t *rfid_uid, uint8_t uid_size) {
+    if (uid_size > sizeof(request->rfid_uid)) {
+        uid_size = sizeof(request->rfid_uid);
+    }
+    memcpy(request->rfid_uid, rfid_uid, uid_size);
+    request->uid_size = uid_size;
+}
+
+bool firebase_async_verify_rfid(firebase_async_t *request, const uint8_t *rfid_uid, uint8_t uid_size, user_t *user,
+                                firebase_async_cb_t on_done, void *ctx) {
+    if (request == NULL || request->pending) {
+        return false;
+    }
+    set_uid(request, rfid_uid, uid_size);
+    request->user = user;
+    return submit(request, FIREBASE_OP_VERIFY_RFID, on_done, ctx);
+}
+
+bool firebase_async_sync_cards(firebase_async_t *request, firebase_async_cb_t on_done, void *ctx) {
+    return submit(request, FIREBASE_OP_SYNC_CARDS, on_done, ctx);
+}
+
+bool firebase_async_check_active_journey(firebase_async_t *request, const uint8_t *rfid_uid, uint8_t uid_size,
+                                         journey_session_t *journey, firebase_async_cb_t on_done, void *ctx) {
+    if (request == NULL || request->pending) {
+        return false;
+    }
+    set_uid(request, rfid_uid, uid_size);
+    request->journey = journey;
+    return submit(request, FIREBASE_OP_CHECK_ACTIVE_JOURNEY, on_done, ctx);
+}
+
+bool firebase_async_start_journey(firebase_async_t *request, journey_session_t *journey,
+                                  firebase_async_cb_t on_done, void *ctx) {
+    if (request == NULL || request->pending) {
+        return false;
+    }
+    request->journey = journey;
+    return submit(request, FIREBASE_OP_START_JOURNEY, on_done, ctx);
+}
+
+bool firebase_async_end_journey(firebase_async_t *request, journey_session_t *journey,
+                                firebase_async_cb_t on_done, void *ctx) {
+    if (request == NULL || request->pending) {
+        return false;
+    }
+    request->journey = journey;
+    return submit(request, FIREBASE_OP_END_JOURNEY, on_done, ctx);
+}
+
+bool firebase_async_write_journey(firebase_async_t *request, const journey_session_t *journey,
+                                  firebase_async_cb_t on_done, void *ctx) {
+    if (request == NULL || request->pending) {
+        return false;
+    }
+    request->journeys = journey;
+    request->journey_count = 1;
+    return submit(request, FIREBASE_OP_WRITE_JOURNEY, on_done, ctx);
+}
+
+bool firebase_async_write_journeys(firebase_async_t *request, const journey_session_t *journeys, size_t count,
+                                   firebase_async_cb_t on_done, void *ctx) {
+    if (request == NULL || request->pending) {
+        return false;
+    }
+    request->journeys = journeys;
+    request->journey_count = count;
+    return submit(request, FIREBASE_OP_WRITE_JOURNEYS, on_done, ctx);
+}
+
+// True once the worker has finished the request (or it was never submitted)
+bool firebase_async_is_done(const firebase_async_t *request) {
+    return !request->pending;
+}
+
+// Block the submitting task until the request is done or timeout expires
+bool firebase_async_wait(firebase_async_t *request, TickType_t timeout) {
+    TickType_t start = xTaskGetTickCount();
+
+    while (request->pending) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= timeout) {
+            return false;
+        }
+        ulTaskNotifyTake(pdTRUE, timeout - waited);
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef FIREBASE_ASYNC_H
+#define FIREBASE_ASYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "firebase.h"
+
+// Network worker settings
+#define FIREBASE_ASYNC_QUEUE_LEN 8          // Requests that can wait for the worker
+#define FIREBASE_ASYNC_STACK_SIZE 8192      // Worker stack, runs the blocking firebase_* calls
+
+// Operations the worker can run, one per blocking firebase_* call
+typedef enum {
+    FIREBASE_OP_VERIFY_RFID,
+    FIREBASE_OP_SYNC_CARDS,
+    FIREBASE_OP_CHECK_ACTIVE_JOURNEY,
+    FIREBASE_OP_START_JOURNEY,
+    FIREBASE_OP_END_JOURNEY,
+    FIREBASE_OP_WRITE_JOURNEY,
+    FIREBASE_OP_WRITE_JOURNEYS
+} firebase_op_t;
+
+typedef struct firebase_async firebase_async_t;
+
+// Completion callback, runs on the worker task right after the operation
+typedef void (*firebase_async_cb_t)(firebase_async_t *request, void *ctx);
+
+// One in-flight request. Owned by the caller and must stay valid (and its
+// in/out pointers too) until the request is done
+struct firebase_async {
+    firebase_op_t op;
+    uint8_t rfid_uid[10];
+    uint8_t uid_size;
+    user_t *user;                       // Out: verified user
+    journey_session_t *journey;         // In/out: journey to check, start or end
+    const journey_session_t *journeys;  // In: journeys to write
+    size_t journey_count;
+
+    firebase_async_cb_t on_done;
+    void *ctx;
+    TaskHandle_t waiter;                // Task notified on completion (the submitter)
+
+    volatile bool pending;              // Queued or running
+    bool result;                        // Return value of the firebase_* call
+    esp_err_t err;                      // Check active journey: ESP_ERR_NOT_FOUND when there is none,
+                                        // any other error when the lookup failed
+};
+
+// Blocking lookup behind FIREBASE_OP_CHECK_ACTIVE_JOURNEY: ESP_OK with the
+// journey, ESP_ERR_NOT_FOUND when there is none, or the lookup error. Declared
+// here because firebase.h is shared with host tools built without ESP-IDF
+esp_err_t firebase_check_active_journey(const uint8_t *rfid_uid, uint8_t uid_size, journey_session_t *journey);
+
+void firebase_async_init(void);
+
+// Submit a request; returns false if the queue is full or a previous request
+// on the same struct is still in flight. on_done may be NULL
+bool firebase_async_verify_rfid(firebase_async_t *request, const uint8_t *rfid_uid, uint8_t uid_size, user_t *user,
+                                firebase_async_cb_t on_done, void *ctx);
+bool firebase_async_sync_cards(firebase_async_t *request, firebase_async_cb_t on_done, void *ctx);
+bool firebase_async_check_active_journey(firebase_async_t *request, const uint8_t *rfid_uid, uint8_t uid_size,
+                                         journey_session_t *journey, firebase_async_cb_t on_done, void *ctx);
+bool firebase_async_start_journey(firebase_async_t *request, journey_session_t *journey,
+                                  firebase_async_cb_t on_done, void *ctx);
+bool firebase_async_end_journey(firebase_async_t *request, journey_session_t *journey,
+                                firebase_async_cb_t on_done, void *ctx);
+bool firebase_async_write_journey(firebase_async_t *request, const journey_session_t *journey,
+                                  firebase_async_cb_t on_done, void *ctx);
+bool firebase_async_write_journeys(firebase_async_t *request, const journey_session_t *journeys, size_t count,
+                                   firebase_async_cb_t on_done, void *ctx);
+
+// Completion, either polled or waited for with a timeout (from the submitting task)
+bool firebase_async_is_done(const firebase_async_t *request);
+bool firebase_async_wait(firebase_async_t *request, TickType_t timeout);
+
+#endif // FIREBASE_ASYNC_H
@@ -0,0 +1,200 @@
+#include "journey_json.h"
+#include <string.h>
+#include <time.h>
+
+// Bounded output cursor; once overflowed, further writes are dropped
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t len;
+    bool overflow;
+} json_writer_t;
+
+static void put_bytes(json_writer_t *w, const char *data, size_t len) {
+    if (w->overflow || w->len + len >= w->size) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buffer + w->len, data, len);
+    w->len += len;
+}
+
+static void put_str(json_writer_t *w, const char *str) {
+    put_bytes(w, str, strlen(str));
+}
+
+static void put_uint(json_writer_t *w, uint32_t value) {
+    char digits[10];
+    size_t pos = sizeof(digits);
+
+    do {
+        digits[--pos] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+
+    put_bytes(w, digits + pos, sizeof(digits) - pos);
+}
+
+// Ticket IDs are generated from [0-9A-Z], so they never need escaping
+static void put_ticket_id(json_writer_t *w, const journey_session_t *journey) {
+    put_bytes(w, journey->ticket_id, strnlen(journey->ticket_id, sizeof(journey->ticket_id)));
+}
+
+static void put_uid(json_writer_t *w, const journey_session_t *journey) {
+    static const char hex[] = "0123456789ABCDEF";
+    char out[sizeof(journey->rfid_uid) * 2];
+    size_t size = journey->uid_size < sizeof(journey->rfid_uid) ? journey->uid_size : sizeof(journey->rfid_uid);
+
+    for (size_t i = 0; i < size; i++) {
+        out[i * 2] = hex[journey->rfid_uid[i] >> 4];
+        out[i * 2 + 1] = hex[journey->rfid_uid[i] & 0x0F];
+    }
+    put_bytes(w, out, size * 2);
+}
+
+// ISO 8601, same format as the records written so far. A time taken before
+// the clock was set is left to the server, which stores epoch milliseconds
+static void put_timestamp(json_writer_t *w, time_t timestamp) {
+    struct tm timeinfo;
+    char out[32];
+
+    if (timestamp < FIREBASE_CLOCK_VALID_AFTER) {
+        put_str(w, "{\".sv\":\"timestamp\"}");
+        return;
+    }
+    localtime_r(&timestamp, &timeinfo);
+    size_t len = strftime(out, sizeof(out), "\"%Y-%m-%dT%H:%M:%SZ\"", &timeinfo);
+    put_bytes(w, out, len);
+}
+
+// A journey has two events, so its state alone orders them
+uint32_t journey_event_seq(const journey_session_t *journey) {
+    return journey->current_state == JOURNEY_STATE_ACTIVE ? JOURNEY_EVENT_SEQ_START : JOURNEY_EVENT_SEQ_END;
+}
+
+static void put_record(json_writer_t *w, const journey_session_t *journey) {
+    bool finished = (journey->current_state == JOURNEY_STATE_INACTIVE);
+
+    put_str(w, "{\"ticketID\":\"");
+    put_ticket_id(w, journey);
+    put_str(w, "\",\"rfidUid\":\"");
+    put_uid(w, journey);
+    put_str(w, "\",\"startTimestamp\":");
+    put_timestamp(w, journey->start_timestamp);
+    if (finished) {
+        put_str(w, ",\"endTimestamp\":");
+        put_timestamp(w, journey->end_timestamp);
+    }
+    put_str(w, ",\"originStation\":");
+    put_uint(w, journey->origin_station);
+    put_str(w, ",\"selectedClass\":");
+    put_uint(w, journey->selected_class);
+    put_str(w, ",\"selectedDestinationStation\":");
+    put_uint(w, journey->selected_destination);
+    if (finished) {
+        put_str(w, ",\"actualDestinationStation\":");
+        put_uint(w, journey->actual_destination);
+        put_str(w, ",\"travelDuration\":");
+        put_uint(w, journey->travel_duration);
+        // Events logged by older firmware carry no fare; billing prices those itself
+        if (journey->fare > 0) {
+            put_str(w, ",\"fare\":");
+            put_uint(w, journey->fare);
+        }
+        put_str(w, journey->is_fraud_suspected ? ",\"isFraudSuspected\":true" : ",\"isFraudSuspected\":false");
+    }
+    put_str(w, ",\"currentState\":");
+    put_uint(w, (uint32_t)journey->current_state);
+    // Which event of the ticket this is, so a late or repeated write can be told apart
+    put_str(w, ",\"eventSeq\":");
+    put_uint(w, journey_event_seq(journey));
+    put_str(w, ",\"eventId\":\"");
+    put_ticket_id(w, journey);
+    put_str(w, "-");
+    put_uint(w, journey_event_seq(journey));
+    put_str(w, "\"");
+    // Authoritative time the database accepted the record
+    put_str(w, ",\"recordedAt\":{\".sv\":\"timestamp\"}}");
+}
+
+static size_t finish(json_writer_t *w) {
+    if (w->overflow) {
+        if (w->size) {
+            w->buffer[0] = '\0';
+        }
+        return 0;
+    }
+    w->buffer[w->len] = '\0';
+    return w->len;
+}
+
+// Encode a single journey record
+size_t journey_json_encode(const journey_session_t *journey, char *buffer, size_t size) {
+    json_writer_t w = {.buffer = buffer, .size = size, .len = 0, .overflow = (buffer == NULL || size == 0)};
+
+    put_record(&w, journey);
+    return finish(&w);
+}
+
+static bool same_card(const journey_session_t *a, const journey_session_t *b) {
+    return a->uid_size == b->uid_size && memcmp(a->rfid_uid, b->rfid_uid, a->uid_size) == 0;
+}
+
+static bool same_ticket(const journey_session_t *a, const journey_session_t *b) {
+    return strncmp(a->ticket_id, b->ticket_id, sizeof(a->ticket_id)) == 0;
+}
+
+// Encode the multi-path update: an active journey is written together with
+// the active journey and ticket of its /cardsByUid record, a finished one
+// clears both
+size_t journey_json_encode_updates(const journey_session_t *journeys, size_t count, char *buffer, size_t size) {
+    json_writer_t w = {.buffer = buffer, .size = size, .len = 0, .overflow = (buffer == NULL || size == 0)};
+    bool first = true;
+
+    put_str(&w, "{");
+    for (size_t i = 0; i < count; i++) {
+        const journey_session_t *journey = &journeys[i];
+        bool newest_for_card = true;
+        bool newest_for_ticket = true;
+
+        // Batches are small (OUTBOX_BATCH_SIZE), a quadratic scan is cheapest
+        for (size_t j = i + 1; j < count; j++) {
+            newest_for_card = newest_for_card && !same_card(journey, &journeys[j]);
+            newest_for_ticket = newest_for_ticket && !same_ticket(journey, &journeys[j]);
+        }
+
+        if (newest_for_card) {
+            bool active = (journey->current_state == JOURNEY_STATE_ACTIVE);
+
+            put_str(&w, first ? "\"cardsByUid/" : ",\"cardsByUid/");
+            put_uid(&w, journey);
+            put_str(&w, "/activeJourney\":");
+            if (active) {
+                put_record(&w, journey);
+            } else {
+                put_str(&w, "null");
+            }
+            put_str(&w, ",\"cardsByUid/");
+            put_uid(&w, journey);
+            put_str(&w, "/activeTicketId\":");
+            if (active) {
+                put_str(&w, "\"");
+                put_ticket_id(&w, journey);
+                put_str(&w, "\"");
+            } else {
+                put_str(&w, "null");
+            }
+            first = false;
+        }
+        if (newest_for_ticket) {
+            put_str(&w, first ? "\"journeys/" : ",\"journeys/");
+            put_ticket_id(&w, journey);
+            put_str(&w, "\":");
+            put_record(&w, journey);
+            first = false;
+        }
+    }
+    put_str(&w, "}");
+
+    return finish(&w);
+}
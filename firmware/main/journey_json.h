@@ -0,0 +1,29 @@
+#ifndef JOURNEY_JSON_H
+#define JOURNEY_JSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "firebase.h"
+
+// Longest outputs, for a 10 byte UID, all end-of-journey fields and maximal numbers
+#define JOURNEY_JSON_MAX_LEN 403            // One compact journey record
+#define JOURNEY_JSON_UPDATE_MAX_LEN 942     // Record plus the card's active journey and ticket as multi-path entries
+
+// Every record carries eventSeq, which grows with each event of its ticket,
+// and eventId ("<ticketID>-<eventSeq>"), the event's idempotency key. A write
+// whose eventSeq is not above the stored one is a repeat or arrived late
+#define JOURNEY_EVENT_SEQ_START 1
+#define JOURNEY_EVENT_SEQ_END 2
+
+uint32_t journey_event_seq(const journey_session_t *journey);
+
+// Encode a journey record as compact JSON into buffer, without heap use.
+// Returns the length written (excluding the terminator) or 0 if it did not fit
+size_t journey_json_encode(const journey_session_t *journey, char *buffer, size_t size);
+
+// Encode the multi-path PATCH body for a list of journey events in log order.
+// When several events touch the same path only the newest one is written.
+// A buffer of count * JOURNEY_JSON_UPDATE_MAX_LEN + 2 bytes always suffices
+size_t journey_json_encode_updates(const journey_session_t *journeys, size_t count, char *buffer, size_t size);
+
+#endif // JOURNEY_JSON_H
@@ -0,0 +1,565 @@
+#include "journey_outbox.h"
+#include "journey_record.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "OUTBOX";
+
+#define OUTBOX_MAGIC 0x4A524E32u   // "JRN2"
+#define OUTBOX_ERASED 0xFFFFFFFFu
+#define OUTBOX_ACKED 0x00000000u
+#define OUTBOX_SLOTS_PER_SECTOR (OUTBOX_SECTOR_SIZE / OUTBOX_SLOT_SIZE)
+
+// One logged event. The acknowledgement word lives in the last 4 bytes of the
+// slot and is cleared in place (1 -> 0 bits need no erase) once Firebase has it
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint8_t type;
+    uint8_t journey[JOURNEY_RECORD_SIZE];   // Packed by journey_record_encode
+    uint32_t crc;
+} outbox_record_t;
+
+_Static_assert(sizeof(outbox_record_t) <= OUTBOX_SLOT_SIZE - sizeof(uint32_t),
+               "outbox record does not fit its slot");
+// Version 1 journey records were two bytes shorter and left those bytes as
+// erased padding. With the CRC in the same place, slots written before the
+// fare was added still verify and decode
+_Static_assert(offsetof(outbox_record_t, crc) == 56, "outbox CRC moved, older slots would be lost");
+
+// Format written by earlier firmware: the raw journey struct in 128-byte
+// slots. Only read to carry pending events over a firmware update
+#define OUTBOX_LEGACY_MAGIC 0x4A524E4Cu    // "JRNL"
+#define OUTBOX_LEGACY_SLOT_SIZE 128
+
+typedef struct {
+    char ticket_id[16];
+    uint8_t rfid_uid[10];
+    uint8_t uid_size;
+    time_t start_timestamp;
+    time_t end_timestamp;
+    uint8_t origin_station;
+    uint8_t selected_class;
+    uint8_t selected_destination;
+    uint8_t actual_destination;
+    uint32_t travel_duration;
+    bool is_fraud_suspected;
+    journey_state_t current_state;
+} legacy_journey_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t type;
+    legacy_journey_t journey;
+    uint32_t crc;
+} legacy_record_t;
+
+static const esp_partition_t *outbox_partition = NULL;
+static SemaphoreHandle_t outbox_mutex = NULL;
+static TaskHandle_t uploader_task_handle = NULL;
+
+// Ring state (guarded by outbox_mutex)
+static uint32_t slot_count = 0;
+static uint32_t head_slot = 0;      // Next slot to write
+static uint32_t tail_slot = 0;      // Oldest slot that may still be pending
+static uint32_t next_seq = 1;
+static outbox_stats_t stats;
+
+// Newest event the uploader has sent. Pending events up to it went out
+// without an answer, so they are only written conditionally from then on
+static uint32_t sent_seq = 0;
+
+// Set by a failed upload until the log drains. Events logged meanwhile reach
+// Firebase late, when the card may have moved on to a later journey at another
+// gate, so they are written conditionally too
+static bool upload_backlog = false;
+
+// Latest pending event per card, so a tap finds it without scanning the log.
+// An entry goes away once its event is acknowledged. If more cards have
+// pending events than fit, lookups fall back to scanning until the log drains
+typedef struct {
+    uint8_t rfid_uid[10];
+    uint8_t uid_size;
+    uint32_t slot;
+    uint32_t seq;
+} outbox_index_entry_t;
+
+static outbox_index_entry_t pending_index[OUTBOX_INDEX_SIZE];
+static size_t pending_index_count = 0;
+static bool pending_index_complete = true;
+
+static void uploader_task(void *pvParameter);
+
+static uint32_t record_crc(const outbox_record_t *record) {
+    return esp_rom_crc32_le(0, (const uint8_t *)record, offsetof(outbox_record_t, crc));
+}
+
+// Read a slot. Returns true for a complete record, acked tells whether it was uploaded
+static bool read_slot(uint32_t slot, outbox_record_t *record, bool *acked) {
+    uint32_t ack = OUTBOX_ERASED;
+    size_t offset = slot * OUTBOX_SLOT_SIZE;
+
+    if (esp_partition_read(outbox_partition, offset, record, sizeof(outbox_record_t)) != ESP_OK ||
+        esp_partition_read(outbox_partition, offset + OUTBOX_SLOT_SIZE - sizeof(uint32_t), &ack, sizeof(ack)) != ESP_OK) {
+        return false;
+    }
+    if (acked) {
+        *acked = (ack != OUTBOX_ERASED);
+    }
+    return record->magic == OUTBOX_MAGIC && record->crc == record_crc(record);
+}
+
+static bool slot_is_erased(uint32_t slot) {
+    uint32_t magic = 0;
+    esp_partition_read(outbox_partition, slot * OUTBOX_SLOT_SIZE, &magic, sizeof(magic));
+    return magic == OUTBOX_ERASED;
+}
+
+static outbox_index_entry_t *index_find(const uint8_t *rfid_uid, uint8_t uid_size) {
+    for (size_t i = 0; i < pending_index_count; i++) {
+        if (pending_index[i].uid_size == uid_size && memcmp(pending_index[i].rfid_uid, rfid_uid, uid_size) == 0) {
+            return &pending_index[i];
+        }
+    }
+    return NULL;
+}
+
+// Note a pending event, replacing an older one for the same card
+static void index_update(const journey_session_t *journey, uint32_t slot, uint32_t seq) {
+    if (journey->uid_size > sizeof(pending_index[0].rfid_uid)) {
+        pending_index_complete = false;
+        return;
+    }
+
+    outbox_index_entry_t *entry = index_find(journey->rfid_uid, journey->uid_size);
+    if (entry == NULL) {
+        if (pending_index_count == OUTBOX_INDEX_SIZE) {
+            pending_index_complete = false;
+            return;
+        }
+        entry = &pending_index[pending_index_count++];
+        memcpy(entry->rfid_uid, journey->rfid_uid, journey->uid_size);
+        entry->uid_size = journey->uid_size;
+    } else if (entry->seq > seq) {
+        return;
+    }
+    entry->slot = slot;
+    entry->seq = seq;
+}
+
+// Forget the card whose latest event was just acknowledged
+static void index_remove_slot(uint32_t slot) {
+    for (size_t i = 0; i < pending_index_count; i++) {
+        if (pending_index[i].slot == slot) {
+            pending_index[i] = pending_index[--pending_index_count];
+            break;
+        }
+    }
+    if (stats.pending == 0) {
+        pending_index_count = 0;
+        pending_index_complete = true;
+    }
+}
+
+// Rebuild head, tail, pending count and index from flash after a reboot
+static void recover(void) {
+    outbox_record_t record;
+    bool acked;
+    uint32_t newest_seq = 0, oldest_pending_seq = UINT32_MAX;
+    bool any = false;
+
+    for (uint32_t slot = 0; slot < slot_count; slot++) {
+        if (!read_slot(slot, &record, &acked)) {
+            continue;
+        }
+        if (!any || record.seq > newest_seq) {
+            newest_seq = record.seq;
+            head_slot = (slot + 1) % slot_count;
+            any = true;
+        }
+        if (!acked) {
+            journey_session_t journey;
+            if (journey_record_decode(record.journey, sizeof(record.journey), &journey)) {
+                index_update(&journey, slot, record.seq);
+            } else {
+                pending_index_complete = false;
+            }
+
+            stats.pending++;
+            if (record.seq < oldest_pending_seq) {
+                oldest_pending_seq = record.seq;
+                tail_slot = slot;
+            }
+        }
+    }
+
+    next_seq = newest_seq + 1;
+    // Events still pending may have been sent before the reboot
+    sent_seq = newest_seq;
+    if (stats.pending == 0) {
+        tail_slot = head_slot;
+    }
+
+    // Step over slots left half-written by a power cut
+    while (head_slot % OUTBOX_SLOTS_PER_SECTOR != 0 && !slot_is_erased(head_slot)) {
+        head_slot = (head_slot + 1) % slot_count;
+    }
+
+    ESP_LOGI(TAG, "Recovered outbox: %lu pending events, next seq %lu",
+             (unsigned long)stats.pending, (unsigned long)next_seq);
+}
+
+// Read a legacy slot. True only for a complete event that was never uploaded
+static bool read_legacy_slot(uint32_t slot, legacy_record_t *record) {
+    uint32_t ack = OUTBOX_ACKED;
+    size_t offset = slot * OUTBOX_LEGACY_SLOT_SIZE;
+
+    if (esp_partition_read(outbox_partition, offset, record, sizeof(legacy_record_t)) != ESP_OK ||
+        esp_partition_read(outbox_partition, offset + OUTBOX_LEGACY_SLOT_SIZE - sizeof(uint32_t), &ack, sizeof(ack)) != ESP_OK) {
+        return false;
+    }
+    return record->magic == OUTBOX_LEGACY_MAGIC && ack == OUTBOX_ERASED &&
+           record->crc == esp_rom_crc32_le(0, (const uint8_t *)record, offsetof(legacy_record_t, crc));
+}
+
+static bool legacy_sector_has_pending(uint32_t sector) {
+    legacy_record_t record;
+    uint32_t per_sector = OUTBOX_SECTOR_SIZE / OUTBOX_LEGACY_SLOT_SIZE;
+
+    for (uint32_t slot = sector * per_sector; slot < (sector + 1) * per_sector; slot++) {
+        if (read_legacy_slot(slot, &record)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Re-log events still pending in the legacy format, oldest first, then mark
+// each old copy uploaded. The two formats have different magics, so they can
+// share the partition while the old records are moved out. A power cut
+// mid-way at worst logs an event twice, and uploads are idempotent
+static esp_err_t migrate_legacy(void) {
+    uint32_t legacy_slots = outbox_partition->size / OUTBOX_LEGACY_SLOT_SIZE;
+    uint32_t sectors = outbox_partition->size / OUTBOX_SECTOR_SIZE;
+    legacy_record_t legacy;
+    uint32_t pending = 0, oldest_seq = UINT32_MAX, newest_seq = 0;
+    uint32_t oldest_slot = 0, newest_slot = 0;
+
+    for (uint32_t slot = 0; slot < legacy_slots; slot++) {
+        if (!read_legacy_slot(slot, &legacy)) {
+            continue;
+        }
+        pending++;
+        if (legacy.seq < oldest_seq) {
+            oldest_seq = legacy.seq;
+            oldest_slot = slot;
+        }
+        if (legacy.seq >= newest_seq) {
+            newest_seq = legacy.seq;
+            newest_slot = slot;
+        }
+    }
+    if (pending == 0) {
+        return ESP_OK;
+    }
+
+    // Without packed records yet, start where the old firmware would have
+    // written next. That sector must hold no pending events of its own
+    if (stats.pending == 0 && next_seq == 1) {
+        uint32_t sector = (newest_slot * OUTBOX_LEGACY_SLOT_SIZE / OUTBOX_SECTOR_SIZE + 1) % sectors;
+        if (legacy_sector_has_pending(sector)) {
+            ESP_LOGE(TAG, "Legacy outbox is full, cannot migrate %lu events", (unsigned long)pending);
+            return ESP_ERR_NO_MEM;
+        }
+        head_slot = tail_slot = sector * OUTBOX_SLOTS_PER_SECTOR;
+        next_seq = newest_seq + 1;
+    }
+
+    for (uint32_t i = 0; i < legacy_slots; i++) {
+        uint32_t slot = (oldest_slot + i) % legacy_slots;
+        if (!read_legacy_slot(slot, &legacy)) {
+            continue;
+        }
+
+        journey_session_t journey = {0};
+        memcpy(journey.ticket_id, legacy.journey.ticket_id, sizeof(journey.ticket_id));
+        memcpy(journey.rfid_uid, legacy.journey.rfid_uid, sizeof(journey.rfid_uid));
+        journey.uid_size = legacy.journey.uid_size;
+        journey.start_timestamp = legacy.journey.start_timestamp;
+        journey.end_timestamp = legacy.journey.end_timestamp;
+        journey.origin_station = legacy.journey.origin_station;
+        journey.selected_class = legacy.journey.selected_class;
+        journey.selected_destination = legacy.journey.selected_destination;
+        journey.actual_destination = legacy.journey.actual_destination;
+        journey.travel_duration = legacy.journey.travel_duration;
+        journey.is_fraud_suspected = legacy.journey.is_fraud_suspected;
+        journey.current_state = legacy.journey.current_state;
+
+        esp_err_t err = journey_outbox_append((outbox_event_t)legacy.type, &journey);
+        if (err != ESP_OK) {
+            return err;
+        }
+        uint32_t ack = OUTBOX_ACKED;
+        esp_partition_write(outbox_partition, slot * OUTBOX_LEGACY_SLOT_SIZE + OUTBOX_LEGACY_SLOT_SIZE - sizeof(uint32_t),
+                            &ack, sizeof(ack));
+    }
+
+    ESP_LOGI(TAG, "Migrated %lu pending events from the legacy outbox format", (unsigned long)pending);
+    return ESP_OK;
+}
+
+// Open the log partition, recover its state and start the uploader
+esp_err_t journey_outbox_init(void) {
+    if (outbox_partition != NULL) {
+        return ESP_OK;
+    }
+
+    outbox_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, OUTBOX_PARTITION_LABEL);
+    if (outbox_partition == NULL) {
+        ESP_LOGE(TAG, "Partition '%s' not found", OUTBOX_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    outbox_mutex = xSemaphoreCreateMutex();
+    slot_count = outbox_partition->size / OUTBOX_SLOT_SIZE;
+    recover();
+
+    esp_err_t err = migrate_legacy();
+    if (err != ESP_OK) {
+        // Appending could erase sectors still holding legacy events
+        outbox_partition = NULL;
+        return err;
+    }
+    ESP_LOGI(TAG, "Outbox holds %lu events of %d bytes (%d byte packed journey)",
+             (unsigned long)slot_count, OUTBOX_SLOT_SIZE, JOURNEY_RECORD_SIZE);
+
+    if (xTaskCreate(uploader_task, "outbox_uploader", 6144, NULL, 4, &uploader_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create uploader task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Durably log an event. Returns once the record is in flash
+esp_err_t journey_outbox_append(outbox_event_t type, const journey_session_t *journey) {
+    if (outbox_partition == NULL || journey == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint32_t slot_data[OUTBOX_SLOT_SIZE / sizeof(uint32_t)];
+    outbox_record_t *record = (outbox_record_t *)slot_data;
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(outbox_mutex, portMAX_DELAY);
+
+    // Entering a new sector needs an erase, which is only allowed once every
+    // event in that sector has been uploaded
+    if (head_slot % OUTBOX_SLOTS_PER_SECTOR == 0) {
+        uint32_t sector = head_slot / OUTBOX_SLOTS_PER_SECTOR;
+        if (stats.pending > 0 && tail_slot / OUTBOX_SLOTS_PER_SECTOR == sector) {
+            ESP_LOGE(TAG, "Outbox full, %lu events waiting for upload", (unsigned long)stats.pending);
+            xSemaphoreGive(outbox_mutex);
+            return ESP_ERR_NO_MEM;
+        }
+        err = esp_partition_erase_range(outbox_partition, sector * OUTBOX_SECTOR_SIZE, OUTBOX_SECTOR_SIZE);
+    }
+
+    if (err == ESP_OK) {
+        memset(slot_data, 0xFF, sizeof(slot_data));
+        record->magic = OUTBOX_MAGIC;
+        record->seq = next_seq;
+        record->type = (uint8_t)type;
+        journey_record_encode(journey, record->journey);
+        record->crc = record_crc(record);
+
+        err = esp_partition_write(outbox_partition, head_slot * OUTBOX_SLOT_SIZE, slot_data, sizeof(slot_data));
+    }
+
+    if (err == ESP_OK) {
+        if (stats.pending == 0) {
+            tail_slot = head_slot;
+        }
+        index_update(journey, head_slot, next_seq);
+        head_slot = (head_slot + 1) % slot_count;
+        next_seq++;
+        stats.appended++;
+        stats.pending++;
+    } else {
+        ESP_LOGE(TAG, "Failed to write outbox record: %s", esp_err_to_name(err));
+    }
+
+    xSemaphoreGive(outbox_mutex);
+
+    if (err == ESP_OK && uploader_task_handle) {
+        xTaskNotifyGive(uploader_task_handle);
+    }
+    return err;
+}
+
+// Oldest events still waiting for upload, in log order
+static size_t peek_batch(uint32_t *slots, outbox_record_t *records, size_t max_count) {
+    bool acked;
+    size_t count = 0;
+
+    xSemaphoreTake(outbox_mutex, portMAX_DELAY);
+
+    // Skip over events that are already uploaded
+    while (stats.pending > 0 && tail_slot != head_slot) {
+        if (read_slot(tail_slot, &records[0], &acked) && !acked) {
+            break;
+        }
+        tail_slot = (tail_slot + 1) % slot_count;
+    }
+
+    for (uint32_t slot = tail_slot; stats.pending > 0 && slot != head_slot && count < max_count;
+         slot = (slot + 1) % slot_count) {
+        if (read_slot(slot, &records[count], &acked) && !acked) {
+            slots[count++] = slot;
+        }
+    }
+    xSemaphoreGive(outbox_mutex);
+
+    return count;
+}
+
+// Mark an event as accepted by Firebase, or as dropped when it cannot be
+// decoded. Slots must be acknowledged in log order, the tail follows them
+static void acknowledge(uint32_t slot, bool uploaded) {
+    uint32_t ack = OUTBOX_ACKED;
+
+    xSemaphoreTake(outbox_mutex, portMAX_DELAY);
+    if (esp_partition_write(outbox_partition, slot * OUTBOX_SLOT_SIZE + OUTBOX_SLOT_SIZE - sizeof(uint32_t), &ack, sizeof(ack)) == ESP_OK) {
+        if (uploaded) {
+            stats.uploaded++;
+        } else {
+            stats.discarded++;
+        }
+        stats.pending--;
+        tail_slot = (slot + 1) % slot_count;
+        index_remove_slot(slot);
+    }
+    xSemaphoreGive(outbox_mutex);
+}
+
+// Drain the log to Firebase in order, coalescing up to OUTBOX_BATCH_SIZE
+// events into one multi-path PATCH. Events are acknowledged as far as Firebase
+// stored them, so a retry starts at the first one it did not confirm
+static void uploader_task(void *pvParameter) {
+    static outbox_record_t records[OUTBOX_BATCH_SIZE];
+    static journey_session_t journeys[OUTBOX_BATCH_SIZE];
+    uint32_t slots[OUTBOX_BATCH_SIZE];
+    bool decoded[OUTBOX_BATCH_SIZE];
+
+    while (1) {
+        size_t count = peek_batch(slots, records, OUTBOX_BATCH_SIZE);
+        if (count == 0) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        // Give a busy gate a moment to add more events to this batch
+        TickType_t linger_start = xTaskGetTickCount();
+        while (count < OUTBOX_BATCH_SIZE) {
+            TickType_t waited = xTaskGetTickCount() - linger_start;
+            if (waited >= pdMS_TO_TICKS(OUTBOX_BATCH_LINGER_MS)) {
+                break;
+            }
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(OUTBOX_BATCH_LINGER_MS) - waited);
+            count = peek_batch(slots, records, OUTBOX_BATCH_SIZE);
+        }
+
+        // Undecodable records are left out of the request, packing the rest
+        size_t valid = 0;
+        for (size_t i = 0; i < count; i++) {
+            decoded[i] = journey_record_decode(records[i].journey, sizeof(records[i].journey), &journeys[valid]);
+            if (decoded[i]) {
+                valid++;
+            } else {
+                ESP_LOGE(TAG, "Dropping undecodable event %lu in slot %lu",
+                         (unsigned long)records[i].seq, (unsigned long)slots[i]);
+            }
+        }
+
+        bool resend = upload_backlog || records[0].seq <= sent_seq;
+        if (records[count - 1].seq > sent_seq) {
+            sent_seq = records[count - 1].seq;
+        }
+
+        size_t written = valid > 0 ? firebase_write_journeys(journeys, valid, resend) : 0;
+
+        // Acknowledge in log order: stored events and the dropped ones before
+        // the first event Firebase did not confirm
+        size_t stored = 0;
+        for (size_t i = 0; i < count && (!decoded[i] || stored < written); i++) {
+            if (decoded[i]) {
+                stored++;
+            }
+            acknowledge(slots[i], decoded[i]);
+        }
+
+        if (written == valid) {
+            stats.batches += (valid > 0);
+            if (upload_backlog) {
+                xSemaphoreTake(outbox_mutex, portMAX_DELAY);
+                upload_backlog = (stats.pending > 0);
+                xSemaphoreGive(outbox_mutex);
+            }
+            ESP_LOGI(TAG, "Uploaded events %lu..%lu", (unsigned long)records[0].seq,
+                     (unsigned long)records[count - 1].seq);
+        } else {
+            stats.failures++;
+            upload_backlog = true;
+            ESP_LOGW(TAG, "Upload of %u events stored %u, %lu pending, retrying in %d ms",
+                     (unsigned)valid, (unsigned)written, (unsigned long)stats.pending, OUTBOX_RETRY_DELAY_MS);
+            vTaskDelay(OUTBOX_RETRY_DELAY_MS / portTICK_PERIOD_MS);
+        }
+    }
+}
+
+// Latest not yet uploaded event for a card, so a gate knows about journeys it
+// logged itself even before they reach Firebase
+bool journey_outbox_find_latest(const uint8_t *rfid_uid, uint8_t uid_size, journey_session_t *journey) {
+    outbox_record_t record;
+    journey_session_t candidate;
+    bool acked;
+    bool found = false;
+
+    if (outbox_partition == NULL) {
+        return false;
+    }
+
+    xSemaphoreTake(outbox_mutex, portMAX_DELAY);
+    if (pending_index_complete) {
+        const outbox_index_entry_t *entry = index_find(rfid_uid, uid_size);
+        found = entry != NULL && read_slot(entry->slot, &record, &acked) && !acked &&
+                journey_record_decode(record.journey, sizeof(record.journey), journey);
+        xSemaphoreGive(outbox_mutex);
+        return found;
+    }
+
+    // More cards pending than the index holds: look through the whole log
+    for (uint32_t slot = tail_slot; stats.pending > 0 && slot != head_slot; slot = (slot + 1) % slot_count) {
+        if (read_slot(slot, &record, &acked) && !acked &&
+            journey_record_decode(record.journey, sizeof(record.journey), &candidate) &&
+            candidate.uid_size == uid_size && memcmp(candidate.rfid_uid, rfid_uid, uid_size) == 0) {
+            memcpy(journey, &candidate, sizeof(journey_session_t));
+            found = true;
+        }
+    }
+    xSemaphoreGive(outbox_mutex);
+
+    return found;
+}
+
+// Copy out the outbox counters
+void journey_outbox_get_stats(outbox_stats_t *out) {
+    xSemaphoreTake(outbox_mutex, portMAX_DELAY);
+    memcpy(out, &stats, sizeof(outbox_stats_t));
+    xSemaphoreGive(outbox_mutex);
+}
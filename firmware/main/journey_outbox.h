@@ -0,0 +1,40 @@
+#ifndef JOURNEY_OUTBOX_H
+#define JOURNEY_OUTBOX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "firebase.h"
+
+// Write-ahead log settings
+#define OUTBOX_PARTITION_LABEL "journal"   // Data partition from partitions_singleapp.csv
+#define OUTBOX_SLOT_SIZE 64                // Bytes per logged event
+#define OUTBOX_SECTOR_SIZE 4096            // Flash erase unit
+#define OUTBOX_RETRY_DELAY_MS 5000         // Uploader back-off after a failed upload
+#define OUTBOX_BATCH_SIZE 8                // Events coalesced into one PATCH (1 = no batching)
+#define OUTBOX_BATCH_LINGER_MS 2000        // Longest wait for a batch to fill up
+#define OUTBOX_INDEX_SIZE 32               // Cards whose latest pending event is indexed in RAM
+
+// Logged event types
+typedef enum {
+    OUTBOX_EVENT_START_JOURNEY = 1,
+    OUTBOX_EVENT_END_JOURNEY = 2
+} outbox_event_t;
+
+// Outbox counters
+typedef struct {
+    uint32_t appended;     // Events made durable since boot
+    uint32_t uploaded;     // Events acknowledged by Firebase since boot
+    uint32_t batches;      // Successful upload requests since boot
+    uint32_t failures;     // Failed upload attempts since boot
+    uint32_t discarded;    // Undecodable events acknowledged without upload since boot
+    uint32_t pending;      // Events waiting for upload (including ones recovered at boot)
+} outbox_stats_t;
+
+esp_err_t journey_outbox_init(void);
+esp_err_t journey_outbox_append(outbox_event_t type, const journey_session_t *journey);
+bool journey_outbox_find_latest(const uint8_t *rfid_uid, uint8_t uid_size, journey_session_t *journey);
+void journey_outbox_get_stats(outbox_stats_t *stats);
+
+#endif // JOURNEY_OUTBOX_H
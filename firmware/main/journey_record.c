@@ -0,0 +1,86 @@
+#include "journey_record.h"
+#include <string.h>
+
+#define RECORD_FLAG_ACTIVE 0x01
+#define RECORD_FLAG_FRAUD 0x02
+
+#define RECORD_UID_OFFSET 2
+#define RECORD_UID_LEN 10
+#define RECORD_TICKET_OFFSET 13
+#define RECORD_TICKET_LEN 15
+#define RECORD_TIMES_OFFSET 28
+#define RECORD_STATIONS_OFFSET 40
+#define RECORD_FARE_OFFSET 44
+#define RECORD_V1_SIZE 44
+
+_Static_assert(sizeof(((journey_session_t *)0)->rfid_uid) == RECORD_UID_LEN, "UID field size changed");
+_Static_assert(sizeof(((journey_session_t *)0)->ticket_id) == RECORD_TICKET_LEN + 1, "ticket ID size changed");
+_Static_assert(RECORD_FARE_OFFSET + 2 == JOURNEY_RECORD_SIZE, "record layout and size disagree");
+
+static void put_u32(uint8_t *out, uint32_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)(value >> 16);
+    out[3] = (uint8_t)(value >> 24);
+}
+
+static uint16_t get_u16(const uint8_t *in) {
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+// Timestamps are stored as unsigned 32-bit seconds, good until 2106
+size_t journey_record_encode(const journey_session_t *journey, uint8_t *record) {
+    uint8_t uid_size = journey->uid_size < RECORD_UID_LEN ? journey->uid_size : RECORD_UID_LEN;
+
+    memset(record, 0, JOURNEY_RECORD_SIZE);
+    record[0] = JOURNEY_RECORD_VERSION;
+    record[1] = (journey->current_state == JOURNEY_STATE_ACTIVE ? RECORD_FLAG_ACTIVE : 0) |
+                (journey->is_fraud_suspected ? RECORD_FLAG_FRAUD : 0);
+    record[RECORD_UID_OFFSET] = uid_size;
+    memcpy(record + RECORD_UID_OFFSET + 1, journey->rfid_uid, uid_size);
+    memcpy(record + RECORD_TICKET_OFFSET, journey->ticket_id, strnlen(journey->ticket_id, RECORD_TICKET_LEN));
+    put_u32(record + RECORD_TIMES_OFFSET, (uint32_t)journey->start_timestamp);
+    put_u32(record + RECORD_TIMES_OFFSET + 4, (uint32_t)journey->end_timestamp);
+    put_u32(record + RECORD_TIMES_OFFSET + 8, journey->travel_duration);
+    record[RECORD_STATIONS_OFFSET] = journey->origin_station;
+    record[RECORD_STATIONS_OFFSET + 1] = journey->selected_class;
+    record[RECORD_STATIONS_OFFSET + 2] = journey->selected_destination;
+    record[RECORD_STATIONS_OFFSET + 3] = journey->actual_destination;
+    record[RECORD_FARE_OFFSET] = (uint8_t)journey->fare;
+    record[RECORD_FARE_OFFSET + 1] = (uint8_t)(journey->fare >> 8);
+
+    return JOURNEY_RECORD_SIZE;
+}
+
+// Version 1 records, still pending in the outbox after an update, decode
+// with no fare
+bool journey_record_decode(const uint8_t *record, size_t len, journey_session_t *journey) {
+    if (len < RECORD_V1_SIZE || record[RECORD_UID_OFFSET] > RECORD_UID_LEN ||
+        (record[0] != 1 && record[0] != JOURNEY_RECORD_VERSION) ||
+        (record[0] == JOURNEY_RECORD_VERSION && len < JOURNEY_RECORD_SIZE)) {
+        return false;
+    }
+
+    memset(journey, 0, sizeof(journey_session_t));
+    journey->current_state = (record[1] & RECORD_FLAG_ACTIVE) ? JOURNEY_STATE_ACTIVE : JOURNEY_STATE_INACTIVE;
+    journey->is_fraud_suspected = (record[1] & RECORD_FLAG_FRAUD) != 0;
+    journey->uid_size = record[RECORD_UID_OFFSET];
+    memcpy(journey->rfid_uid, record + RECORD_UID_OFFSET + 1, journey->uid_size);
+    memcpy(journey->ticket_id, record + RECORD_TICKET_OFFSET, RECORD_TICKET_LEN);
+    journey->start_timestamp = (time_t)get_u32(record + RECORD_TIMES_OFFSET);
+    journey->end_timestamp = (time_t)get_u32(record + RECORD_TIMES_OFFSET + 4);
+    journey->travel_duration = get_u32(record + RECORD_TIMES_OFFSET + 8);
+    journey->origin_station = record[RECORD_STATIONS_OFFSET];
+    journey->selected_class = record[RECORD_STATIONS_OFFSET + 1];
+    journey->selected_destination = record[RECORD_STATIONS_OFFSET + 2];
+    journey->actual_destination = record[RECORD_STATIONS_OFFSET + 3];
+    if (record[0] == JOURNEY_RECORD_VERSION) {
+        journey->fare = get_u16(record + RECORD_FARE_OFFSET);
+    }
+
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef JOURNEY_RECORD_H
+#define JOURNEY_RECORD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "firebase.h"
+
+// Packed binary form of a journey, as stored in the outbox
+#define JOURNEY_RECORD_VERSION 2
+#define JOURNEY_RECORD_SIZE 46
+
+// Fixed little-endian layout, version 2:
+//   0  version
+//   1  flags: bit 0 active, bit 1 fraud suspected
+//   2  UID length, then 10 UID bytes
+//  13  ticket ID, 15 characters, NUL padded
+//  28  start timestamp, end timestamp, travel duration (u32 seconds each)
+//  40  origin, class, selected destination, actual destination
+//  44  fare in rupees (u16)
+// Version 1 records are the first 44 bytes of this layout, without the fare
+size_t journey_record_encode(const journey_session_t *journey, uint8_t *record);
+
+// Returns false for an unknown version or a malformed record
+bool journey_record_decode(const uint8_t *record, size_t len, journey_session_t *journey);
+
+#endif // JOURNEY_RECORD_H
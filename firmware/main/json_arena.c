@@ -0,0 +1,86 @@
+#include "json_arena.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One document at a time is parsed into a static buffer by bumping an offset.
+// Freeing a node is a no-op; the whole arena is reset when the document is
+// released, so tap-path parsing never touches the general heap
+
+#define ARENA_ALIGN 8
+
+static uint64_t arena[JSON_ARENA_SIZE / sizeof(uint64_t)];
+static size_t arena_used = 0;
+static TaskHandle_t arena_owner = NULL;
+static SemaphoreHandle_t arena_mutex = NULL;
+static json_arena_stats_t stats;
+
+static bool in_arena(const void *ptr) {
+    return (const uint8_t *)ptr >= (const uint8_t *)arena &&
+           (const uint8_t *)ptr < (const uint8_t *)arena + sizeof(arena);
+}
+
+// Only the task holding the arena allocates from it; cJSON calls from other
+// tasks (the card stream) are passed through to the heap
+static void *arena_malloc(size_t size) {
+    if (arena_owner != NULL && arena_owner == xTaskGetCurrentTaskHandle()) {
+        size_t aligned = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+        if (aligned <= sizeof(arena) - arena_used) {
+            void *ptr = (uint8_t *)arena + arena_used;
+            arena_used += aligned;
+            return ptr;
+        }
+        stats.heap_fallbacks++;
+    }
+    return malloc(size);
+}
+
+static void arena_free(void *ptr) {
+    if (!in_arena(ptr)) {
+        free(ptr);
+    }
+}
+
+void json_arena_init(void) {
+    if (arena_mutex != NULL) {
+        return;
+    }
+    arena_mutex = xSemaphoreCreateMutex();
+    memset(&stats, 0, sizeof(stats));
+
+    cJSON_Hooks hooks = {
+        .malloc_fn = arena_malloc,
+        .free_fn = arena_free
+    };
+    cJSON_InitHooks(&hooks);
+}
+
+cJSON *json_arena_parse(const char *text) {
+    json_arena_init();
+    xSemaphoreTake(arena_mutex, portMAX_DELAY);
+    arena_owner = xTaskGetCurrentTaskHandle();
+    arena_used = 0;
+
+    cJSON *root = cJSON_Parse(text);
+
+    stats.parses++;
+    stats.last_bytes = arena_used;
+    if (arena_used > stats.peak_bytes) {
+        stats.peak_bytes = arena_used;
+    }
+    return root;
+}
+
+void json_arena_release(cJSON *root) {
+    cJSON_Delete(root);
+    arena_owner = NULL;
+    arena_used = 0;
+    xSemaphoreGive(arena_mutex);
+}
+
+void json_arena_get_stats(json_arena_stats_t *out) {
+    memcpy(out, &stats, sizeof(json_arena_stats_t));
+}
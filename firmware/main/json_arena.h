@@ -0,0 +1,30 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <stdint.h>
+#include "cJSON.h"
+
+// Bump arena for cJSON documents parsed on the tap path
+#define JSON_ARENA_SIZE 4096     // Static bytes; a card record with its active journey takes about 1.3 KB
+
+typedef struct {
+    uint32_t parses;          // Documents parsed into the arena
+    uint32_t last_bytes;      // Arena bytes used by the latest document
+    uint32_t peak_bytes;      // Most arena bytes any document needed
+    uint32_t heap_fallbacks;  // Allocations that did not fit and went to the heap
+} json_arena_stats_t;
+
+// Install the arena as cJSON's allocator. cJSON used outside
+// json_arena_parse/json_arena_release keeps allocating from the heap
+void json_arena_init(void);
+
+// Parse text with every node and string allocated from the arena. The arena
+// is held by the calling task until json_arena_release, even on NULL
+cJSON *json_arena_parse(const char *text);
+
+// Delete a document from json_arena_parse (NULL allowed) and reset the arena
+void json_arena_release(cJSON *root);
+
+void json_arena_get_stats(json_arena_stats_t *stats);
+
+#endif // JSON_ARENA_H
@@ -0,0 +1,277 @@
+#include "json_stream.h"
+#include <string.h>
+
+// Set up a tokenizer that captures the named fields of every record
+void json_stream_init(json_stream_t *stream, const char *const *fields, size_t field_count,
+                      json_record_cb_t on_record, void *ctx) {
+    memset(stream, 0, sizeof(json_stream_t));
+
+    if (field_count > JSON_STREAM_MAX_FIELDS) {
+        field_count = JSON_STREAM_MAX_FIELDS;
+    }
+    for (size_t i = 0; i < field_count; i++) {
+        stream->fields[i] = fields[i];
+    }
+    stream->field_count = field_count;
+    stream->on_record = on_record;
+    stream->ctx = ctx;
+}
+
+// Forget any partial document, e.g. before retrying a request
+void json_stream_reset(json_stream_t *stream) {
+    json_stream_t fresh;
+    json_stream_init(&fresh, stream->fields, stream->field_count, stream->on_record, stream->ctx);
+    memcpy(stream, &fresh, sizeof(json_stream_t));
+}
+
+// Captured value of field index for the current record, or NULL if absent or null
+const char *json_stream_field(const json_stream_t *stream, size_t index) {
+    if (index >= stream->field_count || !stream->present[index]) {
+        return NULL;
+    }
+    return stream->values[index];
+}
+
+static void token_append(json_stream_t *stream, char c) {
+    if (stream->token_len < JSON_STREAM_TOKEN_SIZE - 1) {
+        stream->token[stream->token_len++] = c;
+    }
+}
+
+// Append a code point as UTF-8, all of it or nothing if the token is full
+static void token_append_utf8(json_stream_t *stream, uint32_t cp) {
+    char bytes[4];
+    size_t n;
+
+    if (cp < 0x80) {
+        bytes[0] = (char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        bytes[0] = (char)(0xC0 | (cp >> 6));
+        bytes[1] = (char)(0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        bytes[0] = (char)(0xE0 | (cp >> 12));
+        bytes[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        bytes[2] = (char)(0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        bytes[0] = (char)(0xF0 | (cp >> 18));
+        bytes[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        bytes[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        bytes[3] = (char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+
+    if (stream->token_len + n <= JSON_STREAM_TOKEN_SIZE - 1) {
+        memcpy(stream->token + stream->token_len, bytes, n);
+        stream->token_len += n;
+    }
+}
+
+// A high surrogate not followed by its low half stands for nothing valid
+static void flush_surrogate(json_stream_t *stream) {
+    if (stream->high_surrogate) {
+        stream->high_surrogate = 0;
+        token_append(stream, '?');
+    }
+}
+
+// A \uXXXX code unit was read; surrogate pairs are joined into one code point
+static void on_code_unit(json_stream_t *stream, uint16_t unit) {
+    if (unit >= 0xD800 && unit <= 0xDBFF) {
+        flush_surrogate(stream);
+        stream->high_surrogate = unit;
+    } else if (unit >= 0xDC00 && unit <= 0xDFFF) {
+        if (stream->high_surrogate) {
+            uint32_t cp = 0x10000 + (((uint32_t)stream->high_surrogate - 0xD800) << 10) + (unit - 0xDC00);
+            stream->high_surrogate = 0;
+            token_append_utf8(stream, cp);
+        } else {
+            token_append(stream, '?');
+        }
+    } else {
+        flush_surrogate(stream);
+        token_append_utf8(stream, unit);
+    }
+}
+
+// Value of a hex digit, or -1
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// A complete string or literal was read
+static void on_token(json_stream_t *stream, bool is_key, bool is_literal) {
+    stream->token[stream->token_len] = '\0';
+
+    if (is_key) {
+        if (stream->depth == 1) {
+            // New record, drop the fields of the previous one
+            strcpy(stream->record_key, stream->token);
+            memset(stream->present, 0, sizeof(stream->present));
+        } else if (stream->depth == 2) {
+            strcpy(stream->field_key, stream->token);
+        }
+        return;
+    }
+
+    // Only scalar fields directly inside a record are captured
+    if (stream->depth != 2 || stream->stack[1] != '{') {
+        return;
+    }
+    // A null field reads the same as a missing one
+    bool is_null = is_literal && strcmp(stream->token, "null") == 0;
+    for (size_t i = 0; i < stream->field_count; i++) {
+        if (strcmp(stream->fields[i], stream->field_key) == 0) {
+            strcpy(stream->values[i], stream->token);
+            stream->present[i] = !is_null;
+            break;
+        }
+    }
+}
+
+// Structural character outside of any string or literal
+static void on_structural(json_stream_t *stream, char c) {
+    switch (c) {
+        case '{':
+        case '[':
+            if (stream->depth >= JSON_STREAM_MAX_DEPTH) {
+                stream->error = true;
+                return;
+            }
+            stream->stack[stream->depth++] = c;
+            stream->expect_key = (c == '{');
+            break;
+        case '}':
+        case ']':
+            if (stream->depth == 0 || stream->stack[stream->depth - 1] != (c == '}' ? '{' : '[')) {
+                stream->error = true;
+                return;
+            }
+            stream->depth--;
+            stream->expect_key = false;
+            if (stream->depth == 0) {
+                stream->complete = true;
+            }
+
+            // Closing a record object inside the root object
+            if (c == '}' && stream->depth == 1 && stream->stack[0] == '{') {
+                stream->records++;
+                if (stream->on_record && !stream->on_record(stream, stream->ctx)) {
+                    stream->stopped = true;
+                }
+            }
+            break;
+        case ':':
+            stream->expect_key = false;
+            break;
+        case ',':
+            stream->expect_key = (stream->depth > 0 && stream->stack[stream->depth - 1] == '{');
+            break;
+        case '"':
+            stream->in_string = true;
+            stream->is_key = stream->expect_key;
+            stream->token_len = 0;
+            break;
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+            break;
+        default:
+            // Number, true, false or null
+            stream->in_literal = true;
+            stream->token_len = 0;
+            token_append(stream, c);
+            break;
+    }
+}
+
+// Feed the next chunk. Returns false once parsing stopped or failed, after
+// which the rest of the document can be discarded.
+bool json_stream_feed(json_stream_t *stream, const char *data, size_t len) {
+    for (size_t i = 0; i < len && !stream->stopped && !stream->error; i++) {
+        char c = data[i];
+
+        if (stream->in_string) {
+            if (stream->unicode_left > 0) {
+                int digit = hex_value(c);
+                if (digit < 0) {
+                    stream->error = true;
+                    break;
+                }
+                stream->unicode_value = (uint16_t)((stream->unicode_value << 4) | digit);
+                if (--stream->unicode_left == 0) {
+                    on_code_unit(stream, stream->unicode_value);
+                }
+            } else if (stream->escape) {
+                stream->escape = false;
+                if (c != 'u') {
+                    flush_surrogate(stream);
+                }
+                switch (c) {
+                    case 'n': token_append(stream, '\n'); break;
+                    case 't': token_append(stream, '\t'); break;
+                    case 'r': token_append(stream, '\r'); break;
+                    case 'b': token_append(stream, '\b'); break;
+                    case 'f': token_append(stream, '\f'); break;
+                    case 'u': stream->unicode_left = 4; stream->unicode_value = 0; break;
+                    default: token_append(stream, c); break;
+                }
+            } else if (c == '\\') {
+                stream->escape = true;
+            } else if (c == '"') {
+                flush_surrogate(stream);
+                stream->in_string = false;
+                on_token(stream, stream->is_key, false);
+            } else {
+                flush_surrogate(stream);
+                token_append(stream, c);
+            }
+            continue;
+        }
+
+        if (stream->in_literal) {
+            if (c != ',' && c != '}' && c != ']' && c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+                token_append(stream, c);
+                continue;
+            }
+            stream->in_literal = false;
+            on_token(stream, false, true);
+            if (stream->depth == 0) {
+                stream->complete = true;
+            }
+        }
+
+        on_structural(stream, c);
+    }
+
+    return !stream->stopped && !stream->error;
+}
+
+// Call once the body has ended. Returns true if the document was read to its
+// end (or parsing was stopped on purpose), false if it was malformed or the
+// body was cut off mid-document
+bool json_stream_finish(json_stream_t *stream) {
+    // A bare literal such as null has no closing character of its own
+    if (stream->in_literal && stream->depth == 0) {
+        stream->in_literal = false;
+        on_token(stream, false, true);
+        stream->complete = true;
+    }
+
+    if (stream->error) {
+        return false;
+    }
+    return stream->stopped || stream->complete;
+}
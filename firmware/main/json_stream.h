@@ -0,0 +1,61 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Tokenizer limits
+#define JSON_STREAM_MAX_DEPTH 16     // Deepest nesting that is tracked
+#define JSON_STREAM_MAX_FIELDS 8     // Fields captured per record
+#define JSON_STREAM_TOKEN_SIZE 96    // Longest key or value kept (longer ones are truncated)
+
+typedef struct json_stream json_stream_t;
+
+// Called once per record of an object-of-records document such as
+// {"id1": {...}, "id2": {...}}. Return false to stop parsing.
+typedef bool (*json_record_cb_t)(json_stream_t *stream, void *ctx);
+
+// Incremental tokenizer state, fed with arbitrary chunks of a JSON document
+struct json_stream {
+    // Configuration
+    const char *fields[JSON_STREAM_MAX_FIELDS];
+    size_t field_count;
+    json_record_cb_t on_record;
+    void *ctx;
+
+    // Current record
+    char record_key[JSON_STREAM_TOKEN_SIZE];
+    char values[JSON_STREAM_MAX_FIELDS][JSON_STREAM_TOKEN_SIZE];
+    bool present[JSON_STREAM_MAX_FIELDS];
+    char field_key[JSON_STREAM_TOKEN_SIZE];
+
+    // Tokenizer
+    char stack[JSON_STREAM_MAX_DEPTH];
+    uint8_t depth;
+    bool expect_key;
+    bool in_string;
+    bool in_literal;
+    bool is_key;
+    bool escape;
+    uint8_t unicode_left;
+    uint16_t unicode_value;     // \uXXXX code unit being read
+    uint16_t high_surrogate;    // First half of a surrogate pair, waiting for the second
+    char token[JSON_STREAM_TOKEN_SIZE];
+    size_t token_len;
+
+    // Result
+    size_t records;
+    bool stopped;
+    bool error;
+    bool complete;      // The root value has been read to its end
+};
+
+void json_stream_init(json_stream_t *stream, const char *const *fields, size_t field_count,
+                      json_record_cb_t on_record, void *ctx);
+void json_stream_reset(json_stream_t *stream);
+bool json_stream_feed(json_stream_t *stream, const char *data, size_t len);
+bool json_stream_finish(json_stream_t *stream);
+const char *json_stream_field(const json_stream_t *stream, size_t index);  // NULL if absent or null
+
+#endif // JSON_STREAM_H
@@ -12,6 +12,9 @@
 #include "stations.h"
 #include "wifi_setup.h"
 #include "firebase.h"
+#include "firebase_async.h"
+#include "tap_trace.h"
+#include "esp_timer.h"
 #include "esp_sntp.h"
 
 static const char *TAG = "train-ticket-system";
@@ -53,10 +56,23 @@ typedef enum
     STATE_TRANSACTION_SUCCESSFUL
 } SystemState;
 
+// State names for the tap trace, in SystemState order
+static const char *const state_names[] = {
+    "WELCOME", "WAIT_FOR_RFID", "VERIFY_USER", "CHECK_ACTIVE_JOURNEY", "START_JOURNEY", "END_JOURNEY",
+    "SELECT_DESTINATION", "SHOW_DESTINATION", "SELECT_CLASS", "SHOW_CLASS", "CONFIRM_JOURNEY", "ERROR",
+    "TRANSACTION_SUCCESSFUL"};
+_Static_assert(sizeof(state_names) / sizeof(state_names[0]) == STATE_TRANSACTION_SUCCESSFUL + 1,
+               "state_names must name every SystemState");
+
 // Current active journey
 static journey_session_t current_journey;
 static bool has_active_journey = false;
 
+// Requests handed to the network worker, so the UI keeps running while they are in flight
+static firebase_async_t verify_request;
+static firebase_async_t journey_request;
+static bool journey_check_submitted = false;
+
 /**
  * @brief i2c master initialization
  */
@@ -81,7 +97,9 @@ void time_sync_notification_cb(struct timeval *tv)
     ESP_LOGI(TAG, "Time synchronized with NTP server");
 }
 
-// Initialize time with SNTP
+// Start SNTP in the background. Boot does not wait for it: until the first
+// sync the clock is set from the Date header of the first Firebase response,
+// and journeys logged before either are stamped by the server
 static void initialize_sntp(void)
 {
     ESP_LOGI(TAG, "Initializing SNTP");
@@ -89,33 +107,20 @@ static void initialize_sntp(void)
     esp_sntp_setservername(0, "pool.ntp.org");
     sntp_set_time_sync_notification_cb(time_sync_notification_cb);
     esp_sntp_init();
-
-    // Wait for time to be set
-    time_t now = 0;
-    struct tm timeinfo = {0};
-    int retry = 0;
-    const int retry_count = 15;
-
-    while (timeinfo.tm_year < (2020 - 1900) && ++retry < retry_count)
-    {
-        ESP_LOGI(TAG, "Waiting for system time to be set... (%d/%d)", retry, retry_count);
-        vTaskDelay(2000 / portTICK_PERIOD_MS);
-        time(&now);
-        localtime_r(&now, &timeinfo);
-    }
 }
 
 void handle_keypad_press(void)
 {
     // Short beep for keypad press
-    gpio_set_level(BUZZER_PIN, 1);       // Turn on the buzzer
-    vTaskDelay(50 / portTICK_PERIOD_MS); // Very short beep
-    gpio_set_level(BUZZER_PIN, 0);       // Turn off the buzzer
+    gpio_set_level(BUZZER_PIN, 1);                        // Turn on the buzzer
+    tap_trace_delay(TAP_TRACE_BUZZER, "key beep", 50);    // Very short beep
+    gpio_set_level(BUZZER_PIN, 0);                        // Turn off the buzzer
 }
 
 void beep_success(void)
 {
     // Double short beep for success (beep beeeep)
+    int64_t start_us = esp_timer_get_time();
     gpio_set_level(BUZZER_PIN, 1);        // Turn on the buzzer
     vTaskDelay(100 / portTICK_PERIOD_MS); // Short beep
     gpio_set_level(BUZZER_PIN, 0);        // Turn off the buzzer
@@ -123,14 +128,34 @@ void beep_success(void)
     gpio_set_level(BUZZER_PIN, 1);        // Turn on the buzzer
     vTaskDelay(300 / portTICK_PERIOD_MS); // Longer beep
     gpio_set_level(BUZZER_PIN, 0);        // Turn off the buzzer
+    tap_trace_span(TAP_TRACE_BUZZER, "success beep", start_us);
 }
 
 void beep_error(void)
 {
     // Long beep for errors or invalid operations (beeeeeeeep)
-    gpio_set_level(BUZZER_PIN, 1);        // Turn on the buzzer
-    vTaskDelay(800 / portTICK_PERIOD_MS); // Long beep
-    gpio_set_level(BUZZER_PIN, 0);        // Turn off the buzzer
+    gpio_set_level(BUZZER_PIN, 1);                          // Turn on the buzzer
+    tap_trace_delay(TAP_TRACE_BUZZER, "error beep", 800);   // Long beep
+    gpio_set_level(BUZZER_PIN, 0);                          // Turn off the buzzer
+}
+
+// Wait for a Firebase request, spinning a progress indicator in the last LCD
+// column so the display never looks frozen. The wait is traced under name
+bool wait_for_firebase(firebase_async_t *request, const char *name)
+{
+    static const char spinner[] = "|/-\\";
+    char frame[2] = {0};
+    int i = 0;
+    int64_t start_us = esp_timer_get_time();
+
+    while (!firebase_async_wait(request, 200 / portTICK_PERIOD_MS))
+    {
+        frame[0] = spinner[i++ % 4];
+        lcd_put_cur(1, 15);
+        lcd_send_string(frame);
+    }
+    tap_trace_span(TAP_TRACE_NETWORK, name, start_us);
+    return request->result;
 }
 
 // Now modify the ticket_system_task to include these functions at the appropriate points
@@ -153,6 +178,13 @@ void ticket_system_task(void *pvParameter)
     // User data
     user_t current_user;
 
+    // Whether a tap is being handled (used for per-tap connection statistics)
+    bool tap_in_progress = false;
+
+    // Last state recorded in the tap trace, and when the passenger input began
+    int traced_state = -1;
+    int64_t input_start_us = 0;
+
     // Wait for WiFi connection before proceeding
     while (!wifi_is_connected())
     {
@@ -164,13 +196,30 @@ void ticket_system_task(void *pvParameter)
 
     // Init Firebase after WiFi is connected
     firebase_init();
+    firebase_async_init();
+    tap_trace_init();
 
     while (1)
     {
+        // Trace state changes; idle card polling stays a single span
+        if (current_state != traced_state)
+        {
+            tap_trace_state(state_names[current_state]);
+            traced_state = current_state;
+        }
+
         // State machine for the ticket system
         switch (current_state)
         {
         case STATE_WELCOME:
+            // Every tap ends back here, report how many connections it needed
+            if (tap_in_progress)
+            {
+                firebase_tap_end();
+                tap_trace_tap_done();
+                tap_in_progress = false;
+            }
+
             lcd_clear();
             lcd_put_cur(1, 0);
             lcd_send_string("Scan Your Card");
@@ -182,6 +231,7 @@ void ticket_system_task(void *pvParameter)
             // Continuously check for RFID card presence
             if (rfid_card_present())
             {
+                tap_trace_mark("card");
                 lcd_stop_scroll();
 
                 // Beep to acknowledge card detection
@@ -190,7 +240,10 @@ void ticket_system_task(void *pvParameter)
                 ESP_LOGI(TAG, "RFID card detected");
 
                 // Try to read card UID
-                if (rfid_read_card_uid(card_uid, &uid_size))
+                int64_t read_start_us = esp_timer_get_time();
+                bool uid_read = rfid_read_card_uid(card_uid, &uid_size);
+                tap_trace_span(TAP_TRACE_RFID, "read uid", read_start_us);
+                if (uid_read)
                 {
                     ESP_LOGI(TAG, "Card UID read successfully");
 
@@ -206,7 +259,9 @@ void ticket_system_task(void *pvParameter)
                             card_uid[2], card_uid[3]);
                     lcd_send_string(display_buffer);
 
-                    vTaskDelay(1000 / portTICK_PERIOD_MS);
+                    tap_trace_delay(TAP_TRACE_UI, "show uid", 1000);
+                    firebase_tap_begin();
+                    tap_in_progress = true;
                     current_state = STATE_VERIFY_USER;
                 }
                 else
@@ -222,13 +277,20 @@ void ticket_system_task(void *pvParameter)
                     lcd_send_string("Card read error!");
                     lcd_put_cur(1, 0);
                     lcd_send_string("Try again!");
-                    vTaskDelay(1500 / portTICK_PERIOD_MS);
+                    tap_trace_delay(TAP_TRACE_UI, "read error", 1500);
                     current_state = STATE_WELCOME;
                 }
             }
 
-            // Add a small delay to prevent CPU hogging
-            vTaskDelay(200 / portTICK_PERIOD_MS);
+            // Add a small delay to prevent CPU hogging; after a card it is part of the tap
+            if (current_state == STATE_WAIT_FOR_RFID)
+            {
+                vTaskDelay(200 / portTICK_PERIOD_MS);
+            }
+            else
+            {
+                tap_trace_delay(TAP_TRACE_POLL, "rfid poll", 200);
+            }
             break;
 
         case STATE_VERIFY_USER:
@@ -236,10 +298,15 @@ void ticket_system_task(void *pvParameter)
             lcd_put_cur(0, 0);
             lcd_send_string("Verifying card...");
 
-            if (firebase_verify_rfid(card_uid, uid_size, &current_user))
+            firebase_async_verify_rfid(&verify_request, card_uid, uid_size, &current_user, NULL, NULL);
+            if (wait_for_firebase(&verify_request, "verify"))
             {
                 ESP_LOGI(TAG, "RFID verified for user: %s", current_user.name);
 
+                // Look the journey up while the welcome message is shown
+                journey_check_submitted = firebase_async_check_active_journey(&journey_request, card_uid, uid_size,
+                                                                              &current_journey, NULL, NULL);
+
                 // Beep for successful verification
                 beep_success();
 
@@ -249,7 +316,7 @@ void ticket_system_task(void *pvParameter)
                 lcd_put_cur(1, 0);
                 lcd_send_string(current_user.name);
 
-                vTaskDelay(1500 / portTICK_PERIOD_MS);
+                tap_trace_delay(TAP_TRACE_UI, "welcome user", 1500);
                 current_state = STATE_CHECK_ACTIVE_JOURNEY;
             }
             else
@@ -265,7 +332,7 @@ void ticket_system_task(void *pvParameter)
                 lcd_put_cur(1, 0);
                 lcd_send_string("Contact support");
 
-                vTaskDelay(2000 / portTICK_PERIOD_MS);
+                tap_trace_delay(TAP_TRACE_UI, "invalid card", 2000);
                 current_state = STATE_WELCOME;
             }
             break;
@@ -277,8 +344,34 @@ void ticket_system_task(void *pvParameter)
             lcd_put_cur(1, 0);
             lcd_send_string("status...");
 
-            // Check if user has an active journey
-            if (firebase_check_active_journey(card_uid, uid_size, &current_journey))
+            // Check if user has an active journey (usually already answered)
+            if (!journey_check_submitted)
+            {
+                journey_check_submitted = firebase_async_check_active_journey(&journey_request, card_uid, uid_size,
+                                                                              &current_journey, NULL, NULL);
+            }
+            bool journey_found = journey_check_submitted && wait_for_firebase(&journey_request, "check");
+            bool journey_unknown = !journey_found &&
+                                   (!journey_check_submitted || journey_request.err != ESP_ERR_NOT_FOUND);
+            journey_check_submitted = false;
+            if (journey_unknown)
+            {
+                // The lookup failed: starting a journey now could charge a
+                // passenger who is on their way out, so ask them to tap again
+                ESP_LOGE(TAG, "Active journey lookup failed: %s", esp_err_to_name(journey_request.err));
+
+                beep_error();
+
+                lcd_clear();
+                lcd_put_cur(0, 0);
+                lcd_send_string("Network error");
+                lcd_put_cur(1, 0);
+                lcd_send_string("Please tap again");
+
+                tap_trace_delay(TAP_TRACE_UI, "lookup failed", 2000);
+                current_state = STATE_WELCOME;
+            }
+            else if (journey_found)
             {
                 // User has an active journey
                 has_active_journey = true;
@@ -293,7 +386,7 @@ void ticket_system_task(void *pvParameter)
                 lcd_put_cur(1, 0);
                 lcd_send_string("progress...");
 
-                vTaskDelay(1500 / portTICK_PERIOD_MS);
+                tap_trace_delay(TAP_TRACE_UI, "journey in progress", 1500);
                 current_state = STATE_END_JOURNEY;
             }
             else
@@ -311,7 +404,7 @@ void ticket_system_task(void *pvParameter)
                 lcd_put_cur(1, 0);
                 lcd_send_string("journey");
 
-                vTaskDelay(1500 / portTICK_PERIOD_MS);
+                tap_trace_delay(TAP_TRACE_UI, "starting new journey", 1500);
                 current_state = STATE_SELECT_DESTINATION;
             }
             break;
@@ -323,6 +416,7 @@ void ticket_system_task(void *pvParameter)
             lcd_put_cur(1, 0);
             input_pos = 0;
             memset(input_buffer, 0, MAX_INPUT_LENGTH);
+            input_start_us = esp_timer_get_time();
 
             // Keep scanning until user presses #
             while (1)
@@ -355,7 +449,7 @@ void ticket_system_task(void *pvParameter)
                                 lcd_clear();
                                 lcd_put_cur(0, 0);
                                 lcd_send_string("Invalid number!");
-                                vTaskDelay(1500 / portTICK_PERIOD_MS);
+                                tap_trace_delay(TAP_TRACE_UI, "invalid number", 1500);
 
                                 // Return to destination selection
                                 lcd_clear();
@@ -396,6 +490,7 @@ void ticket_system_task(void *pvParameter)
 
                 vTaskDelay(50 / portTICK_PERIOD_MS);
             }
+            tap_trace_span(TAP_TRACE_INPUT, "destination", input_start_us);
             break;
 
         case STATE_SHOW_DESTINATION:
@@ -409,7 +504,7 @@ void ticket_system_task(void *pvParameter)
             display_buffer[MAX_NAME_LENGTH - 1] = '\0'; // Ensure null termination
             lcd_send_string(display_buffer);
 
-            vTaskDelay(2000 / portTICK_PERIOD_MS);
+            tap_trace_delay(TAP_TRACE_UI, "show destination", 2000);
             current_state = STATE_SELECT_CLASS;
             break;
 
@@ -420,6 +515,7 @@ void ticket_system_task(void *pvParameter)
             lcd_put_cur(1, 0);
             input_pos = 0;
             memset(input_buffer, 0, MAX_INPUT_LENGTH);
+            input_start_us = esp_timer_get_time();
 
             // Keep scanning until user presses #
             while (1)
@@ -452,7 +548,7 @@ void ticket_system_task(void *pvParameter)
                                 lcd_clear();
                                 lcd_put_cur(0, 0);
                                 lcd_send_string("Invalid class!");
-                                vTaskDelay(1500 / portTICK_PERIOD_MS);
+                                tap_trace_delay(TAP_TRACE_UI, "invalid class", 1500);
 
                                 // Return to class selection
                                 lcd_clear();
@@ -493,6 +589,7 @@ void ticket_system_task(void *pvParameter)
 
                 vTaskDelay(50 / portTICK_PERIOD_MS);
             }
+            tap_trace_span(TAP_TRACE_INPUT, "class", input_start_us);
             break;
 
         case STATE_SHOW_CLASS:
@@ -506,7 +603,7 @@ void ticket_system_task(void *pvParameter)
             display_buffer[MAX_NAME_LENGTH - 1] = '\0'; // Ensure null termination
             lcd_send_string(display_buffer);
 
-            vTaskDelay(2000 / portTICK_PERIOD_MS);
+            tap_trace_delay(TAP_TRACE_UI, "show class", 2000);
             current_state = STATE_CONFIRM_JOURNEY;
             break;
 
@@ -515,6 +612,7 @@ void ticket_system_task(void *pvParameter)
             lcd_put_cur(0, 0);
             lcd_send_string("Confirm? 1:Y 2:N");
             lcd_put_cur(1, 0);
+            input_start_us = esp_timer_get_time();
 
             while (1)
             {
@@ -537,7 +635,7 @@ void ticket_system_task(void *pvParameter)
                         lcd_clear();
                         lcd_put_cur(0, 0);
                         lcd_send_string("Cancelled");
-                        vTaskDelay(1500 / portTICK_PERIOD_MS);
+                        tap_trace_delay(TAP_TRACE_UI, "cancelled", 1500);
                         current_state = STATE_WELCOME;
                         break;
                     }
@@ -545,6 +643,7 @@ void ticket_system_task(void *pvParameter)
 
                 vTaskDelay(50 / portTICK_PERIOD_MS);
             }
+            tap_trace_span(TAP_TRACE_INPUT, "confirm", input_start_us);
             break;
 
         case STATE_START_JOURNEY:
@@ -564,7 +663,8 @@ void ticket_system_task(void *pvParameter)
             current_journey.current_state = JOURNEY_STATE_ACTIVE;
 
             // Save to Firebase
-            if (firebase_start_journey(&current_journey))
+            firebase_async_start_journey(&journey_request, &current_journey, NULL, NULL);
+            if (wait_for_firebase(&journey_request, "start"))
             {
                 ESP_LOGI(TAG, "Journey started successfully with ticket ID: %s", current_journey.ticket_id);
 
@@ -582,7 +682,7 @@ void ticket_system_task(void *pvParameter)
                 snprintf(display_buffer, sizeof(display_buffer), "ID: %.15s", current_journey.ticket_id);
                 lcd_send_string(display_buffer);
 
-                vTaskDelay(2000 / portTICK_PERIOD_MS);
+                tap_trace_delay(TAP_TRACE_UI, "journey started", 2000);
                 led_off(); // Turn off LED after 2 seconds
 
                 current_state = STATE_TRANSACTION_SUCCESSFUL;
@@ -600,7 +700,7 @@ void ticket_system_task(void *pvParameter)
                 lcd_put_cur(1, 0);
                 lcd_send_string("journey data");
 
-                vTaskDelay(2000 / portTICK_PERIOD_MS);
+                tap_trace_delay(TAP_TRACE_UI, "start error", 2000);
                 current_state = STATE_ERROR;
             }
             break;
@@ -619,11 +719,16 @@ void ticket_system_task(void *pvParameter)
             // Check for potential fraud (different destination than selected)
             current_journey.is_fraud_suspected = (current_journey.actual_destination != current_journey.selected_destination);
 
+            // Fare from the fare matrix, with the over-travel surcharge if the passenger went further
+            current_journey.fare = get_journey_fare(current_journey.origin_station, current_journey.selected_destination,
+                                                    current_journey.actual_destination, current_journey.selected_class);
+
             // Set journey state to inactive
             current_journey.current_state = JOURNEY_STATE_INACTIVE;
 
             // Save to Firebase
-            if (firebase_end_journey(&current_journey))
+            firebase_async_end_journey(&journey_request, &current_journey, NULL, NULL);
+            if (wait_for_firebase(&journey_request, "end"))
             {
                 ESP_LOGI(TAG, "Journey ended successfully");
 
@@ -632,7 +737,8 @@ void ticket_system_task(void *pvParameter)
 
                 lcd_clear();
                 lcd_put_cur(0, 0);
-                lcd_send_string("Journey ended!");
+                snprintf(display_buffer, sizeof(display_buffer), "Fare: Rs %u", (unsigned)current_journey.fare);
+                lcd_send_string(display_buffer);
 
                 // Show if destination matches or not
                 lcd_put_cur(1, 0);
@@ -647,7 +753,7 @@ void ticket_system_task(void *pvParameter)
                     lcd_send_string("Thank you!");
                 }
 
-                vTaskDelay(2500 / portTICK_PERIOD_MS);
+                tap_trace_delay(TAP_TRACE_UI, "show fare", 2500);
                 current_state = STATE_TRANSACTION_SUCCESSFUL;
             }
             else
@@ -663,7 +769,7 @@ void ticket_system_task(void *pvParameter)
                 lcd_put_cur(1, 0);
                 lcd_send_string("journey");
 
-                vTaskDelay(2000 / portTICK_PERIOD_MS);
+                tap_trace_delay(TAP_TRACE_UI, "end error", 2000);
                 current_state = STATE_ERROR;
             }
             break;
@@ -678,7 +784,7 @@ void ticket_system_task(void *pvParameter)
             // Beep to indicate error state
             beep_error();
 
-            vTaskDelay(2000 / portTICK_PERIOD_MS);
+            tap_trace_delay(TAP_TRACE_UI, "system error", 2000);
             current_state = STATE_WELCOME;
             break;
 
@@ -692,7 +798,7 @@ void ticket_system_task(void *pvParameter)
             // Beep for successful transaction
             beep_success();
 
-            vTaskDelay(2000 / portTICK_PERIOD_MS);
+            tap_trace_delay(TAP_TRACE_UI, "transaction successful", 2000);
             current_state = STATE_WELCOME;
             break;
 
@@ -701,7 +807,14 @@ void ticket_system_task(void *pvParameter)
             break;
         }
 
-        vTaskDelay(50 / portTICK_PERIOD_MS);
+        if (tap_in_progress)
+        {
+            tap_trace_delay(TAP_TRACE_POLL, "loop", 50);
+        }
+        else
+        {
+            vTaskDelay(50 / portTICK_PERIOD_MS);
+        }
     }
 }
 
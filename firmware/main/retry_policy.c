@@ -0,0 +1,74 @@
+#include "retry_policy.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+
+static const char *TAG = "RETRY";
+
+// Sort the result of one request attempt into success, transient or permanent
+retry_class_t retry_classify(esp_err_t err, int status_code) {
+    if (err == ESP_ERR_INVALID_ARG || err == ESP_ERR_INVALID_SIZE) {
+        return RETRY_PERMANENT;
+    }
+    if (err != ESP_OK) {
+        return RETRY_TRANSIENT;
+    }
+    if (status_code >= 200 && status_code < 300) {
+        return RETRY_SUCCESS;
+    }
+    if (status_code == 408 || status_code == 429 || status_code >= 500) {
+        return RETRY_TRANSIENT;
+    }
+    return RETRY_PERMANENT;
+}
+
+// Exponential backoff with equal jitter: half of the step is fixed, the other
+// half random, so gates that failed together do not retry in lockstep
+uint32_t retry_backoff_ms(const retry_policy_t *policy, int attempt) {
+    uint32_t delay = policy->base_delay_ms;
+
+    for (int i = 1; i < attempt && delay < policy->max_delay_ms; i++) {
+        delay *= 2;
+    }
+    if (delay > policy->max_delay_ms) {
+        delay = policy->max_delay_ms;
+    }
+    return delay / 2 + esp_random() % (delay / 2 + 1);
+}
+
+// Decide whether a request may go out at all
+bool breaker_allow(circuit_breaker_t *breaker) {
+    if (breaker->state == BREAKER_OPEN) {
+        int64_t open_ms = (esp_timer_get_time() - breaker->opened_at_us) / 1000;
+        if (open_ms < BREAKER_COOLDOWN_MS) {
+            breaker->rejected++;
+            return false;
+        }
+        ESP_LOGI(TAG, "Circuit half-open, probing backend");
+        breaker->state = BREAKER_HALF_OPEN;
+    }
+    return true;
+}
+
+// Feed the outcome of an attempt back. Permanent errors prove the backend is
+// reachable, so only transient failures count towards opening the breaker
+void breaker_record(circuit_breaker_t *breaker, retry_class_t result) {
+    if (result != RETRY_TRANSIENT) {
+        if (breaker->state != BREAKER_CLOSED) {
+            ESP_LOGI(TAG, "Circuit closed, backend reachable again");
+        }
+        breaker->state = BREAKER_CLOSED;
+        breaker->consecutive_failures = 0;
+        return;
+    }
+
+    breaker->consecutive_failures++;
+    if (breaker->state == BREAKER_HALF_OPEN ||
+        (breaker->state == BREAKER_CLOSED && breaker->consecutive_failures >= BREAKER_FAILURE_THRESHOLD)) {
+        ESP_LOGW(TAG, "Circuit open after %lu failures, failing fast for %d ms",
+                 (unsigned long)breaker->consecutive_failures, BREAKER_COOLDOWN_MS);
+        breaker->state = BREAKER_OPEN;
+        breaker->opened_at_us = esp_timer_get_time();
+        breaker->trips++;
+    }
+}
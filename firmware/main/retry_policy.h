@@ -0,0 +1,55 @@
+#ifndef RETRY_POLICY_H
+#define RETRY_POLICY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Circuit breaker settings
+#define BREAKER_FAILURE_THRESHOLD 4     // Consecutive failed attempts that open the breaker
+#define BREAKER_COOLDOWN_MS 30000       // Time spent failing fast before a probe request
+
+// How hard an operation may try before giving up
+typedef struct {
+    uint8_t max_attempts;       // Attempts including the first one
+    uint32_t deadline_ms;       // Budget for the whole operation, waiting and backoff included
+    uint32_t base_delay_ms;     // Backoff before the second attempt
+    uint32_t max_delay_ms;      // Cap on the exponential backoff
+    bool priority;              // Goes ahead of other requests waiting for the connection
+} retry_policy_t;
+
+// A passenger is waiting at the gate: give up quickly and fall back to offline handling
+#define RETRY_POLICY_TAP { .max_attempts = 2, .deadline_ms = 5000, .base_delay_ms = 250, .max_delay_ms = 1000, \
+                           .priority = true }
+// Background sync and uploads: nobody is waiting, be patient
+#define RETRY_POLICY_BACKGROUND { .max_attempts = 4, .deadline_ms = 30000, .base_delay_ms = 500, .max_delay_ms = 8000, \
+                                  .priority = false }
+
+// Outcome of one attempt
+typedef enum {
+    RETRY_SUCCESS = 0,
+    RETRY_TRANSIENT,    // Network error, timeout, 408, 429 or 5xx: worth another attempt
+    RETRY_PERMANENT     // Other 4xx or bad request: retrying cannot help
+} retry_class_t;
+
+typedef enum {
+    BREAKER_CLOSED = 0,   // Requests flow normally
+    BREAKER_OPEN,         // Backend considered down, requests fail fast
+    BREAKER_HALF_OPEN     // Cooldown over, one probe request is let through
+} breaker_state_t;
+
+typedef struct {
+    breaker_state_t state;
+    uint32_t consecutive_failures;
+    int64_t opened_at_us;
+    uint32_t trips;             // Times the breaker opened since boot
+    uint32_t rejected;          // Requests failed fast while open
+} circuit_breaker_t;
+
+retry_class_t retry_classify(esp_err_t err, int status_code);
+uint32_t retry_backoff_ms(const retry_policy_t *policy, int attempt);
+
+bool breaker_allow(circuit_breaker_t *breaker);
+void breaker_record(circuit_breaker_t *breaker, retry_class_t result);
+
+#endif // RETRY_POLICY_H
@@ -299,9 +299,22 @@ bool rfid_read_card_uid(uint8_t *card_uid, uint8_t *uid_size)
                 buffer[i] = rfid_read_register(FIFO_DATA_REG);
             }
             
-            *uid_size = n;
-            for (uint8_t i = 0; i < n; i++) {
-                card_uid[i] = buffer[i];
+            // Anticollision answers with the 4 UID bytes and their BCC
+            // (XOR check byte). Check it and hand back only the UID, so the
+            // gate keys cards the same way the admin page does
+            if (n != 5) {
+                status = MI_ERR;
+            } else {
+                uint8_t bcc = 0;
+                for (uint8_t i = 0; i < 4; i++) {
+                    bcc ^= buffer[i];
+                    card_uid[i] = buffer[i];
+                }
+                if (bcc != buffer[4]) {
+                    status = MI_ERR;
+                } else {
+                    *uid_size = 4;
+                }
             }
         }
     }
@@ -31,6 +31,60 @@ static const TrainClass train_classes[] = {
 #define NUM_DESTINATIONS (sizeof(destinations) / sizeof(destinations[0]))
 #define NUM_CLASSES (sizeof(train_classes) / sizeof(train_classes[0]))
 
+// Distance of each station from Colombo Fort along the Main Line, in tenths
+// of a kilometre (approximate), by station id
+#define STATION_KM10_1 729   // Polgahawela
+#define STATION_KM10_2 647   // Alawwa
+#define STATION_KM10_3 586   // Ambepussa
+#define STATION_KM10_4 555   // Botale
+#define STATION_KM10_5 509   // Wellawatte
+#define STATION_KM10_6 467   // Mirigama
+#define STATION_KM10_7 400   // Ganegoda
+#define STATION_KM10_8 362   // Veyangoda
+#define STATION_KM10_9 306   // Heendeniya
+#define STATION_KM10_10 277  // Gampaha
+#define STATION_KM10_11 204  // Ganemulla
+#define STATION_KM10_12 151  // Ragama
+#define STATION_KM10_13 100  // Enderamulla
+#define STATION_KM10_14 70   // Kelaniya
+#define STATION_KM10_15 32   // Dematagoda
+#define STATION_KM10_16 16   // Maradana
+#define STATION_KM10_17 0    // Colombo Fort
+
+// Per class: minimum fare in rupees and rate in cents per kilometre
+#define CLASS_MIN_FARE_1 100
+#define CLASS_RATE_1 1000
+#define CLASS_MIN_FARE_2 50
+#define CLASS_RATE_2 500
+#define CLASS_MIN_FARE_3 20
+#define CLASS_RATE_3 250
+
+// Fare in whole rupees: minimum fare plus distance at the class rate, rounded.
+// Everything is a constant expression, so the matrix below is built by the
+// compiler and lives in flash
+#define KM10_BETWEEN(a, b) ((a) > (b) ? (a) - (b) : (b) - (a))
+#define FARE(o, d, c) \
+    (CLASS_MIN_FARE_##c + (KM10_BETWEEN(STATION_KM10_##o, STATION_KM10_##d) * CLASS_RATE_##c + 500) / 1000)
+
+#define FARE_ROW(o, c)                                                               \
+    {FARE(o, 1, c), FARE(o, 2, c), FARE(o, 3, c), FARE(o, 4, c), FARE(o, 5, c),       \
+     FARE(o, 6, c), FARE(o, 7, c), FARE(o, 8, c), FARE(o, 9, c), FARE(o, 10, c),      \
+     FARE(o, 11, c), FARE(o, 12, c), FARE(o, 13, c), FARE(o, 14, c), FARE(o, 15, c),  \
+     FARE(o, 16, c), FARE(o, 17, c)}
+
+#define FARE_CLASS(c)                                                                \
+    {FARE_ROW(1, c), FARE_ROW(2, c), FARE_ROW(3, c), FARE_ROW(4, c), FARE_ROW(5, c),  \
+     FARE_ROW(6, c), FARE_ROW(7, c), FARE_ROW(8, c), FARE_ROW(9, c), FARE_ROW(10, c), \
+     FARE_ROW(11, c), FARE_ROW(12, c), FARE_ROW(13, c), FARE_ROW(14, c),              \
+     FARE_ROW(15, c), FARE_ROW(16, c), FARE_ROW(17, c)}
+
+// Fare by class, origin and destination, each index being the id minus one
+static const uint16_t fare_matrix[FARE_CLASS_COUNT][FARE_STATION_COUNT][FARE_STATION_COUNT] = {
+    FARE_CLASS(1), FARE_CLASS(2), FARE_CLASS(3)};
+
+_Static_assert(NUM_DESTINATIONS == FARE_STATION_COUNT, "fare matrix does not cover every station");
+_Static_assert(NUM_CLASSES == FARE_CLASS_COUNT, "fare matrix does not cover every class");
+
 // Function to get the number of destinations
 int get_number_of_destinations(void)
 {
@@ -79,4 +133,28 @@ const char *get_class_name(int id)
         }
     }
     return "Unknown";
+}
+
+// Look up the fare between two stations
+uint16_t get_fare(int origin, int destination, int class_id)
+{
+    if (origin < 1 || origin > FARE_STATION_COUNT || destination < 1 || destination > FARE_STATION_COUNT ||
+        class_id < 1 || class_id > FARE_CLASS_COUNT)
+    {
+        return 0;
+    }
+    return fare_matrix[class_id - 1][origin - 1][destination - 1];
+}
+
+// Fare charged when a journey ends
+uint16_t get_journey_fare(int origin, int selected_destination, int actual_destination, int class_id)
+{
+    uint16_t paid_for = get_fare(origin, selected_destination, class_id);
+    uint16_t travelled = get_fare(origin, actual_destination, class_id);
+
+    if (travelled <= paid_for)
+    {
+        return paid_for;
+    }
+    return travelled + (travelled - paid_for) * FARE_OVERTRAVEL_SURCHARGE_PERCENT / 100;
 }
\ No newline at end of file
@@ -1,6 +1,13 @@
 #ifndef STATIONS_H
 #define STATIONS_H
 
+#include <stdint.h>
+
+// Fare settings (Sri Lankan rupees)
+#define FARE_STATION_COUNT 17                 // Stations in the fare matrix, ids 1..17
+#define FARE_CLASS_COUNT 3                    // Classes in the fare matrix, ids 1..3
+#define FARE_OVERTRAVEL_SURCHARGE_PERCENT 100 // Extra charged on the fare beyond the destination chosen
+
 // Define destination structure
 typedef struct
 {
@@ -29,4 +36,13 @@ const TrainClass* get_train_classes(void);
 const char* get_destination_name(int id);
 const char* get_class_name(int id);
 
+// Fare between two stations in a class, from the compile-time fare matrix.
+// Returns 0 for an unknown station or class
+uint16_t get_fare(int origin, int destination, int class_id);
+
+// Fare charged at exit. A passenger who exits at or before the destination
+// chosen at entry pays for that destination; one who travels further pays
+// the journey made plus the over-travel surcharge on the difference
+uint16_t get_journey_fare(int origin, int selected_destination, int actual_destination, int class_id);
+
 #endif // STATIONS_H
\ No newline at end of file
@@ -0,0 +1,177 @@
+#include "tap_trace.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "TAP_TRACE";
+
+_Static_assert((TAP_TRACE_EVENTS & (TAP_TRACE_EVENTS - 1)) == 0, "TAP_TRACE_EVENTS must be a power of two");
+
+// A writer claims a slot by bumping head, fills it in and publishes it by
+// storing the event's sequence number last. A reader that sees the same
+// sequence number before and after copying the slot has a whole event
+typedef struct {
+    atomic_uint seq;        // Event index + 1 once written, 0 while being written
+    uint8_t category;
+    const char *name;
+    int64_t start_us;
+    uint32_t duration_us;
+} trace_event_t;
+
+static trace_event_t ring[TAP_TRACE_EVENTS];
+static atomic_uint head = 0;
+static atomic_uint taps = 0;
+
+// The state currently running, closed into a span when the next one starts
+static const char *state_name = NULL;
+static int64_t state_start_us = 0;
+
+// Dump task only
+static uint32_t dump_from = 0;
+static tap_trace_stats_t stats;
+static TaskHandle_t dump_task_handle = NULL;
+
+static const char *const category_names[TAP_TRACE_CATEGORY_COUNT] = {
+    "state", "mark", "network", "ui", "buzzer", "rfid", "input", "poll"
+};
+
+static void record(tap_trace_category_t category, const char *name, int64_t start_us, uint32_t duration_us) {
+    uint32_t index = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed);
+    trace_event_t *event = &ring[index & (TAP_TRACE_EVENTS - 1)];
+
+    atomic_store_explicit(&event->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    event->category = category;
+    event->name = name;
+    event->start_us = start_us;
+    event->duration_us = duration_us;
+    atomic_store_explicit(&event->seq, index + 1, memory_order_release);
+}
+
+// Called from the state machine's task only
+void tap_trace_state(const char *name) {
+    int64_t now_us = esp_timer_get_time();
+
+    if (state_name != NULL) {
+        record(TAP_TRACE_STATE, state_name, state_start_us, (uint32_t)(now_us - state_start_us));
+    }
+    state_name = name;
+    state_start_us = now_us;
+}
+
+void tap_trace_mark(const char *name) {
+    record(TAP_TRACE_MARK, name, esp_timer_get_time(), 0);
+}
+
+void tap_trace_span(tap_trace_category_t category, const char *name, int64_t start_us) {
+    record(category, name, start_us, (uint32_t)(esp_timer_get_time() - start_us));
+}
+
+void tap_trace_delay(tap_trace_category_t category, const char *name, uint32_t ms) {
+    int64_t start_us = esp_timer_get_time();
+    vTaskDelay(ms / portTICK_PERIOD_MS);
+    tap_trace_span(category, name, start_us);
+}
+
+void tap_trace_tap_done(void) {
+    tap_trace_mark("tap done");
+    uint32_t count = atomic_fetch_add_explicit(&taps, 1, memory_order_relaxed) + 1;
+
+    if (TAP_TRACE_DUMP_EVERY_TAPS > 0 && count % TAP_TRACE_DUMP_EVERY_TAPS == 0) {
+        tap_trace_request_dump();
+    }
+}
+
+// Copy one slot; false if it does not (or no longer) hold event index
+static bool read_event(uint32_t index, trace_event_t *out, bool *pending) {
+    trace_event_t *event = &ring[index & (TAP_TRACE_EVENTS - 1)];
+    uint32_t seq = atomic_load_explicit(&event->seq, memory_order_acquire);
+
+    out->category = event->category;
+    out->name = event->name;
+    out->start_us = event->start_us;
+    out->duration_us = event->duration_us;
+    atomic_thread_fence(memory_order_acquire);
+
+    if (seq == index + 1 && atomic_load_explicit(&event->seq, memory_order_relaxed) == seq) {
+        return true;
+    }
+    // Claimed but not published yet, unless a newer event has taken the slot since
+    *pending = atomic_load_explicit(&head, memory_order_relaxed) - index <= TAP_TRACE_EVENTS;
+    return false;
+}
+
+// Print the events recorded since the previous dump as one Chrome trace
+// document. States are on one track and everything the state machine waits
+// for on another, with nested waits (a beep inside keypad input) nesting there
+static void dump(void) {
+    uint32_t end = atomic_load_explicit(&head, memory_order_acquire);
+    uint32_t index = dump_from;
+    uint32_t printed = 0;
+
+    if (end - index > TAP_TRACE_EVENTS) {
+        stats.lost += end - index - TAP_TRACE_EVENTS;
+        index = end - TAP_TRACE_EVENTS;
+    }
+
+    printf("%s\n{\"traceEvents\":[\n", TAP_TRACE_DUMP_BEGIN);
+    for (; index != end; index++) {
+        trace_event_t event;
+        bool pending;
+
+        if (!read_event(index, &event, &pending)) {
+            if (pending) {
+                break;
+            }
+            stats.lost++;
+            continue;
+        }
+        if (event.category == TAP_TRACE_MARK) {
+            printf("{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%lld,\"pid\":1,\"tid\":1},\n",
+                   event.name, category_names[event.category], (long long)event.start_us);
+        } else {
+            printf("{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lu,\"pid\":1,\"tid\":%d},\n",
+                   event.name, category_names[event.category], (long long)event.start_us,
+                   (unsigned long)event.duration_us, event.category == TAP_TRACE_STATE ? 1 : 2);
+        }
+        printed++;
+    }
+    printf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"state\"}},\n"
+           "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"waits\"}}\n"
+           "],\"displayTimeUnit\":\"ms\",\"otherData\":{\"taps\":%lu,\"lost\":%lu}}\n%s\n",
+           (unsigned long)atomic_load(&taps), (unsigned long)stats.lost, TAP_TRACE_DUMP_END);
+
+    dump_from = index;
+    stats.dumped += printed;
+    stats.dumps++;
+}
+
+static void dump_task(void *pvParameter) {
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        dump();
+    }
+}
+
+void tap_trace_init(void) {
+    if (dump_task_handle == NULL) {
+        // Lowest priority above idle, printing never delays the gate
+        xTaskCreate(dump_task, "tap_trace_dump", TAP_TRACE_DUMP_STACK_SIZE, NULL, 1, &dump_task_handle);
+        ESP_LOGI(TAG, "Tap trace on, %d events, dump every %d taps", TAP_TRACE_EVENTS, TAP_TRACE_DUMP_EVERY_TAPS);
+    }
+}
+
+void tap_trace_request_dump(void) {
+    if (dump_task_handle != NULL) {
+        xTaskNotifyGive(dump_task_handle);
+    }
+}
+
+void tap_trace_get_stats(tap_trace_stats_t *out) {
+    memcpy(out, &stats, sizeof(tap_trace_stats_t));
+    out->recorded = atomic_load(&head);
+}
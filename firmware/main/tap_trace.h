@@ -0,0 +1,56 @@
+#ifndef TAP_TRACE_H
+#define TAP_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Timeline of the ticket state machine, kept in a ring and printed to the
+// console as Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+#define TAP_TRACE_EVENTS 256             // Ring capacity, a power of two; a tap records about 30 events
+#define TAP_TRACE_DUMP_EVERY_TAPS 4      // Taps between console dumps, 0 to dump only on request
+#define TAP_TRACE_DUMP_STACK_SIZE 3072
+#define TAP_TRACE_DUMP_BEGIN "TAP_TRACE_BEGIN"
+#define TAP_TRACE_DUMP_END "TAP_TRACE_END"
+
+// What an event measured
+typedef enum {
+    TAP_TRACE_STATE,     // The state machine entered a state (runs until the next one)
+    TAP_TRACE_MARK,      // Instant, such as a card being detected
+    TAP_TRACE_NETWORK,   // Waiting for a Firebase request
+    TAP_TRACE_UI,        // Fixed pause holding a message on the LCD
+    TAP_TRACE_BUZZER,    // Buzzer pattern
+    TAP_TRACE_RFID,      // Card reader transaction
+    TAP_TRACE_INPUT,     // Waiting for the passenger on the keypad
+    TAP_TRACE_POLL,      // State machine loop pacing
+    TAP_TRACE_CATEGORY_COUNT
+} tap_trace_category_t;
+
+typedef struct {
+    uint32_t recorded;   // Events recorded since boot
+    uint32_t dumped;     // Events printed by dumps
+    uint32_t lost;       // Events overwritten before a dump reached them
+    uint32_t dumps;
+} tap_trace_stats_t;
+
+// Start the low priority task that prints dumps
+void tap_trace_init(void);
+
+// Record events; safe from any task without locks. name must be a string
+// that outlives the ring, normally a literal
+void tap_trace_state(const char *name);
+void tap_trace_mark(const char *name);
+void tap_trace_span(tap_trace_category_t category, const char *name, int64_t start_us);
+
+// vTaskDelay recorded as a span of the given category
+void tap_trace_delay(tap_trace_category_t category, const char *name, uint32_t ms);
+
+// Mark the end of a tap and request a dump every TAP_TRACE_DUMP_EVERY_TAPS
+void tap_trace_tap_done(void);
+
+// Print the events recorded since the previous dump from the dump task, so
+// the console output never holds up the state machine
+void tap_trace_request_dump(void);
+
+void tap_trace_get_stats(tap_trace_stats_t *stats);
+
+#endif // TAP_TRACE_H
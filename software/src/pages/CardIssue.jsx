@@ -1,8 +1,33 @@
 import { useEffect, useState } from 'react';
-import { ref, get, update, remove } from 'firebase/database';
+import { ref, get, update, serverTimestamp } from 'firebase/database';
 import { db } from '../firebase';
 import './CardIssue.css';
 
+// Normalize a typed UID the way the gates do (card_uid_key_from_string):
+// optional 0x prefix, ':' '-' and space separators ignored, a trailing BCC
+// after a 4-byte UID dropped once checked. Returns uppercase hex for a 4, 7
+// or 10 byte UID, or null for anything else
+const normalizeUid = (input) => {
+    let text = input.trim();
+    if (/^0x/i.test(text)) {
+        text = text.slice(2);
+    }
+    const digits = text.replace(/[:\- ]/g, '').toUpperCase();
+    if (!/^[0-9A-F]*$/.test(digits)) {
+        return null;
+    }
+
+    if (digits.length === 10) {
+        let bcc = 0;
+        for (let i = 0; i < 10; i += 2) {
+            bcc ^= parseInt(digits.slice(i, i + 2), 16);
+        }
+        return bcc === 0 ? digits.slice(0, 8) : null;
+    }
+
+    return [8, 14, 20].includes(digits.length) ? digits : null;
+};
+
 const CardIssue = () => {
     const [applications, setApplications] = useState([]);
     const [selectedApplication, setSelectedApplication] = useState(null);
@@ -32,9 +57,27 @@ const CardIssue = () => {
             return;
         }
 
+        // Card record keyed like the gates key it: UID bytes as uppercase hex
+        const uidKey = normalizeUid(rfidUid);
+        if (!uidKey) {
+            alert('RFID UID must be 4, 7 or 10 bytes of hex.');
+            return;
+        }
+
         if (selectedApplication) {
-            const applicationRef = ref(db, `rfidApplications/${selectedApplication.id}`);
-            await update(applicationRef, { rfidUid, status: 'approved' });
+            const applicationPath = `rfidApplications/${selectedApplication.id}`;
+            const cardPath = `cardsByUid/${uidKey}`;
+
+            // One atomic multi-path update; the card's active journey fields,
+            // maintained by the gates, are left untouched
+            await update(ref(db), {
+                [`${applicationPath}/rfidUid`]: uidKey,
+                [`${applicationPath}/status`]: 'approved',
+                [`${applicationPath}/updatedAt`]: serverTimestamp(),
+                [`${cardPath}/status`]: 'approved',
+                [`${cardPath}/name`]: selectedApplication.name,
+                [`${cardPath}/userId`]: selectedApplication.id
+            });
             alert('Card issued successfully!');
             setApplications(applications.filter(app => app.id !== selectedApplication.id));
             setSelectedApplication(null);
@@ -45,8 +88,11 @@ const CardIssue = () => {
     // Handle RFID Card Rejection
     const handleReject = async () => {
         if (selectedApplication) {
+            // Mark the application rejected instead of deleting it, so gates
+            // syncing changes since their last updatedAt watermark also see
+            // the rejection; the applicant's details are kept
             const applicationRef = ref(db, `rfidApplications/${selectedApplication.id}`);
-            await remove(applicationRef);
+            await update(applicationRef, { status: 'rejected', updatedAt: serverTimestamp() });
             alert('Application rejected.');
             setApplications(applications.filter(app => app.id !== selectedApplication.id));
             setSelectedApplication(null);